@@ -35,11 +35,20 @@ void ofApp::setup()
     // currently basic.ics is being downloaded from here
     // "https://www.google.com/calendar/ical/christopherbaker.net_91ul9n5dq2b6pkmin511q3bq14%40group.calendar.google.com/public/basic.ics";
 
+    // TZIDs a calendar references but does not define are resolved from a
+    // prebuilt index of the addon's zoneinfo, which is opened before any
+    // calendar loads.  bin/data/zoneinfo.bin is compiled from
+    // libs/libical/share/libical/zoneinfo with ICalendarZoneInfo::compile().
+    if (!ICalendarZoneInfo::getDefault()->open(ofToDataPath("zoneinfo.bin", true)))
+    {
+        ofLogError("ofApp::setup()") << "The zoneinfo index could not be opened, TZIDs that a calendar does not define are resolved by libical.";
+    }
+
     // update it every minute
     calendar = ICalendar::makeShared("basic.ics", 60000);
 
+    // load it now, later reloads happen on the shared refresh scheduler
     calendar->reload();
-    calendar->startThread();
 
     watcher = ICalendarWatcher::makeShared(calendar);
     
@@ -0,0 +1,302 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <libical/ical.h>
+#include "Poco/Timestamp.h"
+#include "ofx/Time/ICalendarChangeSet.h"
+#include "ofx/Time/ICalendarEventIndex.h"
+#include "ofx/Time/ICalendarTimezoneTable.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A flattened, columnar table of the VEVENTs in a calendar.
+///
+/// The table is filled in a single pass over a VCALENDAR component and
+/// stores the frequently queried VEVENT fields in contiguous arrays (one
+/// row per VEVENT, in document order when compiled).  Reading the table
+/// does not touch libical's property lists and does not allocate.
+///
+/// String fields are interned into a single character pool, so identical
+/// summaries or locations are stored once.  Missing string fields are
+/// returned as empty strings and missing times as 0.
+///
+/// The table stores pointers into the compiled icalcomponent, so it must be
+/// recompiled (or cleared) whenever that component is modified or freed,
+/// unless it is replaced with merge().
+///
+/// merge() keeps existing rows stable: modified VEVENTs are read again in
+/// place, added VEVENTs are appended and removed VEVENTs leave an empty row
+/// behind (see isRemoved()).  Empty rows and superseded strings are
+/// reclaimed the next time the table is compiled.
+class CompiledCalendar
+{
+public:
+    /// \brief Create an empty table.
+    CompiledCalendar();
+
+    /// \brief Destroys the table.
+    virtual ~CompiledCalendar();
+
+    /// \brief Rebuild the table from all VEVENTs in the given calendar.
+    /// \param pCalendar the VCALENDAR component to compile, may be 0.
+    void compile(icalcomponent* pCalendar);
+
+    /// \brief Merge an updated calendar into a compiled calendar.
+    ///
+    /// The table is moved to pUpdate, which replaces the compiled calendar.
+    /// VEVENTs are matched by UID and RECURRENCE-ID and each matched row is
+    /// pointed at its VEVENT in pUpdate.  A matched VEVENT is considered
+    /// modified iff its SEQUENCE or LAST-MODIFIED differs, or iff pUpdate
+    /// changes the VTIMEZONE of its DTSTART, in which case its row is read
+    /// again.  Unmatched VEVENTs in pUpdate are appended,
+    /// rows whose VEVENTs are missing from pUpdate are removed and VEVENTs
+    /// without a UID are removed from pUpdate and freed.
+    ///
+    /// The previously compiled calendar is neither read nor modified, so it
+    /// may still be in use, e.g. by an older ICalendarSnapshot, and the
+    /// caller frees it when it is no longer needed.
+    ///
+    /// Rows of unmodified VEVENTs are not read again, so VEVENTs that change
+    /// without a new SEQUENCE or LAST-MODIFIED keep their old row fields
+    /// while libical reads of pUpdate show the new content.  Feeds that do
+    /// not maintain these properties should be compiled from scratch
+    /// instead.
+    ///
+    /// \param pUpdate the updated VCALENDAR component.
+    /// \param changes the change set to fill.
+    void merge(icalcomponent* pUpdate, ICalendarChangeSet& changes);
+
+    /// \brief Remove all rows from the table.
+    void clear();
+
+    /// \brief Exchange the contents of two tables without copying.
+    ///
+    /// This lets a table be compiled on another thread and then installed
+    /// in constant time.
+    ///
+    /// \param other the table to swap with.
+    void swap(CompiledCalendar& other);
+
+    /// \returns the number of rows in the table, including removed rows.
+    std::size_t size() const;
+
+    /// \returns true iff the table has no rows.
+    bool empty() const;
+
+    /// \returns the number of removed rows in the table.
+    std::size_t getNumRemoved() const;
+
+    /// \returns true iff more than half of the rows were removed or
+    /// modified since the table was last compiled.
+    bool isFragmented() const;
+
+    /// \returns true iff the VEVENT for the given row was removed by a merge.
+    bool isRemoved(std::size_t row) const;
+
+    /// \brief Find the row of the first VEVENT with the given UID.
+    /// \param uid the UID to find.
+    /// \returns the row or ICalendarEventIndex::NO_ROW if not found.
+    std::size_t find(const std::string& uid) const;
+
+    /// \returns the VEVENT component for the given row.
+    icalcomponent* getComponent(std::size_t row) const;
+
+    /// \returns the UID for the given row or an empty string if the VEVENT
+    /// has no UID.
+    const char* getUID(std::size_t row) const;
+
+    /// \returns the length of the UID for the given row.
+    std::size_t getUIDLength(std::size_t row) const;
+
+    /// \returns the SUMMARY for the given row.
+    const char* getSummary(std::size_t row) const;
+
+    /// \returns the LOCATION for the given row.
+    const char* getLocation(std::size_t row) const;
+
+    /// \returns the DTSTART for the given row in epoch microseconds.
+    Poco::Timestamp::TimeVal getStart(std::size_t row) const;
+
+    /// \returns the DTEND for the given row in epoch microseconds.
+    Poco::Timestamp::TimeVal getEnd(std::size_t row) const;
+
+    /// \returns the LAST-MODIFIED for the given row in epoch microseconds.
+    Poco::Timestamp::TimeVal getLastModified(std::size_t row) const;
+
+    /// \returns the RECURRENCE-ID for the given row in epoch microseconds or
+    /// 0 if none exists.
+    Poco::Timestamp::TimeVal getRecurrenceID(std::size_t row) const;
+
+    /// \returns the SEQUENCE for the given row or -1 if none exists.
+    int getSequence(std::size_t row) const;
+
+    /// \returns true iff the VEVENT for the given row has an RRULE or RDATE.
+    bool hasRecurrence(std::size_t row) const;
+
+    /// \returns the offset table of the DTSTART timezone for the given row,
+    /// or 0 if DTSTART is a date, floating or UTC.
+    const ICalendarTimezoneTable* getTimezoneTable(std::size_t row) const;
+
+    /// \returns the most recent LAST-MODIFIED of any top-level component in
+    /// the calendar in epoch microseconds, or 0 if none exists.
+    Poco::Timestamp::TimeVal getLastModified() const;
+
+private:
+    /// \brief A map of interned strings to their pool offsets.
+    typedef std::unordered_map<std::string, std::size_t> StringOffsets;
+
+    /// \brief A map of TZIDs to their offset tables.
+    typedef std::unordered_map<std::string, ICalendarTimezoneTable::SharedPtr> TimezoneTables;
+
+    /// \brief Append a row for a VEVENT and index its UID.
+    /// \param pComponent the VEVENT component.
+    /// \param pOffsets the strings interned so far, or 0 to not intern.
+    /// \returns the new row.
+    std::size_t append(icalcomponent* pComponent, StringOffsets* pOffsets);
+
+    /// \brief Read all fields except the UID of a row from its VEVENT.
+    /// \param row the row to fill.
+    /// \param pOffsets the strings interned so far, or 0 to not intern.
+    void fill(std::size_t row, StringOffsets* pOffsets);
+
+    /// \brief Remove a row's UID from the index and clear the row.
+    /// \param row the row to remove.
+    void remove(std::size_t row);
+
+    /// \brief Find the row with the given UID and RECURRENCE-ID.
+    /// \returns the row or ICalendarEventIndex::NO_ROW if not found.
+    std::size_t find(const char* pUID,
+                     std::size_t length,
+                     Poco::Timestamp::TimeVal recurrenceID) const;
+
+    /// \brief Copy a string into the pool, reusing an identical copy.
+    /// \param pString the string to intern, may be 0.
+    /// \param pOffsets the strings interned so far, or 0 to always copy.
+    /// \returns the pool offset of the interned string.
+    std::size_t intern(const char* pString, StringOffsets* pOffsets);
+
+    /// \brief Find the offset table of a VEVENT's DTSTART timezone.
+    /// \param pComponent the VEVENT component.
+    /// \param dtstart the DTSTART of the component.
+    /// \returns the table or an empty pointer if none applies.
+    ICalendarTimezoneTable::SharedPtr findTimezoneTable(icalcomponent* pComponent,
+                                                        const struct icaltimetype& dtstart);
+
+    /// \returns the UID of a component or 0 if none exists.
+    static const char* getUID(icalcomponent* pComponent);
+
+    /// \returns the SEQUENCE of a component or -1 if none exists.
+    static int getSequence(icalcomponent* pComponent);
+
+    /// \returns the LAST-MODIFIED of a component in epoch microseconds or 0
+    /// if none exists.
+    static Poco::Timestamp::TimeVal getLastModified(icalcomponent* pComponent);
+
+    /// \brief Convert a libical time to epoch microseconds.
+    /// \returns the converted time or 0 if the time is null or invalid.
+    static Poco::Timestamp::TimeVal toTimeVal(struct icaltimetype time);
+
+    /// \brief The VEVENT components.
+    std::vector<icalcomponent*> _components;
+
+    /// \brief The pool offsets of the UIDs.
+    std::vector<std::size_t> _uids;
+
+    /// \brief The lengths of the UIDs.
+    std::vector<std::size_t> _uidLengths;
+
+    /// \brief The pool offsets of the SUMMARYs.
+    std::vector<std::size_t> _summaries;
+
+    /// \brief The pool offsets of the LOCATIONs.
+    std::vector<std::size_t> _locations;
+
+    /// \brief The DTSTARTs in epoch microseconds.
+    std::vector<Poco::Timestamp::TimeVal> _starts;
+
+    /// \brief The DTENDs in epoch microseconds.
+    std::vector<Poco::Timestamp::TimeVal> _ends;
+
+    /// \brief The LAST-MODIFIEDs in epoch microseconds.
+    std::vector<Poco::Timestamp::TimeVal> _lastModifieds;
+
+    /// \brief The RECURRENCE-IDs in epoch microseconds.
+    std::vector<Poco::Timestamp::TimeVal> _recurrenceIDs;
+
+    /// \brief The SEQUENCEs.
+    std::vector<int> _sequences;
+
+    /// \brief Non-zero for rows with an RRULE or RDATE.
+    std::vector<unsigned char> _recurrences;
+
+    /// \brief The offset tables of the DTSTART timezones.
+    std::vector<ICalendarTimezoneTable::SharedPtr> _timezones;
+
+    /// \brief The next row with the same UID, or NO_ROW.
+    ///
+    /// The index maps a UID to the first of its rows, so together they form
+    /// a list of all VEVENTs (e.g. RECURRENCE-ID overrides) sharing a UID.
+    std::vector<std::size_t> _nextRows;
+
+    /// \brief The interned, NUL-terminated string pool.
+    ///
+    /// Offset 0 always holds the empty string.
+    std::vector<char> _strings;
+
+    /// \brief An index from UID to the first row with that UID.
+    ICalendarEventIndex _index;
+
+    /// \brief The offset tables found so far, by TZID.
+    ///
+    /// A table is kept for its TZID until the table is recompiled or merge()
+    /// finds a different VTIMEZONE for the TZID.
+    TimezoneTables _timezoneTables;
+
+    /// \brief The most recent LAST-MODIFIED in the calendar.
+    Poco::Timestamp::TimeVal _lastModified;
+
+    /// \brief The number of removed rows.
+    std::size_t _numRemoved;
+
+    /// \brief The number of rows removed or modified since compile().
+    std::size_t _numStale;
+
+    // The cache writes and restores the columns as they are.
+    friend class ICalendarSnapshotCache;
+
+};
+
+
+} } // namespace ofx::Time
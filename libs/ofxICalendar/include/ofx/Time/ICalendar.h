@@ -26,19 +26,30 @@
 #pragma once
 
 
+#include <atomic>
+#include <istream>
 #include <string>
 #include <cstring>
 #include <map>
 #include <libical/ical.h>
 #include "Poco/File.h"
+#include "Poco/RunnableAdapter.h"
 #include "Poco/Thread.h"
 #include "Poco/Timestamp.h"
 #include "Poco/Timezone.h"
 #include "Poco/Timer.h"
 #include "Poco/URI.h"
 #include "ofx/Time/ICalendarInterface.h"
+#include "ofx/Time/ICalendarChangeSet.h"
 #include "ofx/Time/ICalendarEvent.h"
+#include "ofx/Time/CompiledCalendar.h"
 #include "ofx/Time/ICalendarEventInstance.h"
+#include "ofx/Time/ICalendarExpansionPool.h"
+#include "ofx/Time/ICalendarInstanceIndex.h"
+#include "ofx/Time/ICalendarRefreshScheduler.h"
+#include "ofx/Time/ICalendarSnapshot.h"
+#include "ofx/Time/ICalendarSnapshotCache.h"
+#include "ofx/Time/ICalendarWriter.h"
 #include "ofx/Time/Interval.h"
 #include "ofUtils.h"
 #include "ofURLFileLoader.h"
@@ -52,9 +63,16 @@ namespace Time {
 
     
 /// \brief The ICalendar class implements the RFC 2445 icalendar format.
-class ICalendar:
-    public ICalendarInterface,
-    public ofThread
+///
+/// The parsed calendar is held in an immutable ICalendarSnapshot that is
+/// replaced atomically whenever the calendar is parsed or merged.  All
+/// const query methods acquire the current snapshot without locking and may
+/// be called from any thread.  Methods that change the calendar are
+/// serialized with each other.
+///
+/// Auto-refreshed calendars are reloaded by the threads of the shared
+/// ICalendarRefreshScheduler rather than by a thread of their own.
+class ICalendar: public ICalendarInterface
 {
 public:
     /// \brief A shared pointer typedef.
@@ -69,6 +87,24 @@ public:
     /// \brief A collection of events.
     typedef std::vector<ICalendarEventInstance> EventInstances;
 
+    /// \brief Counters describing the outcome of reload() calls.
+    struct ReloadStatistics
+    {
+        /// \brief The number of reloads attempted.
+        uint64_t reloads;
+
+        /// \brief The number of reloads skipped because the fetched content
+        /// was identical to the last content parsed.
+        uint64_t unchanged;
+
+        /// \brief The number of reloads skipped because the server
+        /// answered a conditional request with 304 Not Modified.
+        uint64_t notModified;
+
+        /// \brief The number of reloads that failed to load or parse.
+        uint64_t failures;
+    };
+
     /// \brief Creates a calendar with the given uri.
     /// \param uri the uri of the calnedar.
     /// \param autoRefreshInterval the automatic refresh interval.
@@ -76,7 +112,10 @@ public:
 
     /// \brief Copy constructor.
     ///
-    /// This copy constructor manages the internal libical objects.
+    /// This copy constructor manages the internal libical objects.  The
+    /// copy shares the other calendar's content and auto refresh interval
+    /// but is not scheduled for refresh until setAutoRefreshInterval() is
+    /// called on it.
     ICalendar(const ICalendar& other);
 
     /// \brief Assignment.
@@ -119,6 +158,9 @@ public:
     /// If no URI has been loaded, no auto updates will be attempted.
     /// Auto update is disabled if the interval is set to 0.
     ///
+    /// The next reload is scheduled one interval from now.  Call reload()
+    /// to load the calendar immediately.
+    ///
     /// \param autoRefreshInterval automatic refresh interval in milliseconds.
     void setAutoRefreshInterval(unsigned long long autoRefreshInterval);
 
@@ -127,12 +169,63 @@ public:
     /// or 0 if auto refresh is disabled.
     unsigned long long getAutoRefreshInterval() const;
 
+    /// \brief Set the instance cache horizon.
+    ///
+    /// When the horizon is greater than 0, all event instances that lie
+    /// within the horizon before and after the current time are expanded
+    /// once per parse and stored in an interval tree.  Instance queries that
+    /// lie within the cached horizon are answered from the tree; all other
+    /// queries expand the recurrences of every event.  The cache is
+    /// disabled if the horizon is set to 0.
+    ///
+    /// \param horizon the horizon on either side of now in milliseconds.
+    void setInstanceCacheHorizon(unsigned long long horizon);
+
+    /// \brief Get the instance cache horizon.
+    /// \returns the number of milliseconds on either side of now that are
+    /// cached, or 0 if the instance cache is disabled.
+    unsigned long long getInstanceCacheHorizon() const;
+
+    /// \brief Enable or disable incremental updates.
+    ///
+    /// When enabled, auto-refreshed buffers are merged into the current
+    /// calendar with merge() rather than replacing it with parse().
+    /// Incremental updates are disabled by default, because feeds that do
+    /// not maintain SEQUENCE or LAST-MODIFIED will not be updated correctly.
+    ///
+    /// \param incrementalUpdates true to merge auto-refreshed buffers.
+    void setIncrementalUpdates(bool incrementalUpdates);
+
+    /// \returns true iff auto-refreshed buffers are merged incrementally.
+    bool getIncrementalUpdates() const;
+
+    /// \brief Set the path of the snapshot cache.
+    ///
+    /// Once a path is set, every snapshot that a parse, merge or reload
+    /// produces is written to it with ICalendarSnapshotCache::save(),
+    /// after the instance index has been built for the current horizon.
+    /// Both happen on a background thread; if snapshots are produced
+    /// faster than they are written, only the newest one is written.
+    /// If no calendar is loaded yet, the cached snapshot is loaded and
+    /// published immediately, along with the validators of its content, so
+    /// the calendar can be queried before its URI has been fetched and the
+    /// first reload can be conditional.  Copies of a calendar do not write
+    /// the cache.
+    ///
+    /// \param path the path of the cache file, or an empty string to
+    ///        disable the cache.
+    void setCachePath(const std::string& path);
+
+    /// \returns the path of the snapshot cache or an empty string if the
+    /// cache is disabled.
+    std::string getCachePath() const;
+
     /// \brief Loads data from a text buffer containing an icalendar file.
     ///
     /// The buffered data must conform to the RFC 2445 specification.
-    /// If the user is manually parsing a buffer (as opposed to using
-    /// a URI and auto refresh interval, the user must be certain to
-    /// maintain thread safety.  Additionally, the user must disable
+    /// The new snapshot is published immediately and may be called from
+    /// any thread.  If the user is manually parsing a buffer (as opposed to
+    /// using a URI and auto refresh interval), the user must disable
     /// auto refresh by setting the URI to an empty string and / or
     /// setting the auto update interval to 0.
     ///
@@ -140,6 +233,54 @@ public:
     /// \returns true iff successful.
     bool parse(const ofBuffer& buffer);
 
+    /// \brief Loads data from a stream containing an icalendar file.
+    ///
+    /// The stream is read and parsed in chunks, so only one content line
+    /// and the parsed calendar are held in memory.  The same requirements
+    /// as parse(const ofBuffer&) apply.
+    ///
+    /// \param stream the stream to read icalendar data from until it ends.
+    /// \returns true iff successful.
+    bool parse(std::istream& stream);
+
+    /// \brief Merges data from a text buffer into the current calendar.
+    ///
+    /// VEVENTs are matched by UID and RECURRENCE-ID and only those with a
+    /// new SEQUENCE or LAST-MODIFIED are replaced.  Added VEVENTs are
+    /// appended and missing VEVENTs are removed.  The compiled event table
+    /// and the instance cache are updated for the changed events only.
+    /// If no calendar is loaded, this is equivalent to parse().
+    ///
+    /// The current snapshot is not modified.  The merge is applied to a
+    /// clone of it, which is then published.  The same requirements as
+    /// parse() apply.
+    ///
+    /// \param buffer the buffer containing icalendar data to merge.
+    /// \returns true iff successful.
+    bool merge(const ofBuffer& buffer);
+
+    /// \brief Get the changes made by the last parse or merge.
+    /// \returns the change set of the current snapshot.
+    ICalendarChangeSet getLastChangeSet() const;
+
+    /// \brief Get the reload statistics.
+    ///
+    /// Each reload() of an http(s) URI sends the ETag and Last-Modified
+    /// validators of the last response with the current content as
+    /// If-None-Match and If-Modified-Since.  A 304 Not Modified response is
+    /// counted as not modified.  Otherwise the fetched content is hashed
+    /// before it is parsed.  If the hash matches the last content that was
+    /// successfully parsed, the parse and the snapshot swap are skipped, the
+    /// response's validators are kept for the next request and the reload
+    /// is counted as unchanged.
+    ///
+    /// Conditional requests need openFrameworks 0.10 or later, which
+    /// exposes HTTP headers.  With older versions only the hash is
+    /// compared.
+    ///
+    /// \returns the counters accumulated since construction.
+    ReloadStatistics getReloadStatistics() const;
+
     /// \returns the calendar's product id
     /// (e.g. -//Google Inc//Google Calendar 70.9054//EN)
     /// or an empty std::string if no PRODID field exists.
@@ -189,6 +330,11 @@ public:
     /// All event recurrences are checked for overlap.
     Events getEvents(const Poco::Timestamp& timestamp) const;
 
+    /// \brief Get the event instances that overlap with a range.
+    ///
+    /// Large calendars expand their VEVENTs on the shared expansion pool.
+    /// The instances are in the same order either way.
+    ///
     /// \returns all event instances that overlap with the given range.
     EventInstances getEventInstances(const Interval& interval) const;
 
@@ -196,13 +342,48 @@ public:
     EventInstances getEventInstances(const Poco::Timestamp& timestamp) const;
 
     /// \brief Get the raw icalcomponent pointer.
+    ///
+    /// The pointer is owned by the current snapshot and is only valid until
+    /// the calendar is replaced.  Use getSnapshot() to keep it alive.
+    ///
     /// \returns a pointer the underlying libicalcomponent.
     icalcomponent* getComponent();
 
     /// \brief Get the raw icalcomponent pointer.
+    ///
+    /// The pointer is owned by the current snapshot and is only valid until
+    /// the calendar is replaced.  Use getSnapshot() to keep it alive.
+    ///
     /// \returns a pointer to the the underlying libicalcomponent.
     icalcomponent* getComponent() const;
 
+    /// \brief Get the VEVENT component for a given event uid.
+    ///
+    /// The lookup uses the compiled event table's hash index, so it runs in
+    /// constant time rather than scanning every VEVENT in the calendar.
+    ///
+    /// \param uid the uid of the VEVENT to find.
+    /// \returns 0 iff a VEVENT with the given UID is NOT found or a pointer
+    /// to the VEVENT icalcomponent if found.
+    icalcomponent* getEventComponentForUID(const std::string& uid) const;
+
+    /// \brief Get the calendar generation.
+    ///
+    /// The generation changes each time a new snapshot is published.
+    ///
+    /// \returns the generation of the current snapshot or 0 if no calendar
+    /// is loaded.
+    uint64_t getGeneration() const;
+
+    /// \brief Get the current snapshot of the calendar.
+    ///
+    /// The snapshot is immutable and stays valid for as long as the
+    /// returned pointer is held, even if the calendar is replaced.
+    ///
+    /// \returns the current snapshot or an empty pointer if no calendar is
+    /// loaded.
+    ICalendarSnapshot::SharedPtr getSnapshot() const;
+
     /// \brief Passes the internal icalcomponent text to the output stream.
     ///
     /// (e.g. std::cout << myCalendar << std::endl will dump the
@@ -219,67 +400,283 @@ public:
     /// \brief The default update interval updating the watch.
     static const Poco::Timespan DEFAULT_UPDATE_INTERVAL;
 
-    /// \brief The thread function used for auto updates.
-    virtual void threadedFunction()
-    {
-        while (isThreadRunning())
-        {
-            Poco::Timestamp now;
-
-            if (_autoUpdateInterval > 0 && now >= _nextUpdate)
-            {
-                reload();
-                _nextUpdate = now + _autoUpdateInterval * Poco::Timespan::MILLISECONDS;
-            }
-
-            sleep(1000);
-        }
-    }
+    /// \brief The default instance cache horizon.
+    static const Poco::Timespan DEFAULT_INSTANCE_CACHE_HORIZON;
 
     /// \brief Reload the calendar from the URI.
-    void reload()
-    {
-        if (!_uri.empty())
-        {
-            // cout << "reloading calendar." << endl;
-            ofBuffer buffer;
-
-            if (loadURI(_uri, buffer))
-            {
-                //cout << "success!." << endl;
-
-                ofScopedLock lock(_mutex);
-                _calendarBuffer = buffer; // lock while we set the buffer
-            }
-            else
-            {
-                //cout << "not successsful." << endl;
-
-            }
-        }
-    }
+    ///
+    /// The calendar is downloaded, parsed, compiled (or merged) into a new
+    /// snapshot on the calling thread (usually a refresh scheduler thread).
+    /// The snapshot becomes current during the next ofEvents().update,
+    /// which only swaps pointers, see publishPendingSnapshot().  A snapshot
+    /// that has not become current yet is replaced by a newer one.
+    void reload();
+
+    /// \brief Make the snapshot built by the last reload() current.
+    ///
+    /// The snapshot and the validators of its content become current
+    /// together, so conditional requests and content hashes always
+    /// describe the content that readers see.  This is called during every
+    /// ofEvents().update.  Applications without an openFrameworks update
+    /// loop, e.g. headless tools and tests, call it themselves after
+    /// reload().
+    ///
+    /// \returns true iff a pending snapshot became current.
+    bool publishPendingSnapshot();
+
+    /// \brief Reload the calendar now and then every auto refresh interval.
+    ///
+    /// ICalendar used to be an ofThread that reloaded the calendar on its
+    /// own thread once started.  Calendars are now scheduled on the shared
+    /// ICalendarRefreshScheduler when they are created, so this only
+    /// reschedules the calendar with its first reload due immediately.
+    /// Nothing is scheduled if the auto refresh interval is 0.
+    ///
+    /// \param mutexBlocks ignored.
+    /// \param verbose ignored.
+    /// \deprecated Calendars are reloaded by the ICalendarRefreshScheduler.
+    void startThread(bool mutexBlocks = true, bool verbose = false);
+
+    /// \brief Stop reloading the calendar.
+    ///
+    /// This waits for a reload in progress, like waitForThread().  Call
+    /// setAutoRefreshInterval() or startThread() to resume.
+    /// \deprecated Use setAutoRefreshInterval(0) instead.
+    void stopThread();
+
+    /// \brief Stop reloading the calendar and wait for a reload in
+    /// progress.
+    /// \param callStopThread ignored, the calendar is always unscheduled.
+    /// \deprecated Use setAutoRefreshInterval(0) instead.
+    void waitForThread(bool callStopThread = true);
+
+    /// \returns true iff the calendar is scheduled for auto refresh.
+    /// \deprecated Use getAutoRefreshInterval() instead.
+    bool isThreadRunning() const;
 
 private:
-    /// \brief The underlying libical representation of the calendar.
+    /// \brief Expands runs of VEVENT rows over an interval.
+    class ExpansionJob;
+
+    /// \brief The current snapshot.
+    ///
+    /// Accessed with std::atomic_load() and std::atomic_store() only.
+    ICalendarSnapshot::SharedPtr _snapshot;
+
+    /// \brief The snapshot built by reload() that becomes current during
+    /// the next update().
     ///
-    /// The C++ wrapper manages the memory internally.
-    icalcomponent* _pICalendar;
+    /// Accessed with std::atomic_load(), std::atomic_exchange() and
+    /// std::atomic_store() only, and only replaced under _mutex.
+    ICalendarSnapshot::SharedPtr _pendingSnapshot;
 
     /// \brief The URI of the store.
     Poco::URI _uri;
 
-    /// \brief A record of the nextupdate;
-    Poco::Timestamp _nextUpdate;
-
     /// \brief An automatic update interval.
     unsigned long long _autoUpdateInterval;
 
-    /// \brief A string buffer to hold the auto-refreshed ICalendar buffer.
-    ofBuffer _calendarBuffer;
+    /// \brief The scheduler that reloads the calendar.
+    ///
+    /// It is held so that it outlives the calendar.
+    ICalendarRefreshScheduler::SharedPtr _scheduler;
+
+    /// \brief The pool that expands event recurrences.
+    ///
+    /// It is held so that it outlives the calendar.
+    ICalendarExpansionPool::SharedPtr _expansionPool;
+
+    /// \brief The instance cache horizon in milliseconds.
+    std::atomic<unsigned long long> _instanceCacheHorizon;
 
-    /// \brief The mutex used to prevent simultaneous calls to parse.
+    /// \brief True iff auto-refreshed buffers are merged.
+    ///
+    /// This is read by reload() on the auto refresh thread.
+    std::atomic<bool> _incrementalUpdates;
+
+    /// \brief The mutex used to serialize changes to the calendar.
+    ///
+    /// Readers never take this mutex.
     mutable ofMutex _mutex;
 
+    /// \brief Values that identify the content of the current calendar.
+    typedef ICalendarSnapshotCache::Validators ContentValidators;
+
+    /// \brief The result of loading a calendar.
+    enum LoadStatus
+    {
+        /// \brief The content was loaded.
+        LOAD_OK,
+        /// \brief The content hash matched the current calendar.
+        LOAD_UNCHANGED,
+        /// \brief The server responded with 304 Not Modified.
+        LOAD_NOT_MODIFIED,
+        /// \brief The content could not be loaded or parsed.
+        LOAD_FAILED
+    };
+
+    /// \brief The validators of the current calendar.
+    ///
+    /// Guarded by _mutex.
+    ContentValidators _validators;
+
+    /// \brief The validators of the pending snapshot.
+    ///
+    /// They become current with the pending snapshot.  Guarded by _mutex.
+    ContentValidators _pendingValidators;
+
+    /// \brief The number of reloads attempted.
+    std::atomic<uint64_t> _reloads;
+
+    /// \brief The number of reloads skipped because of unchanged content.
+    std::atomic<uint64_t> _unchangedReloads;
+
+    /// \brief The number of reloads skipped because of a 304 response.
+    std::atomic<uint64_t> _notModifiedReloads;
+
+    /// \brief The number of reloads that failed.
+    std::atomic<uint64_t> _failedReloads;
+
+    /// \brief The path of the snapshot cache, or an empty string.
+    ///
+    /// Guarded by _mutex.
+    std::string _cachePath;
+
+    /// \brief The mutex guarding the cache writer.
+    ofMutex _cacheMutex;
+
+    /// \brief The newest snapshot waiting to be written to the cache, if
+    /// any.
+    ///
+    /// Guarded by _cacheMutex.
+    ICalendarSnapshot::SharedPtr _pendingCacheSnapshot;
+
+    /// \brief The validators of _pendingCacheSnapshot.
+    ///
+    /// Guarded by _cacheMutex.
+    ContentValidators _pendingCacheValidators;
+
+    /// \brief The generation of the newest snapshot queued for the cache.
+    ///
+    /// Guarded by _cacheMutex.
+    uint64_t _cacheGeneration;
+
+    /// \brief True while _cacheThread is writing queued snapshots.
+    ///
+    /// Guarded by _cacheMutex.
+    bool _isWritingCache;
+
+    /// \brief Runs writeCache() on _cacheThread.
+    Poco::RunnableAdapter<ICalendar> _cacheWriter;
+
+    /// \brief The thread that writes the snapshot cache.
+    Poco::Thread _cacheThread;
+
+    /// \brief Record the validators of the current calendar.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param validators the validators of the content.
+    void setValidators(const ContentValidators& validators);
+
+    /// \returns a copy of the validators of the current calendar.
+    ContentValidators getValidators() const;
+
+    /// \brief Check the content hash of the current calendar.
+    /// \param contentHash the content hash to compare.
+    /// \returns true iff contentHash matches the hash of the content that
+    /// produced the current calendar.
+    bool isContentUnchanged(uint64_t contentHash) const;
+
+    /// \brief Build and publish the instance index of a snapshot.
+    /// \param snapshot the snapshot to index.
+    /// \param window the horizon to expand instances within.
+    /// \returns the published index.
+    ICalendarSnapshot::InstanceIndexPtr buildInstanceIndex(const ICalendarSnapshot& snapshot,
+                                                           const Interval& window) const;
+
+    /// \brief Queue a snapshot to be written to the snapshot cache, if a
+    /// path is set.
+    ///
+    /// The snapshot is written by writeCache() on _cacheThread, so parse()
+    /// and merge() do not wait for the file.  Only the newest queued
+    /// snapshot is written, and a snapshot older than one already queued is
+    /// ignored, so an older snapshot never replaces a newer one.
+    ///
+    /// \param snapshot the snapshot to write.
+    /// \param validators the validators of the snapshot's content.
+    void saveCache(const ICalendarSnapshot::SharedPtr& snapshot,
+                   const ContentValidators& validators);
+
+    /// \brief Write queued snapshots to the snapshot cache until none is
+    /// left.
+    ///
+    /// The instance index is built first if the instance cache is enabled
+    /// and the snapshot has none.
+    void writeCache();
+
+    /// \brief Get the window around now that the instance cache expands.
+    /// \param horizon the instance cache horizon in milliseconds.
+    /// \returns the window.
+    static Interval getInstanceCacheWindow(unsigned long long horizon);
+
+    /// \brief Make validators for an unconditionally loaded buffer.
+    /// \param buffer the buffer.
+    /// \returns validators holding the hash of the buffer.
+    static ContentValidators makeValidators(const ofBuffer& buffer);
+
+    /// \brief Find an HTTP response header.
+    /// \param response the HTTP response.
+    /// \param name the case-insensitive name of the header.
+    /// \returns the header value or an empty string if it is not found.
+    static std::string getHeader(const ofHttpResponse& response,
+                                 const std::string& name);
+
+    /// \brief Parse a buffer in place with an ICalendarParser.
+    /// \param buffer the buffer to parse.
+    /// \returns the parsed calendar or 0 on failure.
+    static icalcomponent* parseBuffer(const ofBuffer& buffer);
+
+    /// \brief Resolve the TZIDs a parsed calendar references but does not
+    /// define.
+    ///
+    /// The VTIMEZONEs are cloned from the base snapshot, if it has them, or
+    /// taken from ICalendarZoneInfo::getDefault().  They are added to a new
+    /// component and pCalendar is added to it as a subcomponent, so libical
+    /// finds them without pCalendar being modified.  See
+    /// ICalendarSnapshot::getTimezones().
+    ///
+    /// \param pCalendar the parsed calendar.
+    /// \param pBase the snapshot pCalendar replaces, or 0.
+    /// \returns the new parent of pCalendar, or 0 if no VTIMEZONE was
+    ///          found.
+    static icalcomponent* resolveTimezones(icalcomponent* pCalendar,
+                                           const ICalendarSnapshot* pBase);
+
+    /// \brief Make a snapshot from a parsed calendar.
+    ///
+    /// TZIDs the calendar does not define are resolved with
+    /// resolveTimezones() first, as they are by mergeSnapshot().
+    ///
+    /// \param pCalendar the parsed calendar.  The snapshot takes ownership.
+    /// \returns the new snapshot.
+    static ICalendarSnapshot::SharedPtr makeSnapshot(icalcomponent* pCalendar);
+
+    /// \brief Make a snapshot by merging a parsed calendar into an existing
+    /// snapshot.
+    ///
+    /// The parsed calendar becomes the new snapshot's calendar, so the base
+    /// calendar is not cloned.  A copy of the base's compiled table and
+    /// instance index is updated for the changed rows only.  TZIDs pUpdate
+    /// no longer defines are resolved from the base with resolveTimezones().
+    ///
+    /// \param base the snapshot to merge into.  It is not modified.
+    /// \param pUpdate the calendar to merge.  Ownership is taken; it is
+    ///        freed if nothing changed.
+    /// \returns the new snapshot, or base if nothing changed.
+    static ICalendarSnapshot::SharedPtr mergeSnapshot(const ICalendarSnapshot::SharedPtr& base,
+                                                      icalcomponent* pUpdate);
+
     /// \brief A callback for the ofApp to keep everything in the main thread.
     ///
     /// Is automatically registered and unregistered upon ICalendar construction
@@ -290,18 +687,45 @@ private:
     // \param timer is the poco timer that was used.
     // void onAutoUpdate(Poco::Timer& timer);
 
-    /// \brief Loads a URI to a string
-    bool loadURI(const Poco::URI& uri, ofBuffer& buffer);
+    /// \brief Loads and parses the calendar at a URI.
+    ///
+    /// Local files are memory-mapped and parsed in place.  Remote
+    /// calendars are downloaded with loadURI() and parsed in place.  The
+    /// content is hashed before it is parsed and is not parsed if the hash
+    /// matches the content of the current calendar.
+    ///
+    /// \param uri the URI to load.
+    /// \param validators is set to the validators of the loaded content.
+    /// \param status is set to the result of the load.
+    /// \returns the parsed calendar or 0 unless status is LOAD_OK.
+    icalcomponent* loadComponent(const Poco::URI& uri,
+                                 ContentValidators& validators,
+                                 LoadStatus& status);
+
+    /// \brief Loads a URI to a buffer.
+    ///
+    /// Requests to http(s) URIs are conditional on the validators of the
+    /// current calendar with openFrameworks 0.10 or later.
+    ///
+    /// \param uri the URI to load.
+    /// \param buffer is set to the loaded content.
+    /// \param validators is set to the HTTP validators of the response.
+    /// \returns LOAD_OK, LOAD_NOT_MODIFIED or LOAD_FAILED.
+    LoadStatus loadURI(const Poco::URI& uri,
+                       ofBuffer& buffer,
+                       ContentValidators& validators);
 
 };
 
 
 inline std::ostream& operator << (std::ostream& os, const ICalendar& calendar)
 {
-    if (calendar.isLoaded())
+    ICalendarSnapshot::SharedPtr snapshot = calendar.getSnapshot();
+
+    if (snapshot)
     {
-        char* pString = icalcomponent_as_ical_string(calendar._pICalendar);
-        os.write(pString, std::strlen(pString));
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        ICalendarWriter::write(os, snapshot->getComponent());
     }
 
     return os;
@@ -0,0 +1,104 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief ICalendarChangeSet describes how a calendar changed during a merge.
+///
+/// The change set is filled by ICalendar::merge().  When the calendar was
+/// replaced rather than merged (e.g. by ICalendar::parse()), isReplaced()
+/// is true and the UID lists are empty; all derived state must then be
+/// rebuilt.
+class ICalendarChangeSet
+{
+public:
+    /// \brief Creates an empty ICalendarChangeSet.
+    ICalendarChangeSet(): replaced(false)
+    {
+    }
+
+    /// \brief Destroys an ICalendarChangeSet.
+    virtual ~ICalendarChangeSet()
+    {
+    }
+
+    /// \brief Remove all changes.
+    void clear()
+    {
+        replaced = false;
+        added.clear();
+        modified.clear();
+        removed.clear();
+        rows.clear();
+    }
+
+    /// \returns true iff the calendar was neither replaced nor changed.
+    bool empty() const
+    {
+        return !replaced &&
+               added.empty() &&
+               modified.empty() &&
+               removed.empty() &&
+               rows.empty();
+    }
+
+    /// \returns true iff the calendar was replaced rather than merged.
+    bool isReplaced() const
+    {
+        return replaced;
+    }
+
+    /// \brief True iff the calendar was replaced rather than merged.
+    bool replaced;
+
+    /// \brief The UIDs of added VEVENTs.
+    std::vector<std::string> added;
+
+    /// \brief The UIDs of VEVENTs whose SEQUENCE or LAST-MODIFIED changed.
+    std::vector<std::string> modified;
+
+    /// \brief The UIDs of removed VEVENTs.
+    std::vector<std::string> removed;
+
+    /// \brief The CompiledCalendar rows of all added, modified and removed
+    /// VEVENTs.
+    ///
+    /// This is empty if the compiled table was rebuilt after the merge, in
+    /// which case rows may have been renumbered.
+    std::vector<std::size_t> rows;
+
+};
+
+
+} } // namespace ofx::Time
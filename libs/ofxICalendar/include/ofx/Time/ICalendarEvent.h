@@ -32,6 +32,7 @@
 #include "Poco/Timestamp.h"
 #include "ofx/Time/ICalendarInterface.h"
 #include "ofx/Time/ICalendarUtils.h"
+#include "ofx/Time/ICalendarWriter.h"
 #include "ofx/Time/Interval.h"
 #include "ofx/Time/Utils.h"
 #include "ofLog.h"
@@ -45,6 +46,9 @@ namespace Time {
 ///
 /// The ICalendarEvent class stores a VEVENT object and provides access to event
 /// information including recurrances.
+///
+/// Each getter reads from the parent's current ICalendarSnapshot, so events
+/// may be queried from any thread.
 class ICalendarEvent
 {
 public:
@@ -185,6 +189,10 @@ public:
     ///
     /// Returned component is not cloned.  The parent retains ownership.
     ///
+    /// This performs a linear search of the parent's VEVENTs.  When an
+    /// ICalendar is available, ICalendar::getEventComponentForUID() uses
+    /// a hash index and should be preferred.
+    ///
     /// \returns 0 iff a VEVENT in the parent with the given UID is NOT found or
     /// a pointer to the VEVENT icalcomponent within the parent if found.
     static icalcomponent* getEventComponentForUID(icalcomponent* parent,
@@ -207,38 +215,50 @@ private:
     /// \brief The event's uid
     std::string _uid;
 
+    /// \brief Get this event's row in a snapshot's compiled table.
+    ///
+    /// The row is looked up in the table's UID index on every call rather
+    /// than cached, so a const ICalendarEvent is never modified and may be
+    /// read from several threads.
+    ///
+    /// \param pSnapshot the snapshot to look in, may be 0.
+    /// \returns the row or ICalendarEventIndex::NO_ROW if the event was not
+    /// found.
+    std::size_t getRow(const ICalendarSnapshot* pSnapshot) const;
+
     /// \brief Get this event's icalcomponent.
-    /// \returns a pointer to this event's icalcomponent.
-    icalcomponent* getEventComponent() const;
+    ///
+    /// The caller must hold the snapshot's mutex while using the component.
+    ///
+    /// \param pSnapshot the snapshot to look in, may be 0.
+    /// \returns a pointer to this event's icalcomponent or 0 if not found.
+    icalcomponent* getEventComponent(const ICalendarSnapshot* pSnapshot) const;
 
     /// \brief A helper method for getting properties as strings.
     /// \param kind The icalproperty_kind that the user is seeking.
     /// \returns the string representing the property value.
     std::string getProperty(icalproperty_kind kind) const;
 
-    /// \param component the internal icalcomponent returned with the callback.
-    /// \param timeSpan the icaltime_span returned with the callback.
-    /// \param data the user data returned with the callback.
-    /// \return The internal callback for querying recurrance information.
-    static void recurrencesCallback(icalcomponent* component,
-                                    struct icaltime_span* timeSpan,
-                                    void* data);
-
     // The Calendar class is allowed to create Event
     // classes using the private Event constructor.
     friend class ICalendar;
 
+    // Instances read the UID without copying it.
+    friend class ICalendarEventInstance;
+
 };
 
 
 inline std::ostream& operator << (std::ostream& os, const ICalendarEvent& event)
 {
-    icalcomponent* evt = event.getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = event._pParent->getSnapshot();
+
+    icalcomponent* evt = event.getEventComponent(snapshot.get());
 
     if (evt)
     {
-        char* pString = icalcomponent_as_ical_string(evt);
-        os.write(pString, std::strlen(pString));
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        ICalendarWriter::write(os, evt);
     }
 
     return os;
@@ -0,0 +1,140 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief An open-addressing hash index from VEVENT UIDs to table rows.
+///
+/// Inserted UIDs are copied into a key pool owned by the index, so callers
+/// may discard or move their own copies.  Erased keys are not reclaimed
+/// from the pool until the index is reset or cleared.
+///
+/// When multiple VEVENTs share a UID (e.g. a recurring event and its
+/// RECURRENCE-ID overrides), the first inserted row is kept.
+class ICalendarEventIndex
+{
+public:
+    /// \brief Create an empty index.
+    ICalendarEventIndex();
+
+    /// \brief Destroys the index.
+    virtual ~ICalendarEventIndex();
+
+    /// \brief Remove all entries and size the table for the given count.
+    /// \param count the number of UIDs that will be inserted.
+    void reset(std::size_t count);
+
+    /// \brief Remove all entries from the index.
+    void clear();
+
+    /// \brief Exchange the contents of two indexes without copying.
+    /// \param other the index to swap with.
+    void swap(ICalendarEventIndex& other);
+
+    /// \brief Insert a UID unless it is already present.
+    /// \param pUID a pointer to the UID characters.
+    /// \param length the number of characters in the UID.
+    /// \param row the row to associate with the UID.
+    /// \returns true iff the entry was inserted.
+    bool insert(const char* pUID, std::size_t length, std::size_t row);
+
+    /// \brief Remove a UID from the index.
+    /// \param pUID a pointer to the UID characters.
+    /// \param length the number of characters in the UID.
+    /// \returns true iff the UID was found and removed.
+    bool erase(const char* pUID, std::size_t length);
+
+    /// \brief Find the row associated with the given UID.
+    /// \param uid the UID to find.
+    /// \returns the matching row or NO_ROW if not found.
+    std::size_t find(const std::string& uid) const;
+
+    /// \brief Find the row associated with the given UID.
+    /// \param pUID a pointer to the UID characters.
+    /// \param length the number of characters in the UID.
+    /// \returns the matching row or NO_ROW if not found.
+    std::size_t find(const char* pUID, std::size_t length) const;
+
+    /// \returns the number of indexed UIDs.
+    std::size_t size() const;
+
+    /// \returns true iff the index has no entries.
+    bool empty() const;
+
+    /// \brief The value returned by find() when a UID is not indexed.
+    static const std::size_t NO_ROW;
+
+private:
+    /// \brief A single slot in the open-addressing table.
+    struct Entry
+    {
+        /// \brief The cached hash of the UID.
+        uint64_t hash;
+
+        /// \brief The offset of the UID characters in the key pool.
+        std::size_t offset;
+
+        /// \brief The length of the UID string.
+        std::size_t length;
+
+        /// \brief The row associated with this UID.
+        ///
+        /// An empty slot has a NO_ROW row.
+        std::size_t row;
+    };
+
+    /// \brief Find the slot for the given UID.
+    /// \returns the slot holding the UID or the empty slot where it belongs.
+    std::size_t findSlot(const char* pUID,
+                         std::size_t length,
+                         uint64_t hash) const;
+
+    /// \brief Grow the table so it can hold the given number of entries.
+    void reserve(std::size_t count);
+
+    /// \brief The slots. The size is always zero or a power of two.
+    std::vector<Entry> _entries;
+
+    /// \brief The pool of UID characters.
+    std::vector<char> _keys;
+
+    /// \brief The number of occupied slots.
+    std::size_t _size;
+
+};
+
+
+} } // namespace ofx::Time
@@ -28,6 +28,7 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 #include <libical/ical.h>
 #include "Poco/Timestamp.h"
 #include "ofx/Time/ICalendarEvent.h"
@@ -73,37 +74,75 @@ public:
     /// is a valid interval for this instance.
     bool isValidEventInstance() const;
 
-    /// \returns true iff all fields of the
-    /// ICalendarEventInstance are exactly the same.
+    /// \brief Get the occurrence key of this instance.
+    ///
+    /// The key is a hash of the event's UID and the instance's start, so
+    /// every occurrence of a recurring event has its own key.
+    ///
+    /// \returns the 64-bit occurrence key.
+    uint64_t getOccurrenceKey() const;
+
+    /// \brief Determine if two instances are the same occurrence.
+    ///
+    /// Occurrence keys are hashes, so two distinct occurrences may share a
+    /// key.  This also compares the UIDs and starts the keys were made of.
+    ///
+    /// \param other the instance to compare with.
+    /// \returns true iff both instances belong to the same event and start
+    ///          at the same time.
+    bool isSameOccurrence(const ICalendarEventInstance& other) const;
+
+    /// \returns true iff both instances are the same occurrence and have
+    /// the same interval.
     bool operator == (const ICalendarEventInstance& other) const;
 
-    /// \returns true iff all fields of the
-    /// ICalendarEventInstance not exactly the same.
+    /// \returns true iff the instances are different occurrences or have
+    /// different intervals.
     bool operator != (const ICalendarEventInstance& other) const;
 
-    /// \returns true iff this instance's minimum
-    /// is greater than the given instance's minimum.
+    /// \returns true iff this instance is ordered after the given instance.
+    ///
+    /// Instances are ordered by occurrence key, then by UID, start and end.
+    /// This gives a consistent, but arbitrary, order that is suitable for
+    /// sorting and set operations, and two instances are equivalent in this
+    /// order iff they are equal.
 	bool operator >  (const ICalendarEventInstance& other) const;
 
-    /// \returns true iff the this instance's minimum
-    /// is greater than or equal to the given instance's minimum.
+    /// \returns true iff this instance is ordered after or equal to the
+    /// given instance.
 	bool operator >= (const ICalendarEventInstance& other) const;
 
-    /// \returns true iff the instance instance's minimum is
-    /// less than the given instance's minimum.
+    /// \returns true iff this instance is ordered before the given
+    /// instance.
     bool operator <  (const ICalendarEventInstance& other) const;
 
-    /// \returns true iff the this instance's minimum
-    /// is less than or equal to the given instance's minimum.
+    /// \returns true iff this instance is ordered before or equal to the
+    /// given instance.
     bool operator <= (const ICalendarEventInstance& other) const;
 
+    /// \brief Compute an occurrence key.
+    /// \param uid the UID of the event.
+    /// \param start the start of the occurrence.
+    /// \returns the 64-bit occurrence key.
+    static uint64_t makeOccurrenceKey(const std::string& uid,
+                                      const Poco::Timestamp& start);
+
 private:
+    /// \brief Compare two instances by occurrence key, UID, start and end.
+    /// \param other the instance to compare with.
+    /// \returns a negative value, zero or a positive value if this instance
+    ///          is ordered before, equal to or after the given instance.
+    int compare(const ICalendarEventInstance& other) const;
+
     /// \brief A copy of the event source for this instance
     ICalendarEvent _event;
 
     /// \brief The time range Interval for the instance of the event.
     Interval _interval;
 
+    /// \brief The occurrence key, computed once on construction.
+    uint64_t _occurrenceKey;
+
 };
 
 
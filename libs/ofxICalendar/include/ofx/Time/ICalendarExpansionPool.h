@@ -0,0 +1,180 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief Expands recurrences of many VEVENTs on a shared pool of threads.
+///
+/// A job is split into chunks, typically runs of consecutive rows of a
+/// CompiledCalendar.  The calling thread and the workers claim chunks from a
+/// shared counter until none are left, so threads that finish early keep
+/// taking work from the ones that hit expensive rules.  Each chunk should
+/// write to its own output, which the caller merges in chunk order to get
+/// the same result as a serial loop.
+///
+/// Only one job runs at a time.  If the pool is busy, execute() processes
+/// the whole job on the calling thread instead of waiting.
+///
+/// libical is not generally thread-safe.  The vendored build keeps its
+/// memory ring buffer and error state per thread and locks the builtin
+/// timezone table, but it expands the transitions of each timezone lazily
+/// and without a lock, and sorts a calendar's timezones on first lookup.
+/// Callers must therefore hold the snapshot mutex for the whole job, give
+/// each row to a single chunk and call ICalendarUtils::prepareTimezones()
+/// for every row before executing.  Builtin timezones are shared by all
+/// calendars, so prepareTimezones() expands them under the process-wide
+/// ICalendarUtils::getTimezoneMutex() rather than the snapshot mutex.
+///
+/// The worker threads are started by the first job that has more than one
+/// chunk.
+class ICalendarExpansionPool: public Poco::Runnable
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<ICalendarExpansionPool> SharedPtr;
+
+    /// \brief Work that is split into independent chunks.
+    class Job
+    {
+    public:
+        /// \brief Destroys the job.
+        virtual ~Job();
+
+        /// \brief Process one chunk.
+        ///
+        /// This is called concurrently for different chunks.
+        ///
+        /// \param chunk the index of the chunk.
+        virtual void process(std::size_t chunk) = 0;
+    };
+
+    /// \brief Create a pool.
+    /// \param numWorkers the number of worker threads in addition to the
+    ///        calling thread.  If 0, jobs run on the calling thread.
+    ICalendarExpansionPool(std::size_t numWorkers = getDefaultNumWorkers());
+
+    /// \brief Stops and joins the worker threads.
+    virtual ~ICalendarExpansionPool();
+
+    /// \brief Process every chunk of a job and wait until all are done.
+    /// \param job the job to process.
+    /// \param numChunks the number of chunks in the job.
+    void execute(Job& job, std::size_t numChunks);
+
+    /// \returns the number of worker threads.
+    std::size_t getNumWorkers() const;
+
+    /// \brief The worker thread function.
+    void run();
+
+    /// \brief The number of rows per chunk used by the calendar classes.
+    enum
+    {
+        DEFAULT_CHUNK_SIZE = 32
+    };
+
+    /// \returns one worker less than the number of processors, so that
+    /// together with the calling thread each processor has one thread.
+    static std::size_t getDefaultNumWorkers();
+
+    /// \brief Get the pool shared by all calendars.
+    ///
+    /// Calendars hold a reference to it, so it outlives every calendar.
+    ///
+    /// \returns the shared pool.
+    static SharedPtr getDefault();
+
+private:
+    ICalendarExpansionPool(const ICalendarExpansionPool&);
+    ICalendarExpansionPool& operator = (const ICalendarExpansionPool&);
+
+    /// \brief Claim and process chunks until none are left.
+    /// \param job the job to process.
+    /// \param numChunks the number of chunks in the job.
+    void work(Job& job, std::size_t numChunks);
+
+    /// \brief Process one chunk, logging any exception it throws.
+    /// \param job the job to process.
+    /// \param chunk the index of the chunk.
+    static void process(Job& job, std::size_t chunk);
+
+    /// \brief Start the worker threads if they are not running.
+    ///
+    /// The caller must hold _mutex.
+    void startWorkers();
+
+    /// \brief The number of worker threads.
+    std::size_t _numWorkers;
+
+    /// \brief The worker threads, empty until the first parallel job.
+    std::vector<Poco::Thread*> _workers;
+
+    /// \brief The current job, or 0 if there is none.
+    Job* _pJob;
+
+    /// \brief The number of chunks in the current job.
+    std::size_t _numChunks;
+
+    /// \brief The next chunk to claim.
+    std::atomic<std::size_t> _nextChunk;
+
+    /// \brief Incremented for each job so workers join each job once.
+    uint64_t _generation;
+
+    /// \brief The number of workers processing the current job.
+    std::size_t _numActive;
+
+    /// \brief True when the workers must exit.
+    bool _stopping;
+
+    /// \brief Signalled when a job starts or a worker finishes one.
+    Poco::Condition _condition;
+
+    /// \brief The mutex guarding all members but _nextChunk.
+    mutable Poco::Mutex _mutex;
+
+    /// \brief Held by the thread executing the current job.
+    Poco::Mutex _executeMutex;
+
+};
+
+
+} } // namespace ofx::Time
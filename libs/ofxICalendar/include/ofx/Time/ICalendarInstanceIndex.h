@@ -0,0 +1,190 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <vector>
+#include <stdint.h>
+#include <libical/ical.h>
+#include "ofx/Time/CompiledCalendar.h"
+#include "ofx/Time/ICalendarExpansionPool.h"
+#include "ofx/Time/Interval.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief An interval tree over the expanded instances of a calendar.
+///
+/// All VEVENT recurrences that overlap a fixed horizon are expanded once
+/// and stored in an array sorted by start time.  The array doubles as an
+/// implicit, balanced binary search tree in which every node is augmented
+/// with the maximum end time of its subtree, so overlap queries run in
+/// O(log N + K) for K results.
+///
+/// Query results are identical to calling icalcomponent_foreach_recurrence()
+/// on every VEVENT, as long as the query interval lies inside the horizon.
+class ICalendarInstanceIndex
+{
+public:
+    /// \brief A single expanded instance.
+    struct Instance
+    {
+        /// \brief The instance start in epoch seconds.
+        int64_t start;
+
+        /// \brief The instance end in epoch seconds.
+        int64_t end;
+
+        /// \brief The row of the instance's VEVENT in the CompiledCalendar.
+        std::size_t row;
+    };
+
+    /// \brief A collection of instances.
+    typedef std::vector<Instance> Instances;
+
+    /// \brief Create an empty index.
+    ICalendarInstanceIndex();
+
+    /// \brief Destroys the index.
+    virtual ~ICalendarInstanceIndex();
+
+    /// \brief Expand and index all instances that overlap the horizon.
+    ///
+    /// VEVENTs without a UID are skipped.  If a pool is given, the rows are
+    /// expanded on it, which requires that the snapshot has been prepared
+    /// with ICalendarSnapshot::prepareExpansion().  The result is the same
+    /// either way.
+    ///
+    /// \param compiled the compiled calendar to expand.
+    /// \param horizon the interval to expand instances within.
+    /// \param pPool the pool to expand rows on, or 0 to expand them on the
+    ///        calling thread.
+    void build(const CompiledCalendar& compiled,
+               const Interval& horizon,
+               ICalendarExpansionPool* pPool = 0);
+
+    /// \brief Expand the given rows again after a merge.
+    ///
+    /// All instances of the given rows are dropped and the rows that still
+    /// exist are expanded over the current horizon.  Only the changed rows
+    /// are passed to libical; the rest of the index is merged and its tree
+    /// rebuilt in linear time.  This does nothing if the index is not built.
+    ///
+    /// \param compiled the compiled calendar that was merged.
+    /// \param rows the rows that were added, modified or removed.
+    void update(const CompiledCalendar& compiled,
+                const std::vector<std::size_t>& rows);
+
+    /// \brief Remove all instances and invalidate the horizon.
+    void clear();
+
+    /// \returns true iff the index has been built.
+    bool isBuilt() const;
+
+    /// \returns true iff the index was built and the interval lies within
+    /// the expanded horizon.
+    bool covers(const Interval& interval) const;
+
+    /// \returns the expanded horizon.
+    const Interval& getHorizon() const;
+
+    /// \brief Find all instances that overlap the given interval.
+    ///
+    /// The tree is traversed in order, so results are appended to the given
+    /// collection in start order.
+    ///
+    /// \param interval the interval to query.
+    /// \param results the collection to append the results to.
+    void query(const Interval& interval, Instances& results) const;
+
+    /// \returns the total number of indexed instances.
+    std::size_t size() const;
+
+private:
+    /// \brief Expands runs of rows into one collection per run.
+    class BuildJob;
+
+    /// \brief The data passed to the recurrence callback.
+    struct ExpansionData
+    {
+        /// \brief The collection being filled.
+        Instances* pInstances;
+
+        /// \brief The row being expanded.
+        std::size_t row;
+    };
+
+    /// \brief Expand a single row over the horizon.
+    static void expand(const CompiledCalendar& compiled,
+                       std::size_t row,
+                       const Interval& horizon,
+                       Instances& instances);
+
+    /// \brief Build the implicit interval tree over the sorted instances.
+    void buildTree();
+
+    /// \brief Order instances by getLow(), then by row.
+    static bool compareStart(const Instance& lhs, const Instance& rhs);
+
+    /// \returns the earlier of an instance's start and end.
+    ///
+    /// libical does not reject events that end before they start, so the
+    /// tree is keyed on the hull of each span.
+    static int64_t getLow(const Instance& instance);
+
+    /// \returns the later of an instance's start and end.
+    static int64_t getHigh(const Instance& instance);
+
+    /// \brief Collect instance spans from ICalendarUtils::forEachRecurrence().
+    static void expansionCallback(icalcomponent* component,
+                                  struct icaltime_span* timeSpan,
+                                  void* data);
+
+    /// \brief The expanded instances sorted by compareStart().
+    Instances _instances;
+
+    /// \brief The maximum end time of the subtree rooted at each instance.
+    std::vector<int64_t> _maxEnds;
+
+    /// \brief The level of the root node of the implicit tree.
+    int _maxLevel;
+
+    /// \brief The expanded horizon.
+    Interval _horizon;
+
+    /// \brief True iff the index has been built.
+    bool _isBuilt;
+
+    // The cache writes and restores the sorted instances.
+    friend class ICalendarSnapshotCache;
+
+};
+
+
+} } // namespace ofx::Time
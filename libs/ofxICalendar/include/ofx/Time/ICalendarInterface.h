@@ -26,7 +26,10 @@
 #pragma once
 
 
+#include <string>
+#include <stdint.h>
 #include <libical/ical.h>
+#include "ofx/Time/ICalendarSnapshot.h"
 
 
 namespace ofx {
@@ -48,6 +51,24 @@ public:
     /// \returns the underlying libicalcomponent.
     virtual icalcomponent* getComponent() const = 0;
 
+    /// \brief Get the VEVENT component for a given event uid.
+    ///
+    /// Returned component is not cloned.  The parent retains ownership.
+    ///
+    /// \param uid the uid of the VEVENT to find.
+    /// \returns 0 iff a VEVENT with the given UID is NOT found or a pointer
+    /// to the VEVENT icalcomponent if found.
+    virtual icalcomponent* getEventComponentForUID(const std::string& uid) const = 0;
+
+    /// \brief Get the current snapshot of the calendar.
+    ///
+    /// The snapshot is acquired atomically and remains valid for as long as
+    /// the returned pointer is held, even if the calendar is replaced.
+    ///
+    /// \returns the current snapshot or an empty pointer if no calendar is
+    /// loaded.
+    virtual ICalendarSnapshot::SharedPtr getSnapshot() const = 0;
+
 };
 
 
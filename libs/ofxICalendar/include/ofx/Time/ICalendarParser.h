@@ -0,0 +1,130 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <string>
+#include <istream>
+#include <libical/ical.h>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A streaming icalendar parser.
+///
+/// ICalendarParser feeds data to libical's icalparser one unfolded content
+/// line at a time as it arrives, so the input never has to be held in
+/// memory as a single NUL-terminated string.  Only the current content line
+/// and the parsed component tree are kept.
+///
+/// The result is the same as icalcomponent_new_from_string(), except that
+/// empty lines are skipped rather than reported as parse errors.
+class ICalendarParser
+{
+public:
+    /// \brief The default chunk size used by parse(std::istream&).
+    enum
+    {
+        DEFAULT_CHUNK_SIZE = 64 * 1024
+    };
+
+    /// \brief Create a parser.
+    ICalendarParser();
+
+    /// \brief Destroys the parser and any component that was not returned.
+    virtual ~ICalendarParser();
+
+    /// \brief Parse a chunk of data.
+    ///
+    /// Chunks may split the data anywhere, including within a line ending.
+    ///
+    /// \param pData a pointer to the data, need not be NUL-terminated.
+    /// \param size the number of bytes of data.
+    void parse(const char* pData, std::size_t size);
+
+    /// \brief Finish parsing and take the parsed component.
+    ///
+    /// Any unterminated final line is parsed first.  Components that were
+    /// not closed by an END line are discarded.  If the data contained more
+    /// than one top-level component, they are returned inside an XROOT
+    /// component.  The parser is reset and can be reused.
+    ///
+    /// \returns the parsed component, which the caller must free with
+    /// icalcomponent_free(), or 0 if no complete component was parsed.
+    icalcomponent* finish();
+
+    /// \brief Parse a whole stream in fixed-size chunks.
+    /// \param stream the stream to read until it ends.
+    /// \param chunkSize the number of bytes to read at a time.
+    /// \returns the parsed component, which the caller must free with
+    /// icalcomponent_free(), or 0 if no complete component was parsed.
+    static icalcomponent* parse(std::istream& stream,
+                                std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /// \brief Parse a local file.
+    ///
+    /// The file is opened as a MappedFile and the mapped pages are parsed
+    /// in place, so on POSIX systems the file contents are never copied to
+    /// the heap.
+    ///
+    /// \param path the path of the file to parse.
+    /// \returns the parsed component, which the caller must free with
+    /// icalcomponent_free(), or 0 if the file could not be read or no
+    /// complete component was parsed.
+    static icalcomponent* parseFile(const std::string& path);
+
+private:
+    ICalendarParser(const ICalendarParser&);
+    ICalendarParser& operator = (const ICalendarParser&);
+
+    /// \brief Handle a complete physical line without its line ending.
+    void addPhysicalLine(const char* pLine, std::size_t length);
+
+    /// \brief Pass the pending content line to libical.
+    void addContentLine();
+
+    /// \brief The libical parser.
+    icalparser* _pParser;
+
+    /// \brief The top-level component(s) parsed so far.
+    icalcomponent* _pRoot;
+
+    /// \brief The unterminated physical line at the end of the last chunk.
+    std::string _partialLine;
+
+    /// \brief The content line being unfolded.
+    std::string _contentLine;
+
+    /// \brief True iff _contentLine holds a line that has not been parsed.
+    bool _hasContentLine;
+
+};
+
+
+} } // namespace ofx::Time
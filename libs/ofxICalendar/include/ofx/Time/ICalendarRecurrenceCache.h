@@ -0,0 +1,164 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <vector>
+#include <stdint.h>
+#include <libical/ical.h>
+#include "ofx/Time/CompiledCalendar.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A cache of expanded recurrences for each VEVENT of a snapshot.
+///
+/// The first query of a row expands its recurrences over a window that
+/// extends a horizon on either side of the query and stores them sorted by
+/// start.  Later queries that lie within the window are answered with a
+/// binary search instead of walking the RRULEs from DTSTART again.  A query
+/// outside the window slides the window to it.
+///
+/// Results are identical to calling icalcomponent_foreach_recurrence() with
+/// the query interval, except that they are ordered by start.
+///
+/// The cache belongs to one snapshot, so it is invalidated by each parse
+/// or merge.  It is not synchronized; callers must hold the snapshot's
+/// mutex, which they need for the expansion anyway.  After prepare(),
+/// different rows may be queried concurrently under that mutex.
+class ICalendarRecurrenceCache
+{
+public:
+    /// \brief An expanded recurrence.
+    struct Span
+    {
+        /// \brief The start in epoch seconds.
+        int64_t start;
+
+        /// \brief The end in epoch seconds.
+        int64_t end;
+    };
+
+    /// \brief A collection of spans.
+    typedef std::vector<Span> Spans;
+
+    /// \brief Create an empty cache.
+    /// \param horizon the number of seconds expanded on either side of a
+    ///        query that misses the cache.
+    ICalendarRecurrenceCache(int64_t horizon = DEFAULT_HORIZON);
+
+    /// \brief Destroys the cache.
+    virtual ~ICalendarRecurrenceCache();
+
+    /// \brief Find the recurrences of a row that overlap an interval.
+    /// \param compiled the compiled calendar the row belongs to.
+    /// \param row the row of the VEVENT.
+    /// \param start the start of the interval in epoch seconds.
+    /// \param end the end of the interval in epoch seconds.
+    /// \param results the collection to append the results to, in start
+    ///        order.
+    void query(const CompiledCalendar& compiled,
+               std::size_t row,
+               int64_t start,
+               int64_t end,
+               Spans& results);
+
+    /// \brief Make room for every row of a compiled calendar.
+    ///
+    /// query() then only touches the entry of its row, so different rows
+    /// may be queried from different threads, as long as the caller holds
+    /// the snapshot's mutex for all of them.
+    ///
+    /// \param compiled the compiled calendar the rows belong to.
+    void prepare(const CompiledCalendar& compiled);
+
+    /// \brief Remove all cached recurrences.
+    void clear();
+
+    /// \returns the total number of cached recurrences.
+    std::size_t size() const;
+
+    /// \brief The default horizon of 30 days in seconds.
+    static const int64_t DEFAULT_HORIZON;
+
+private:
+    /// \brief The cached recurrences of one row.
+    struct Entry
+    {
+        /// \brief Create an empty entry.
+        Entry();
+
+        /// \brief True iff the recurrences have been expanded.
+        bool isExpanded;
+
+        /// \brief The start of the expanded window in epoch seconds.
+        int64_t windowStart;
+
+        /// \brief The end of the expanded window in epoch seconds.
+        int64_t windowEnd;
+
+        /// \brief The largest distance between the start and end of a
+        /// span, used to bound the binary search.
+        int64_t maxLength;
+
+        /// \brief The recurrences that overlap the window, sorted by the
+        /// lower of their start and end.
+        Spans spans;
+    };
+
+    /// \brief Expand a row over a new window.
+    /// \param compiled the compiled calendar the row belongs to.
+    /// \param row the row of the VEVENT.
+    /// \param windowStart the start of the window in epoch seconds.
+    /// \param windowEnd the end of the window in epoch seconds.
+    /// \param entry the entry to fill.
+    static void expand(const CompiledCalendar& compiled,
+                       std::size_t row,
+                       int64_t windowStart,
+                       int64_t windowEnd,
+                       Entry& entry);
+
+    /// \brief The callback passed to ICalendarUtils::forEachRecurrence().
+    static void expansionCallback(icalcomponent* component,
+                                  struct icaltime_span* timeSpan,
+                                  void* data);
+
+    /// \returns true iff lhs starts before rhs.
+    static bool compareLow(const Span& lhs, const Span& rhs);
+
+    /// \brief The number of seconds expanded on either side of a query.
+    int64_t _horizon;
+
+    /// \brief The entries, indexed by row.
+    std::vector<Entry> _entries;
+
+};
+
+
+} } // namespace ofx::Time
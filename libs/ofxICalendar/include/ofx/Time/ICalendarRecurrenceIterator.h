@@ -0,0 +1,176 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <vector>
+#include <stdint.h>
+#include <libical/ical.h>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A recurrence rule iterator that can seek to a point in time.
+///
+/// libical's icalrecur_iterator always starts at DTSTART and steps forward
+/// one occurrence at a time, so finding the occurrences of a long-lived
+/// FREQ=MINUTELY rule near today costs time proportional to the age of the
+/// event.  For the common rules this iterator computes the position of the
+/// first occurrence at or after a given time arithmetically instead.
+///
+/// Rules with FREQ=SECONDLY, MINUTELY, HOURLY or DAILY and no BY* parts,
+/// FREQ=DAILY with a weekday BYDAY list, FREQ=WEEKLY with an optional
+/// weekday BYDAY list and FREQ=MONTHLY with an optional BYMONTHDAY list of
+/// days 1 to 28 are seekable, with any INTERVAL, COUNT or UNTIL.  All other
+/// rules are delegated to libical, in which case seek() steps forward from
+/// DTSTART.
+///
+/// In both cases next() returns exactly the sequence icalrecur_iterator_next()
+/// would, in DTSTART's timezone.  libical has its own ideas about where a
+/// rule starts (DTSTART is skipped by some rules it does not match and by
+/// some it does), so the first occurrence is always taken from libical and
+/// the arithmetic continues from there.
+class ICalendarRecurrenceIterator
+{
+public:
+    /// \brief Create an iterator.
+    /// \param rule the recurrence rule.
+    /// \param dtstart the DTSTART of the recurring component.
+    ICalendarRecurrenceIterator(const struct icalrecurrencetype& rule,
+                                const struct icaltimetype& dtstart);
+
+    /// \brief Destroys the iterator.
+    virtual ~ICalendarRecurrenceIterator();
+
+    /// \brief Get the next occurrence.
+    /// \returns the next occurrence or a null time if there are no more.
+    struct icaltimetype next();
+
+    /// \brief Skip the occurrences that start before a time.
+    ///
+    /// After seeking, next() returns the first remaining occurrence whose
+    /// wall-clock start is at or after the given time.  Seeking never moves
+    /// the iterator backwards.
+    ///
+    /// \param time the time to seek to.  It is converted to DTSTART's
+    ///        timezone before comparing.
+    void seek(const struct icaltimetype& time);
+
+    /// \returns true iff seek() computes its position arithmetically.
+    bool isSeekable() const;
+
+private:
+    ICalendarRecurrenceIterator(const ICalendarRecurrenceIterator&);
+    ICalendarRecurrenceIterator& operator = (const ICalendarRecurrenceIterator&);
+
+    /// \brief The ways occurrences are laid out in time.
+    enum Pattern
+    {
+        /// \brief The rule is iterated by libical.
+        PATTERN_LIBICAL,
+        /// \brief One occurrence every fixed number of seconds.
+        PATTERN_FIXED,
+        /// \brief Occurrences on some weekdays of every nth week.
+        PATTERN_WEEKLY,
+        /// \brief Occurrences on some days of every nth month.
+        PATTERN_MONTHLY
+    };
+
+    /// \brief Determine the pattern of a rule and collect its slots.
+    /// \param rule the recurrence rule.
+    /// \param dtstart the DTSTART of the rule.
+    /// \returns the pattern, or PATTERN_LIBICAL if the rule is not seekable.
+    Pattern setup(const struct icalrecurrencetype& rule,
+                  const struct icaltimetype& dtstart);
+
+    /// \brief Lay the periods out from the first occurrence.
+    /// \param first the first occurrence returned by libical.
+    void anchor(const struct icaltimetype& first);
+
+    /// \returns the index of the current slot counted from the first slot
+    /// of the first period.
+    int64_t getSlotIndex() const;
+
+    /// \returns the wall-clock start of the current slot in seconds.
+    int64_t getSlotTime() const;
+
+    /// \brief Move to the next slot.
+    void advance();
+
+    /// \returns true iff each value is greater than the one before it.
+    static bool isIncreasing(const std::vector<int>& values);
+
+    /// \brief The first occurrence, used as a template for the others.
+    struct icaltimetype _first;
+
+    /// \brief The UNTIL of the rule, or a null time.
+    struct icaltimetype _until;
+
+    /// \brief The COUNT of the rule, or 0.
+    int _count;
+
+    /// \brief The layout of the occurrences.
+    Pattern _pattern;
+
+    /// \brief The libical iterator for rules that are not seekable.
+    icalrecur_iterator* _pIterator;
+
+    /// \brief An occurrence that has been read ahead, or a null time.
+    struct icaltimetype _pending;
+
+    /// \brief The wall-clock start of the first period in seconds, or its
+    /// month number for monthly rules.
+    int64_t _origin;
+
+    /// \brief The wall-clock time of day of the occurrences in seconds.
+    int64_t _timeOfDay;
+
+    /// \brief The number of seconds, days or months between periods.
+    int64_t _periodLength;
+
+    /// \brief The weekdays, numbered from 0 for Sunday, or the month days
+    /// of the slots in each period.  Sorted ascending.
+    std::vector<int> _slots;
+
+    /// \brief The index of the slot that follows the first occurrence.
+    int64_t _secondIndex;
+
+    /// \brief The current period.
+    int64_t _period;
+
+    /// \brief The current slot within the period.
+    std::size_t _slot;
+
+    /// \brief True iff the rule has no more occurrences.
+    bool _isFinished;
+
+};
+
+
+} } // namespace ofx::Time
@@ -0,0 +1,212 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <stdint.h>
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+class ICalendar;
+
+
+/// \brief Reloads auto-refreshed calendars from a shared pool of threads.
+///
+/// Each scheduled calendar has a refresh deadline.  The deadlines are kept
+/// in a min-heap and the worker threads sleep on a condition until the
+/// earliest deadline passes or the schedule changes, so idle calendars cost
+/// no threads and no wakeups.  When a deadline passes, one worker calls
+/// ICalendar::reload() and schedules the next deadline one interval later.
+/// A calendar is never reloaded by two workers at once.
+///
+/// The worker threads are started when the first calendar is scheduled.
+class ICalendarRefreshScheduler: public Poco::Runnable
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<ICalendarRefreshScheduler> SharedPtr;
+
+    /// \brief Create a scheduler.
+    /// \param numWorkers the number of worker threads, at least 1.
+    ICalendarRefreshScheduler(std::size_t numWorkers = DEFAULT_NUM_WORKERS);
+
+    /// \brief Stops and joins the worker threads.
+    virtual ~ICalendarRefreshScheduler();
+
+    /// \brief Schedule a calendar to be reloaded periodically.
+    ///
+    /// The first reload happens one interval from now, or as soon as a
+    /// worker is free if immediately is true.  If the calendar is already
+    /// scheduled, its deadline is replaced and the workers are woken to
+    /// observe it.
+    ///
+    /// \param pCalendar the calendar to reload.  It must be unscheduled
+    ///        before it is destroyed.
+    /// \param interval the refresh interval in milliseconds.  If 0, the
+    ///        calendar is unscheduled.
+    /// \param immediately true to reload the calendar now.
+    void schedule(ICalendar* pCalendar,
+                  unsigned long long interval,
+                  bool immediately = false);
+
+    /// \brief Stop reloading a calendar.
+    ///
+    /// If a worker is reloading the calendar, this waits until it is done,
+    /// so the calendar may be destroyed as soon as this returns.
+    ///
+    /// \param pCalendar the calendar to unschedule.
+    void unschedule(ICalendar* pCalendar);
+
+    /// \returns true iff the calendar is scheduled.
+    bool isScheduled(ICalendar* pCalendar) const;
+
+    /// \returns the number of scheduled calendars.
+    std::size_t getNumScheduled() const;
+
+    /// \returns the number of worker threads.
+    std::size_t getNumWorkers() const;
+
+    /// \brief The worker thread function.
+    void run();
+
+    /// \brief The default number of worker threads.
+    enum
+    {
+        DEFAULT_NUM_WORKERS = 2
+    };
+
+    /// \brief Get the scheduler shared by all calendars.
+    ///
+    /// Calendars hold a reference to it, so it outlives every calendar.
+    ///
+    /// \returns the shared scheduler.
+    static SharedPtr getDefault();
+
+private:
+    ICalendarRefreshScheduler(const ICalendarRefreshScheduler&);
+    ICalendarRefreshScheduler& operator = (const ICalendarRefreshScheduler&);
+
+    /// \brief The schedule of one calendar.
+    struct Registration
+    {
+        /// \brief The refresh interval in milliseconds.
+        unsigned long long interval;
+
+        /// \brief The next refresh deadline.
+        Poco::Timestamp deadline;
+
+        /// \brief Identifies the current heap entry of this calendar.
+        ///
+        /// Tickets are drawn from _nextTicket, so an entry left behind by
+        /// an unscheduled calendar never matches a later registration at
+        /// the same address.
+        uint64_t ticket;
+
+        /// \brief True iff a worker is reloading the calendar.
+        bool running;
+    };
+
+    /// \brief A deadline in the heap.
+    ///
+    /// Entries are not removed when a calendar is rescheduled or
+    /// unscheduled.  Instead, an entry whose ticket does not match its
+    /// registration is discarded when it reaches the top of the heap.
+    struct Deadline
+    {
+        /// \brief The refresh deadline.
+        Poco::Timestamp deadline;
+
+        /// \brief The calendar to reload.
+        ICalendar* pCalendar;
+
+        /// \brief The ticket of the registration when this was pushed.
+        uint64_t ticket;
+
+        /// \returns true iff this deadline is later than other.
+        bool operator > (const Deadline& other) const;
+    };
+
+    typedef std::map<ICalendar*, Registration> Registrations;
+
+    typedef std::priority_queue<Deadline,
+                                std::vector<Deadline>,
+                                std::greater<Deadline> > Deadlines;
+
+    /// \brief Push a new heap entry for a registration.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param pCalendar the calendar.
+    /// \param registration the registration of the calendar.
+    void push(ICalendar* pCalendar, Registration& registration);
+
+    /// \brief Start the worker threads if they are not running.
+    ///
+    /// The caller must hold _mutex.
+    void startWorkers();
+
+    /// \brief The number of worker threads.
+    std::size_t _numWorkers;
+
+    /// \brief The worker threads, empty until the first calendar is
+    /// scheduled.
+    std::vector<Poco::Thread*> _workers;
+
+    /// \brief The registrations, keyed by calendar.
+    Registrations _registrations;
+
+    /// \brief The min-heap of deadlines.
+    Deadlines _deadlines;
+
+    /// \brief The last ticket handed out.
+    uint64_t _nextTicket;
+
+    /// \brief True when the workers must exit.
+    bool _stopping;
+
+    /// \brief Signalled when the schedule changes or a reload finishes.
+    Poco::Condition _condition;
+
+    /// \brief The mutex guarding all members.
+    mutable Poco::Mutex _mutex;
+
+};
+
+
+} } // namespace ofx::Time
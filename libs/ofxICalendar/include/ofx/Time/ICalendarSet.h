@@ -0,0 +1,208 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "ofx/Time/ICalendar.h"
+#include "ofThread.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A set of calendars that are queried as one.
+///
+/// The calendars of a set are reloaded by the workers of the shared
+/// ICalendarRefreshScheduler, like every ICalendar, so a set of many feeds
+/// costs no threads of its own.
+///
+/// getEventInstances() queries each calendar whose bounding interval
+/// overlaps the query, and merges the sorted results of the calendars with
+/// a heap, so the merged instances are sorted by start without sorting
+/// them again.  Instances with equal starts are kept in the order of their
+/// calendars in the set.
+///
+/// All methods are thread-safe.
+class ICalendarSet
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<ICalendarSet> SharedPtr;
+
+    /// \brief A collection of calendars.
+    typedef std::vector<ICalendar::SharedPtr> Calendars;
+
+    /// \brief Create an empty set.
+    ICalendarSet();
+
+    /// \brief Destroys the set.
+    virtual ~ICalendarSet();
+
+    /// \brief Add a calendar to the set.
+    /// \param calendar the calendar to add.  It is not added twice.
+    void add(ICalendar::SharedPtr calendar);
+
+    /// \brief Remove a calendar from the set.
+    /// \param calendar the calendar to remove.
+    /// \returns true iff the calendar was in the set.
+    bool remove(ICalendar::SharedPtr calendar);
+
+    /// \brief Remove all calendars from the set.
+    void clear();
+
+    /// \returns the calendars in the set, in the order they were added.
+    Calendars getCalendars() const;
+
+    /// \returns the number of calendars in the set.
+    std::size_t size() const;
+
+    /// \returns true iff the set has no calendars.
+    bool empty() const;
+
+    /// \brief Set the auto refresh interval of every calendar in the set.
+    /// \param autoRefreshInterval the interval in milliseconds, or 0 to
+    ///        disable auto refresh.
+    /// \sa ICalendar::setAutoRefreshInterval()
+    void setAutoRefreshInterval(unsigned long long autoRefreshInterval);
+
+    /// \brief Get the event instances of all calendars within an interval.
+    ///
+    /// Calendars that are not loaded yet are skipped.
+    ///
+    /// \param interval the interval to query.
+    /// \returns the instances of all calendars, sorted by start.
+    ICalendar::EventInstances getEventInstances(const Interval& interval) const;
+
+    /// \brief Get the event instances of all calendars at a time.
+    /// \param timestamp the time to query.
+    /// \returns the instances of all calendars, sorted by start.
+    ICalendar::EventInstances getEventInstances(const Poco::Timestamp& timestamp) const;
+
+    /// \brief Make a shared instance.
+    static SharedPtr makeShared()
+    {
+        return SharedPtr(new ICalendarSet());
+    }
+
+    enum
+    {
+        /// \brief The seconds that bounding intervals are widened by.
+        ///
+        /// The compiled event table reads local times as if they were UTC
+        /// and all-day events last until the end of their day, so the
+        /// instances of an event may lie up to a day outside the times
+        /// in the table.
+        BOUNDS_MARGIN = 2 * 24 * 60 * 60
+    };
+
+private:
+    ICalendarSet(const ICalendarSet&);
+    ICalendarSet& operator = (const ICalendarSet&);
+
+    /// \brief The bounding interval of a calendar's snapshot.
+    struct Bounds
+    {
+        /// \brief The generation of the snapshot.
+        uint64_t generation;
+
+        /// \brief The earliest instance start in epoch seconds.
+        int64_t start;
+
+        /// \brief The latest instance end in epoch seconds.
+        int64_t end;
+
+        /// \brief True iff the snapshot has no events.
+        bool isEmpty;
+    };
+
+    /// \brief The sorted instances of one calendar being merged.
+    struct Stream
+    {
+        /// \brief The instances of the calendar.
+        const ICalendar::EventInstances* pInstances;
+
+        /// \brief The index of the next instance to merge.
+        std::size_t position;
+
+        /// \brief The start of the next instance.
+        Poco::Timestamp start;
+
+        /// \brief The index of the calendar in the set.
+        std::size_t calendar;
+    };
+
+    /// \brief A map of calendars to the bounds of their last snapshot.
+    typedef std::unordered_map<const ICalendar*, Bounds> BoundsCache;
+
+    /// \brief Get the bounding interval of a calendar's snapshot.
+    ///
+    /// Bounds are computed once per snapshot.
+    ///
+    /// \param pCalendar the calendar.
+    /// \param snapshot the current snapshot of the calendar.
+    /// \returns the bounds of the snapshot.
+    Bounds getBounds(const ICalendar* pCalendar,
+                     const ICalendarSnapshot& snapshot) const;
+
+    /// \brief Compute the bounding interval of a snapshot's instances.
+    ///
+    /// Recurring events are unbounded after their DTSTART, and before it
+    /// too if they have an RDATE.
+    ///
+    /// \param snapshot the snapshot.
+    /// \returns the bounds of the snapshot.
+    static Bounds computeBounds(const ICalendarSnapshot& snapshot);
+
+    /// \brief Order instances by start.
+    static bool compareStart(const ICalendarEventInstance& lhs,
+                             const ICalendarEventInstance& rhs);
+
+    /// \brief Order streams for a min-heap on start, then calendar.
+    static bool compareStreams(const Stream& lhs, const Stream& rhs);
+
+    /// \brief The calendars in the order they were added.
+    Calendars _calendars;
+
+    /// \brief The bounds of each calendar's last snapshot.
+    mutable BoundsCache _bounds;
+
+    /// \brief The mutex guarding _calendars and _bounds.
+    ///
+    /// Queries copy the calendar list under it and then merge the
+    /// calendars' snapshots without it, so adding or removing a calendar
+    /// never waits for a query.
+    mutable ofMutex _mutex;
+
+};
+
+
+} } // namespace ofx::Time
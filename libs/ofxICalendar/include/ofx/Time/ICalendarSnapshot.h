@@ -0,0 +1,195 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <libical/ical.h>
+#include "Poco/Mutex.h"
+#include "ofx/Time/CompiledCalendar.h"
+#include "ofx/Time/ICalendarChangeSet.h"
+#include "ofx/Time/ICalendarInstanceIndex.h"
+#include "ofx/Time/ICalendarRecurrenceCache.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief An immutable, parsed and compiled version of a calendar.
+///
+/// ICalendar never modifies a snapshot once it has been published.  Each
+/// parse or merge builds a new snapshot and atomically replaces the shared
+/// pointer to the current one.  Readers acquire the current snapshot with
+/// ICalendar::getSnapshot() and may use it from any thread for as long as
+/// they hold it.  A replaced snapshot is freed when its last reader drops
+/// it.
+///
+/// The compiled event table and the instance index are plain arrays and can
+/// be read without locking.  libical stores iteration state inside each
+/// icalcomponent, so code that walks the libical tree (property lookups,
+/// recurrence expansion, serialization) must hold getMutex() while doing
+/// so.
+class ICalendarSnapshot
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<const ICalendarSnapshot> SharedPtr;
+
+    /// \brief A shared pointer to an immutable instance index.
+    typedef std::shared_ptr<const ICalendarInstanceIndex> InstanceIndexPtr;
+
+    /// \brief Create a snapshot.
+    /// \param pCalendar the VCALENDAR component.  The snapshot takes
+    ///        ownership and frees it when destroyed.
+    /// \param pTimezones the component holding the VTIMEZONEs resolved for
+    ///        pCalendar, which has been added to it as a subcomponent, or 0.
+    ///        The snapshot takes ownership and frees it with pCalendar.
+    /// \param compiled the compiled table for pCalendar.  It is swapped
+    ///        into the snapshot and left empty.
+    /// \param changes the changes that produced this snapshot.
+    ICalendarSnapshot(icalcomponent* pCalendar,
+                      icalcomponent* pTimezones,
+                      CompiledCalendar& compiled,
+                      const ICalendarChangeSet& changes);
+
+    /// \brief Frees the VCALENDAR component.
+    virtual ~ICalendarSnapshot();
+
+    /// \returns the VCALENDAR component.  The snapshot retains ownership.
+    icalcomponent* getComponent() const;
+
+    /// \brief Get the VTIMEZONEs resolved for the calendar.
+    ///
+    /// These are the timezones the calendar references but does not define,
+    /// found in an earlier version of the calendar or in
+    /// ICalendarZoneInfo::getDefault().  They are kept in a parent of the
+    /// VCALENDAR component, where libical finds them when it resolves a
+    /// TZID, so the calendar itself is exactly what was parsed.
+    ///
+    /// \returns the component holding the VTIMEZONEs, or 0 if there are
+    ///          none.  The snapshot retains ownership.
+    icalcomponent* getTimezones() const;
+
+    /// \returns the compiled event table.
+    const CompiledCalendar& getCompiledCalendar() const;
+
+    /// \returns the changes that produced this snapshot.
+    const ICalendarChangeSet& getChangeSet() const;
+
+    /// \brief Get the snapshot generation.
+    ///
+    /// Generations are unique across all snapshots in the process and are
+    /// never 0, so they can be used as cache keys.
+    ///
+    /// \returns the generation.
+    uint64_t getGeneration() const;
+
+    /// \brief Get the instance index, if one has been built.
+    /// \returns the instance index or an empty pointer.
+    InstanceIndexPtr getInstanceIndex() const;
+
+    /// \brief Publish a new instance index for this snapshot.
+    ///
+    /// The index is derived from the immutable contents of the snapshot, so
+    /// concurrent readers that build one race harmlessly; the last one
+    /// published wins.
+    ///
+    /// \param instanceIndex the index to publish, may be empty.
+    void setInstanceIndex(InstanceIndexPtr instanceIndex) const;
+
+    /// \brief Get the recurrence cache of this snapshot.
+    ///
+    /// The caller must hold getMutex() while using the cache.
+    ///
+    /// \returns the recurrence cache.
+    ICalendarRecurrenceCache& getRecurrenceCache() const;
+
+    /// \brief Prepare the snapshot for expanding rows concurrently.
+    ///
+    /// This sizes the recurrence cache so that different rows can be
+    /// queried from different threads, and calls
+    /// ICalendarUtils::prepareTimezones() for every row.  The work is only
+    /// done again when a later year is reached.
+    ///
+    /// The caller must hold getMutex() and keep holding it while the rows
+    /// are expanded.
+    ///
+    /// \param end the end of the expansion in epoch seconds.  The horizon
+    ///        of the recurrence cache is added to it.
+    void prepareExpansion(int64_t end) const;
+
+    /// \returns the mutex that guards access to the libical tree.
+    Poco::Mutex& getMutex() const;
+
+private:
+    ICalendarSnapshot(const ICalendarSnapshot&);
+    ICalendarSnapshot& operator = (const ICalendarSnapshot&);
+
+    /// \brief The VCALENDAR component.
+    icalcomponent* _pCalendar;
+
+    /// \brief The parent of _pCalendar holding its resolved VTIMEZONEs, or
+    /// 0.
+    icalcomponent* _pTimezones;
+
+    /// \brief The compiled VEVENT table for _pCalendar.
+    CompiledCalendar _compiled;
+
+    /// \brief The changes that produced this snapshot.
+    ICalendarChangeSet _changes;
+
+    /// \brief The generation of this snapshot.
+    uint64_t _generation;
+
+    /// \brief An interval tree of expanded instances.
+    ///
+    /// Accessed with std::atomic_load() and std::atomic_store().
+    mutable InstanceIndexPtr _instanceIndex;
+
+    /// \brief The expanded recurrences of single VEVENTs.
+    ///
+    /// Guarded by _mutex.
+    mutable ICalendarRecurrenceCache _recurrenceCache;
+
+    /// \brief The last year prepared by prepareExpansion(), or 0.
+    ///
+    /// Guarded by _mutex.
+    mutable int _preparedYear;
+
+    /// \brief The mutex that guards access to the libical tree.
+    mutable Poco::Mutex _mutex;
+
+    /// \brief The generation of the next snapshot.
+    static std::atomic<uint64_t> _nextGeneration;
+
+};
+
+
+} } // namespace ofx::Time
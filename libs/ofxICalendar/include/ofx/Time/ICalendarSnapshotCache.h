@@ -0,0 +1,360 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <string>
+#include <stdint.h>
+#include "ofx/Time/ICalendarSnapshot.h"
+#include "ofx/Time/MappedFile.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A binary cache of a calendar snapshot for warm starts.
+///
+/// save() writes everything needed to publish a snapshot again without
+/// compiling the calendar or expanding its recurrences: the compiled event
+/// table with its timezone tables, the instance index, the validators of
+/// the content, the text of the calendar and the VTIMEZONEs resolved for
+/// it.  load() maps the file and
+/// restores the snapshot from it, so a calendar can be queried at startup
+/// before its URI has been fetched.
+///
+/// libical has no binary form of its component tree, so the calendar text
+/// is still parsed by load(), in place from the mapped file.  The compiled
+/// table and the instance index are copied from the file as they are.
+///
+/// The file is written in the byte order and layout of the writing
+/// platform and is rejected on any other, like an ICalendarZoneInfo file.
+class ICalendarSnapshotCache
+{
+public:
+    /// \brief Values that identify the content a snapshot was parsed from.
+    struct Validators
+    {
+        /// \brief Create empty validators.
+        Validators();
+
+        /// \brief The hash of the content.
+        uint64_t hash;
+
+        /// \brief True iff hash is valid.
+        ///
+        /// Content that is not hashed (e.g. a parsed stream) clears this.
+        bool hasHash;
+
+        /// \brief The ETag header of the HTTP response, if any.
+        std::string entityTag;
+
+        /// \brief The Last-Modified header of the HTTP response, if any.
+        std::string lastModified;
+    };
+
+    /// \brief Write a snapshot to a cache file.
+    ///
+    /// Removed rows of the compiled table are left out.  The instance index
+    /// is written only if one has been built.  The file is replaced
+    /// atomically, but concurrent calls for the same path must be
+    /// serialized by the caller.
+    ///
+    /// \param path the path of the file to write.
+    /// \param snapshot the snapshot to write.
+    /// \param validators the validators of the snapshot's content.
+    /// \returns true iff the file was written.
+    static bool save(const std::string& path,
+                     const ICalendarSnapshot& snapshot,
+                     const Validators& validators);
+
+    /// \brief Restore a snapshot from a cache file.
+    /// \param path the path of the file to read.
+    /// \param validators is set to the validators saved with the snapshot.
+    /// \returns the restored snapshot, or an empty pointer if the file does
+    ///          not exist or is not a valid cache for this platform.
+    static ICalendarSnapshot::SharedPtr load(const std::string& path,
+                                             Validators& validators);
+
+    enum
+    {
+        /// \brief The version of the file layout.
+        ///
+        /// Version 2 also stores instances that only touch the horizon.
+        /// Version 3 also stores the resolved VTIMEZONEs, see
+        /// ICalendarSnapshot::getTimezones().
+        VERSION = 3
+    };
+
+private:
+    ICalendarSnapshotCache();
+    ICalendarSnapshotCache(const ICalendarSnapshotCache&);
+    ICalendarSnapshotCache& operator = (const ICalendarSnapshotCache&);
+
+    /// \brief The file header.
+    struct Header
+    {
+        /// \brief The file signature, MAGIC.
+        char magic[8];
+
+        /// \brief The layout version.
+        uint32_t version;
+
+        /// \brief 0x01020304 in the byte order of the file.
+        uint32_t byteOrder;
+
+        /// \brief HAS_HASH and HAS_INSTANCE_INDEX flags.
+        uint32_t flags;
+
+        /// \brief The number of timezone records.
+        uint32_t numTimezones;
+
+        /// \brief The number of transition records.
+        uint32_t numTransitions;
+
+        /// \brief Padding, always 0.
+        uint32_t reserved;
+
+        /// \brief The number of row records.
+        uint64_t numRows;
+
+        /// \brief The number of instance records.
+        uint64_t numInstances;
+
+        /// \brief The hash of the content.
+        uint64_t contentHash;
+
+        /// \brief The most recent LAST-MODIFIED in epoch microseconds.
+        int64_t lastModified;
+
+        /// \brief The start of the instance index horizon in epoch
+        /// microseconds.
+        int64_t horizonStart;
+
+        /// \brief The end of the instance index horizon in epoch
+        /// microseconds.
+        int64_t horizonEnd;
+
+        /// \brief The file offset of the row records.
+        uint64_t rowsOffset;
+
+        /// \brief The file offset of the instance records.
+        uint64_t instancesOffset;
+
+        /// \brief The file offset of the timezone records.
+        uint64_t timezonesOffset;
+
+        /// \brief The file offset of the transition records.
+        uint64_t transitionsOffset;
+
+        /// \brief The file offset of the compiled string pool.
+        uint64_t stringsOffset;
+
+        /// \brief The size of the compiled string pool.
+        uint64_t stringsSize;
+
+        /// \brief The file offset of the text pool.
+        uint64_t textOffset;
+
+        /// \brief The size of the text pool.
+        uint64_t textSize;
+
+        /// \brief The text offset of the NUL-terminated ETag.
+        uint64_t entityTag;
+
+        /// \brief The text offset of the NUL-terminated Last-Modified
+        /// header.
+        uint64_t httpLastModified;
+
+        /// \brief The text offset of the NUL-terminated calendar text.
+        uint64_t calendar;
+
+        /// \brief The length of the calendar text.
+        uint64_t calendarSize;
+
+        /// \brief The text offset of a NUL-terminated VCALENDAR holding the
+        /// resolved VTIMEZONEs, or of an empty string if there are none.
+        uint64_t resolvedTimezones;
+    };
+
+    /// \brief A row of the compiled event table.
+    struct Row
+    {
+        /// \brief The pool offset of the UID.
+        uint64_t uid;
+
+        /// \brief The length of the UID.
+        uint64_t uidLength;
+
+        /// \brief The pool offset of the SUMMARY.
+        uint64_t summary;
+
+        /// \brief The pool offset of the LOCATION.
+        uint64_t location;
+
+        /// \brief The DTSTART in epoch microseconds.
+        int64_t start;
+
+        /// \brief The DTEND in epoch microseconds.
+        int64_t end;
+
+        /// \brief The LAST-MODIFIED in epoch microseconds.
+        int64_t lastModified;
+
+        /// \brief The RECURRENCE-ID in epoch microseconds.
+        int64_t recurrenceID;
+
+        /// \brief The next row with the same UID, or NO_RECORD.
+        uint64_t nextRow;
+
+        /// \brief The SEQUENCE.
+        int32_t sequence;
+
+        /// \brief The index of the DTSTART timezone record, or -1.
+        int32_t timezone;
+
+        /// \brief HAS_RECURRENCE flag.
+        uint32_t flags;
+
+        /// \brief Padding, always 0.
+        uint32_t reserved;
+    };
+
+    /// \brief An expanded instance.
+    struct Instance
+    {
+        /// \brief The instance start in epoch seconds.
+        int64_t start;
+
+        /// \brief The instance end in epoch seconds.
+        int64_t end;
+
+        /// \brief The row of the instance.
+        uint64_t row;
+    };
+
+    /// \brief A timezone table and the TZID it was found for.
+    struct Timezone
+    {
+        /// \brief The text offset of the NUL-terminated TZID.
+        uint64_t tzid;
+
+        /// \brief The index of the first transition.
+        uint32_t firstTransition;
+
+        /// \brief The number of transitions.
+        uint32_t numTransitions;
+
+        /// \brief See ICalendarTimezoneTable::getLocalStart().
+        int64_t localStart;
+
+        /// \brief See ICalendarTimezoneTable::getFirstYear().
+        int32_t firstYear;
+
+        /// \brief See ICalendarTimezoneTable::getLastYear().
+        int32_t lastYear;
+
+        /// \brief See ICalendarTimezoneTable::getInitialOffset().
+        int32_t offset;
+
+        /// \brief 1 iff daylight time applies before the first transition.
+        uint32_t isDaylight;
+    };
+
+    /// \brief A transition record.
+    struct Transition
+    {
+        /// \brief The instant of the change in epoch seconds.
+        int64_t time;
+
+        /// \brief The UTC offset in seconds after the change.
+        int32_t offset;
+
+        /// \brief The UTC offset in seconds before the change.
+        int32_t previousOffset;
+
+        /// \brief IS_DAYLIGHT and WAS_DAYLIGHT flags.
+        uint32_t flags;
+
+        /// \brief Padding, always 0.
+        uint32_t reserved;
+    };
+
+    enum
+    {
+        /// \brief The content hash is valid.
+        HAS_HASH = 1,
+
+        /// \brief The file holds an instance index.
+        HAS_INSTANCE_INDEX = 2,
+
+        /// \brief The row has an RRULE or RDATE.
+        HAS_RECURRENCE = 1,
+
+        /// \brief Daylight time applies after the change.
+        IS_DAYLIGHT = 1,
+
+        /// \brief Daylight time applied before the change.
+        WAS_DAYLIGHT = 2
+    };
+
+    /// \brief Check the header and records of a mapped file.
+    /// \param file the mapped file.
+    /// \returns true iff the file is a valid cache for this platform.
+    static bool validate(const MappedFile& file);
+
+    /// \brief Restore the compiled table of a parsed calendar.
+    /// \param file the validated file.
+    /// \param pCalendar the calendar parsed from the file.
+    /// \param compiled the empty table to fill.
+    /// \returns false iff the calendar's VEVENTs do not match the rows.
+    static bool restore(const MappedFile& file,
+                        icalcomponent* pCalendar,
+                        CompiledCalendar& compiled);
+
+    /// \brief Restore the instance index.
+    /// \param file the validated file.
+    /// \param index the empty index to fill.
+    static void restore(const MappedFile& file,
+                        ICalendarInstanceIndex& index);
+
+    /// \brief Append a NUL-terminated string to a pool.
+    /// \param pool the pool.
+    /// \param value the string to append.
+    /// \returns the pool offset of the string.
+    static uint64_t append(std::vector<char>& pool, const std::string& value);
+
+    /// \brief The file signature.
+    static const char MAGIC[8];
+
+    /// \brief The row or instance row that does not exist.
+    static const uint64_t NO_RECORD;
+
+};
+
+
+} } // namespace ofx::Time
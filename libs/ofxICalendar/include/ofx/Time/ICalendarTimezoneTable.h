@@ -0,0 +1,267 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <libical/ical.h>
+#include "Poco/Mutex.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A precomputed table of the UTC offset changes of a timezone.
+///
+/// libical expands the STANDARD and DAYLIGHT rules of a VTIMEZONE lazily
+/// and searches the expanded changes on every conversion.  The table
+/// records the same changes once, as a sorted array of UTC instants and
+/// offsets over a range of years, so converting between UTC and local
+/// time is a binary search that does not touch the timezone again.
+///
+/// The changes are read back from libical itself, so conversions give
+/// exactly the results of icaltimezone_get_utc_offset() and
+/// icaltimezone_get_utc_offset_of_utc_time(), including the handling of
+/// local times that are skipped or repeated at a change.  Times outside
+/// the range are reported as not covered, and callers fall back to
+/// libical.  So are local times near or before the first change of a
+/// VTIMEZONE that starts within the range, which libical converts
+/// irregularly.
+///
+/// Tables are immutable and shared.  get() returns the same table for
+/// every timezone with the same VTIMEZONE definition, across calendars.
+class ICalendarTimezoneTable
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<const ICalendarTimezoneTable> SharedPtr;
+
+    /// \brief A change of UTC offset.
+    struct Transition
+    {
+        /// \brief The instant of the change in epoch seconds.
+        int64_t time;
+
+        /// \brief The wall-clock seconds from which local times use the
+        /// new offset.
+        ///
+        /// This is the instant shifted by the smaller of the two offsets,
+        /// which is how libical orders local times against the change.
+        int64_t localTime;
+
+        /// \brief The UTC offset in seconds after the change.
+        int offset;
+
+        /// \brief The UTC offset in seconds before the change.
+        int previousOffset;
+
+        /// \brief True iff daylight time applies after the change.
+        bool isDaylight;
+
+        /// \brief True iff daylight time applied before the change.
+        bool wasDaylight;
+    };
+
+    /// \brief A sorted collection of transitions.
+    typedef std::vector<Transition> Transitions;
+
+    /// \brief Build the table of a timezone.
+    ///
+    /// The caller must hold the mutex guarding the calendar that owns the
+    /// timezone, as libical expands its changes while the table is built.
+    /// The expansion itself is made under
+    /// ICalendarUtils::getTimezoneMutex(), as builtin timezones are owned
+    /// by no calendar.
+    ///
+    /// \param pZone the timezone to tabulate.
+    /// \param firstYear the first year covered by the table.
+    /// \param lastYear the last year covered by the table.
+    ICalendarTimezoneTable(icaltimezone* pZone,
+                           int firstYear = DEFAULT_FIRST_YEAR,
+                           int lastYear = DEFAULT_LAST_YEAR);
+
+    /// \brief Create a table from changes recorded by another table.
+    ///
+    /// This restores a table saved with the accessors below, e.g. from an
+    /// ICalendarZoneInfo file, without asking libical again.
+    ///
+    /// \param firstYear the first year covered by the table.
+    /// \param lastYear the last year covered by the table.
+    /// \param offset the UTC offset before the first transition.
+    /// \param isDaylight true iff daylight time applies before the first
+    ///        transition.
+    /// \param localStart the wall-clock seconds from which local times
+    ///        are covered.
+    /// \param transitions the transitions sorted by time.
+    ICalendarTimezoneTable(int firstYear,
+                           int lastYear,
+                           int offset,
+                           bool isDaylight,
+                           int64_t localStart,
+                           const Transitions& transitions);
+
+    /// \brief Destroys the table.
+    ~ICalendarTimezoneTable();
+
+    /// \brief Get the UTC offset in effect at a UTC time.
+    /// \param time the time in epoch seconds.
+    /// \param offset the offset in seconds to be filled.
+    /// \param isDaylight filled with true iff daylight time applies.
+    /// \returns false iff the time is outside the table.
+    bool getOffsetOfUTC(int64_t time, int& offset, bool& isDaylight) const;
+
+    /// \brief Convert a local time to UTC.
+    ///
+    /// A local time repeated at a change uses the standard time offset,
+    /// unless isDaylight asks for daylight time.  A skipped local time uses
+    /// the offset after the change.  Both match libical.
+    ///
+    /// \param wallClock the local time in wall-clock seconds, i.e. its
+    ///        fields read as if they were UTC.
+    /// \param isDaylight the is_daylight flag of the local time.
+    /// \param time the time in epoch seconds to be filled.
+    /// \returns false iff the local time is not covered by the table.
+    bool toUTC(int64_t wallClock, bool isDaylight, int64_t& time) const;
+
+    /// \returns the first year covered by the table.
+    int getFirstYear() const;
+
+    /// \returns the last year covered by the table.
+    int getLastYear() const;
+
+    /// \returns the UTC offset before the first transition.
+    int getInitialOffset() const;
+
+    /// \returns true iff daylight time applies before the first transition.
+    bool isInitiallyDaylight() const;
+
+    /// \returns the wall-clock seconds from which local times are covered.
+    int64_t getLocalStart() const;
+
+    /// \returns the changes within the table, sorted by time.
+    const Transitions& getTransitions() const;
+
+    /// \brief Get the shared table of a timezone.
+    ///
+    /// Tables are keyed by the VTIMEZONE definition, so calendars that
+    /// embed the same timezone share one table.  A table is built on first
+    /// use and freed once no calendar holds it.  The caller must hold the
+    /// mutex guarding the calendar that owns the timezone.
+    ///
+    /// \param pZone the timezone.
+    /// \returns the table, or an empty pointer for UTC and for timezones
+    ///          without a definition.
+    static SharedPtr get(icaltimezone* pZone);
+
+    /// \brief Share a table for a VTIMEZONE definition.
+    ///
+    /// Later calls to get() for a timezone with the same definition return
+    /// the table instead of building one, for as long as it is held.
+    ///
+    /// \param pComponent the VTIMEZONE component.
+    /// \param table the table of the timezone.
+    static void insert(icalcomponent* pComponent, const SharedPtr& table);
+
+    enum
+    {
+        /// \brief The first year covered by default.
+        DEFAULT_FIRST_YEAR = 1970,
+
+        /// \brief The last year covered by default.
+        ///
+        /// libical does not expand timezone changes beyond 2037.
+        DEFAULT_LAST_YEAR = 2037
+    };
+
+private:
+    ICalendarTimezoneTable(const ICalendarTimezoneTable&);
+    ICalendarTimezoneTable& operator = (const ICalendarTimezoneTable&);
+
+    /// \brief Ask libical for the UTC offset at a UTC time.
+    /// \param pZone the timezone.
+    /// \param time the time in epoch seconds.
+    /// \param isDaylight filled with true iff daylight time applies.
+    /// \returns the offset in seconds.
+    static int getOffsetOfUTC(icaltimezone* pZone,
+                              int64_t time,
+                              bool& isDaylight);
+
+    /// \brief Drop the entries of tables that are no longer held.
+    ///
+    /// The caller must hold _tablesMutex.
+    static void prune();
+
+    /// \returns true iff the local time of lhs is before rhs.
+    static bool compareLocalTime(int64_t lhs, const Transition& rhs);
+
+    /// \returns true iff the instant of lhs is before rhs.
+    static bool compareTime(int64_t lhs, const Transition& rhs);
+
+    /// \brief A map of VTIMEZONE definitions to their tables.
+    typedef std::map<std::string, std::weak_ptr<const ICalendarTimezoneTable> > Tables;
+
+    /// \brief The first year covered.
+    int _firstYear;
+
+    /// \brief The last year covered.
+    int _lastYear;
+
+    /// \brief The start of the first year in epoch seconds.
+    int64_t _start;
+
+    /// \brief The end of the last year in epoch seconds.
+    int64_t _end;
+
+    /// \brief The UTC offset before the first transition.
+    int _offset;
+
+    /// \brief True iff daylight time applies before the first transition.
+    bool _isDaylight;
+
+    /// \brief The wall-clock seconds from which local times are covered.
+    int64_t _localStart;
+
+    /// \brief The transitions sorted by time.
+    Transitions _transitions;
+
+    /// \brief The shared tables.
+    ///
+    /// Guarded by _tablesMutex.
+    static Tables _tables;
+
+    /// \brief The mutex guarding _tables.
+    static Poco::Mutex _tablesMutex;
+
+};
+
+
+} } // namespace ofx::Time
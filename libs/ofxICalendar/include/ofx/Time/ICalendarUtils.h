@@ -26,14 +26,18 @@
 #pragma once
 
 
+#include <set>
 #include <string>
 #include <cstring>
+#include <stdint.h>
 #include <libical/ical.h>
 #include "Poco/File.h"
+#include "Poco/Mutex.h"
 #include "Poco/Timestamp.h"
 #include "Poco/Timezone.h"
 #include "Poco/DateTimeFormatter.h"
 #include "ofLog.h"
+#include "ofx/Time/ICalendarTimezoneTable.h"
 
 
 namespace ofx {
@@ -63,6 +67,188 @@ public:
                                   const std::string& key,
                                   std::string& value);
 
+    /// \brief Compute a 64-bit FNV-1a hash of a short byte string.
+    ///
+    /// This is intended for hashing short keys such as UIDs.
+    ///
+    /// \param data a pointer to the bytes to hash.
+    /// \param size the number of bytes to hash.
+    /// \returns the 64-bit hash of the bytes.
+    static uint64_t hash(const char* data, std::size_t size);
+
+    /// \brief Compute a 64-bit XXH64 hash of a block of bytes.
+    ///
+    /// Unlike hash(), this consumes 32 bytes per round and is intended for
+    /// hashing whole calendar feeds to detect changes.
+    ///
+    /// \param data a pointer to the bytes to hash.
+    /// \param size the number of bytes to hash.
+    /// \param seed the hash seed.
+    /// \returns the 64-bit hash of the bytes.
+    static uint64_t hashContent(const char* data,
+                                std::size_t size,
+                                uint64_t seed = 0);
+
+    /// \brief Test two time spans for overlap the way libical does.
+    ///
+    /// This reproduces icaltime_span_overlaps() so that cached instance
+    /// queries return exactly what icalcomponent_foreach_recurrence() would.
+    /// Spans overlap if either span has an endpoint strictly inside the
+    /// other or if both spans are identical.
+    ///
+    /// \param start0 the start of the first span in epoch seconds.
+    /// \param end0 the end of the first span in epoch seconds.
+    /// \param start1 the start of the second span in epoch seconds.
+    /// \param end1 the end of the second span in epoch seconds.
+    /// \returns true iff the spans overlap.
+    static bool spansOverlap(int64_t start0,
+                             int64_t end0,
+                             int64_t start1,
+                             int64_t end1);
+
+    /// \brief Get the span of an event's primary DTSTART / DTEND.
+    ///
+    /// The span is computed exactly as icalcomponent_foreach_recurrence()
+    /// computes its base span.  Recurrences of the event have the same
+    /// duration and are offset from the base span start by the wall-clock
+    /// difference between the recurrence time and DTSTART.
+    ///
+    /// \param pEventComponent a pointer to the VEVENT component.
+    /// \param start the span start in epoch seconds, filled on success.
+    /// \param end the span end in epoch seconds, filled on success.
+    /// \returns true iff the event has a valid DTSTART.
+    static bool getBaseSpan(icalcomponent* pEventComponent,
+                            int64_t& start,
+                            int64_t& end);
+
+    /// \brief Call a function for each recurrence of a component that
+    /// overlaps an interval.
+    ///
+    /// This is a drop-in replacement for icalcomponent_foreach_recurrence()
+    /// that calls back with exactly the same spans, in the same order.
+    /// Instead of stepping each RRULE from DTSTART it seeks to the interval
+    /// with an ICalendarRecurrenceIterator, so for the common rules the cost
+    /// does not grow with the age of the event.
+    ///
+    /// Given the offset table of the DTSTART timezone, recurrences are
+    /// converted to UTC with the table rather than with libical.
+    ///
+    /// \param pComponent a pointer to the recurring component.
+    /// \param start the start of the interval.
+    /// \param end the end of the interval.
+    /// \param callback the function to call for each recurrence.
+    /// \param data the user data passed to the callback.
+    /// \param pTable the offset table of the DTSTART timezone, may be 0.
+    static void forEachRecurrence(icalcomponent* pComponent,
+                                  struct icaltimetype start,
+                                  struct icaltimetype end,
+                                  void (*callback)(icalcomponent* component,
+                                                   struct icaltime_span* span,
+                                                   void* data),
+                                  void* data,
+                                  const ICalendarTimezoneTable* pTable = 0);
+
+    /// \brief Convert a time to UTC the way icaltime_compare() does.
+    ///
+    /// Dates and floating times are not converted.  Times in the timezone
+    /// pZone are converted with its offset table if it covers them.
+    ///
+    /// \param time the time to convert.
+    /// \param pZone the timezone the table belongs to.
+    /// \param pTable the offset table of pZone, may be 0.
+    /// \returns the UTC time in epoch seconds.
+    static int64_t toUTC(const struct icaltimetype& time,
+                         const icaltimezone* pZone,
+                         const ICalendarTimezoneTable* pTable);
+
+    /// \brief Test whether a recurrence is excluded by an EXDATE or EXRULE.
+    ///
+    /// This gives the result of icalproperty_recurrence_is_excluded(), but
+    /// compares EXDATEs in the DTSTART timezone using its offset table.
+    /// Components with an EXRULE, or with an EXDATE in another timezone,
+    /// are left to libical.  Unlike libical, this moves the component's
+    /// property iterator.
+    ///
+    /// \param pComponent a pointer to the recurring component.
+    /// \param dtstart the DTSTART of the component.
+    /// \param time the recurrence time.
+    /// \param pTable the offset table of the DTSTART timezone, may be 0.
+    /// \returns true iff the recurrence is excluded.
+    static bool isExcluded(icalcomponent* pComponent,
+                           struct icaltimetype dtstart,
+                           struct icaltimetype time,
+                           const ICalendarTimezoneTable* pTable);
+
+    /// \brief Convert a time to wall-clock seconds since the epoch.
+    ///
+    /// Wall-clock seconds treat the fields of a time as if they were UTC,
+    /// which makes calendar arithmetic independent of timezones.
+    ///
+    /// \param time the time to convert.
+    /// \returns the wall-clock seconds.
+    static int64_t toWallClock(const struct icaltimetype& time);
+
+    /// \returns the quotient of two numbers rounded towards negative infinity.
+    static int64_t floorDivide(int64_t numerator, int64_t denominator);
+
+    /// \returns the number of days from 1970-01-01 to a civil date.
+    static int64_t daysFromCivil(int year, int month, int day);
+
+    /// \brief Convert a day number to a civil date.
+    static void civilFromDays(int64_t days, int& year, int& month, int& day);
+
+    /// \brief Expand the timezone transitions a component depends on.
+    ///
+    /// libical computes the UTC offset changes of each timezone lazily and
+    /// without locking, the first time a conversion reaches a new year.
+    /// This converts the component's DTSTART, DTEND, RDATE and EXDATE
+    /// times, and a time in the last year an expansion may reach, so that
+    /// expanding the component later only reads the shared timezones.  It
+    /// also resolves the TZIDs, which sorts the calendar's timezones once.
+    ///
+    /// Builtin timezones are shared by every calendar in the process, so
+    /// the conversions are made under getTimezoneMutex().  The caller must
+    /// also hold the mutex guarding the libical tree.
+    ///
+    /// \param pComponent a pointer to the VEVENT component.
+    /// \param year the last year that will be expanded.  Recurrences are
+    ///        always prepared up to 2038, where libical stops them.
+    static void prepareTimezones(icalcomponent* pComponent, int year);
+
+    /// \brief Get the mutex that guards the expansion of shared timezones.
+    ///
+    /// libical's builtin timezones are not owned by any calendar, so the
+    /// mutex of a snapshot does not keep two calendars from expanding the
+    /// same builtin timezone at once.  Code that may convert a time in a
+    /// timezone libical has not expanded that far yet holds this mutex.
+    ///
+    /// \returns the process-wide timezone mutex.
+    static Poco::Mutex& getTimezoneMutex();
+
+    /// \brief Find the TZIDs a calendar references but does not define.
+    ///
+    /// The TZID parameters of all properties of the calendar's components
+    /// are collected, except those of its VTIMEZONEs.
+    ///
+    /// \param pCalendar a pointer to the VCALENDAR component.
+    /// \param tzids the set to add the missing TZIDs to.
+    static void findMissingTimezones(icalcomponent* pCalendar,
+                                     std::set<std::string>& tzids);
+
+    /// \brief Copy VTIMEZONEs from one component to another.
+    ///
+    /// Each VTIMEZONE of pSource whose TZID is in tzids and not yet defined
+    /// by pTarget is cloned and added to pTarget.
+    ///
+    /// \param pSource a pointer to the component to copy VTIMEZONEs from,
+    ///        may be 0.
+    /// \param tzids the TZIDs to copy.
+    /// \param pTarget a pointer to the component to add them to.
+    /// \returns the number of VTIMEZONEs copied.
+    static std::size_t copyTimezones(icalcomponent* pSource,
+                                     const std::set<std::string>& tzids,
+                                     icalcomponent* pTarget);
+
 //    static void sortByStartTime(std::vector<ICalendarEvent>& events);
 //
 //    static void sortByStartTime(std::vector<ICalendarEventInstance>& events);
@@ -72,6 +258,9 @@ public:
 //        ///< Returns a pointer to a known icaltimezone if the zone is defined
 //        ///< in the icalendar file.  If the zone is not defined, 0 is returned.
 
+private:
+    /// \brief The mutex that guards the expansion of shared timezones.
+    static Poco::Mutex _timezoneMutex;
 
 };
 
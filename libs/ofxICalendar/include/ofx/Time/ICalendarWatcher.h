@@ -27,8 +27,8 @@
 
 
 #include <string>
-#include <map>
-#include <algorithm>
+#include <unordered_map>
+#include <vector>
 #include "ofEvents.h"
 #include "ofEventUtils.h"
 #include "ofx/Time/ICalendar.h"
@@ -44,6 +44,13 @@ namespace Time {
 /// Additionally it provides events for ICalendarEvent beginnings and endings.
 /// These events can be used to trigger any behavior in the
 /// ICalendarWatcherEvent listener.
+///
+/// The watcher does not poll.  Whenever the calendar publishes a new
+/// snapshot, it queries the instances within a look-ahead window once and
+/// keeps a sorted queue of their start and end transitions.  Each
+/// ofEvents().update then only pops the transitions that are due, so
+/// between transitions it costs one timestamp comparison.  The queue is
+/// rebuilt when the window runs out.
 class ICalendarWatcher
 {
 public:
@@ -58,12 +65,34 @@ public:
     virtual ~ICalendarWatcher();
 
     /// \brief Sets the update interval in milliseconds.
+    ///
+    /// \deprecated The watcher no longer polls.  This is equivalent to
+    /// setLookAhead().
+    ///
     /// \param updateInterval the update interval in milliseconds.
     void setUpdateInterval(unsigned long long updateInterval);
 
     /// \returns the current update interval in milliseconds.
+    /// \deprecated This is equivalent to getLookAhead().
     unsigned long long getUpdateInterval() const;
 
+    /// \brief Sets the look-ahead window in milliseconds.
+    ///
+    /// The transitions of all instances that start or end within the
+    /// window are queued in advance.  A longer window means fewer instance
+    /// queries and a longer queue.  The queue is rebuilt with the new
+    /// window on the next update.
+    ///
+    /// \param lookAhead the look-ahead window in milliseconds.
+    void setLookAhead(unsigned long long lookAhead);
+
+    /// \returns the look-ahead window in milliseconds.
+    unsigned long long getLookAhead() const;
+
+    /// \returns the time of the next queued transition or the end of the
+    /// look-ahead window, whichever is earlier.
+    Poco::Timestamp getNextRefresh() const;
+
     /// \brief A utility method for registering a ListenerClass to listen
     /// for ICalendarWatcherEvents.
     ///
@@ -123,8 +152,12 @@ public:
     ICalendarWatcherEvents events;
 
     /// \brief The default update interval for updating the watch.
+    /// \deprecated The watcher no longer polls.
     static const Poco::Timespan DEFAULT_UPDATE_INTERVAL;
 
+    /// \brief The default look-ahead window.
+    static const Poco::Timespan DEFAULT_LOOK_AHEAD;
+
     /// \brief Make a shared instance.
     static SharedPtr makeShared(ICalendar::SharedPtr calendar)
     {
@@ -135,33 +168,107 @@ private:
     /// \brief The calendar being watched.
     ICalendar::SharedPtr _calendar;
 
-    /// \brief A collection of all current watches.
-    ICalendar::EventInstances _watches;
+    /// \brief A watched instance.
+    struct Watch
+    {
+        /// \brief Create a Watch.
+        /// \param watchedInstance the watched instance.
+        /// \param eventLastModified the LAST-MODIFIED time of its event.
+        Watch(const ICalendarEventInstance& watchedInstance,
+              const Poco::Timestamp& eventLastModified);
+
+        /// \brief The watched instance.
+        ICalendarEventInstance instance;
+
+        /// \brief The LAST-MODIFIED time of the event when last checked.
+        Poco::Timestamp lastModified;
+    };
+
+    /// \brief The watches, keyed by occurrence key.
+    ///
+    /// Distinct occurrences of an event never share a start time, so each
+    /// occurrence, including a detached one, has its own key.  Keys are
+    /// hashes and may collide, so a key can map to several watches, which
+    /// findWatch() tells apart.
+    typedef std::unordered_multimap<uint64_t, Watch> Watches;
+
+    /// \brief All current watches.
+    Watches _watches;
 
-    /// \brief A map of the last updated times for the current watches.
-    std::map<std::string, Poco::Timestamp> _watchesLastUpdated;
+    /// \brief A queued start or end of an upcoming instance.
+    struct Transition
+    {
+        /// \brief The time of the transition in epoch microseconds.
+        Poco::Timestamp::TimeVal time;
+
+        /// \brief True for a start, false for an end.
+        bool isStart;
+
+        /// \brief The index of the instance in _upcoming.
+        std::size_t index;
+
+        /// \returns true iff this transition is due before other.  Starts
+        /// are due before ends at the same time.
+        bool operator < (const Transition& other) const;
+    };
+
+    /// \brief The instances within the look-ahead window.
+    ICalendar::EventInstances _upcoming;
+
+    /// \brief The transitions of _upcoming, sorted by time.
+    std::vector<Transition> _transitions;
+
+    /// \brief The index of the next transition that is due.
+    std::size_t _nextTransition;
+
+    /// \brief The end of the look-ahead window.
+    Poco::Timestamp _windowEnd;
 
     /// \brief The last time the watches were updated.
     Poco::Timestamp _lastUpdate;
 
-    /// \brief The timespan for updating the watches.
-    Poco::Timespan _updateInterval;
+    /// \brief The look-ahead window.
+    Poco::Timespan _lookAhead;
+
+    /// \brief The generation of the calendar when the queue was built.
+    uint64_t _generation;
+
+    /// \brief Look up the LAST-MODIFIED time of an instance's event.
+    ///
+    /// The time is read from the snapshot's compiled table, so a refresh
+    /// takes a single snapshot instead of one per instance.
+    ///
+    /// \param pSnapshot a pointer to the snapshot to read, may be 0.
+    /// \param instance the instance whose event is looked up.
+    /// \returns the LAST-MODIFIED time, or 0 if the event is not found.
+    static Poco::Timestamp getLastModified(const ICalendarSnapshot* pSnapshot,
+                                           const ICalendarEventInstance& instance);
+
+    /// \brief Find the watch of an instance's occurrence.
+    /// \param watches the watches to search.
+    /// \param instance the instance to find.
+    /// \returns an iterator to the watch or watches.end().
+    static Watches::iterator findWatch(Watches& watches,
+                                       const ICalendarEventInstance& instance);
 
     /// \brief A callback for the ofApp to keep everything in the
     /// main thread.  Is automatically registered and unregistered
     /// upon Watcher construction and destruction.
     void update(ofEventArgs& args);
 
-    /// \brief Manually refresh the watch. Overrides auto watcher and
-    /// updates the _lastUpdate variable.
-    void refresh();
+    /// \brief Manually refresh the watch.
+    ///
+    /// The watches are compared with the instances in progress and the
+    /// transition queue is rebuilt for the look-ahead window.  Instances
+    /// that started and ended since the last update fire their start and
+    /// end right away.
+    ///
+    /// \param now the time of the refresh.
+    void refresh(const Poco::Timestamp& now);
 
-    /// \brief Compare two ICalendarEventInstances.
-    /// \param lhs the left hand side instance.
-    /// \param rhs the right hand side instance.
-    /// \returns true iff the left event's uid is before the right event's uid.
-    static bool compareUID(const ICalendarEventInstance& lhs,
-                           const ICalendarEventInstance& rhs);
+    /// \brief Fire all queued transitions that are due.
+    /// \param now the current time.
+    void advance(const Poco::Timestamp& now);
 
 };
 
@@ -0,0 +1,117 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <ostream>
+#include <vector>
+#include <libical/ical.h>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A streaming icalendar writer.
+///
+/// icalcomponent_as_ical_string() builds the text of a whole component tree
+/// in one growing heap buffer, which is then held in libical's ring of
+/// temporary buffers, so writing a calendar needs memory proportional to
+/// its size.
+/// ICalendarWriter instead walks the tree and passes each folded content
+/// line to the stream through a fixed-size buffer as soon as it is built.
+/// Only one property is held in memory at a time.
+///
+/// The output is the same as icalcomponent_as_ical_string().
+///
+/// libical stores iteration state inside each icalcomponent, so the caller
+/// must hold the mutex guarding the tree, e.g. ICalendarSnapshot::getMutex().
+class ICalendarWriter
+{
+public:
+    /// \brief The default chunk size.
+    enum
+    {
+        DEFAULT_CHUNK_SIZE = 64 * 1024
+    };
+
+    /// \brief Create a writer.
+    /// \param stream the stream to write to.
+    /// \param chunkSize the number of bytes to buffer before writing to the
+    ///        stream.
+    ICalendarWriter(std::ostream& stream,
+                    std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /// \brief Writes any buffered data to the stream.
+    virtual ~ICalendarWriter();
+
+    /// \brief Write a component and all of its subcomponents.
+    /// \param pComponent the component to write, may be 0.
+    void write(icalcomponent* pComponent);
+
+    /// \brief Write any buffered data to the stream.
+    void flush();
+
+    /// \brief Write a component to a stream.
+    /// \param stream the stream to write to.
+    /// \param pComponent the component to write, may be 0.
+    /// \param chunkSize the number of bytes to buffer before writing to the
+    ///        stream.
+    static void write(std::ostream& stream,
+                      icalcomponent* pComponent,
+                      std::size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+private:
+    ICalendarWriter(const ICalendarWriter&);
+    ICalendarWriter& operator = (const ICalendarWriter&);
+
+    /// \brief Append data to the buffer, flushing it when it is full.
+    /// \param pData the data to append.
+    /// \param size the number of bytes to append.
+    void append(const char* pData, std::size_t size);
+
+    /// \brief Append a NUL-terminated string to the buffer.
+    /// \param pString the string to append.
+    void append(const char* pString);
+
+    /// \brief Append a string returned by libical and free it.
+    /// \param pString the string to append, may be 0.
+    void appendAndFree(char* pString);
+
+    /// \brief The stream written to.
+    std::ostream& _stream;
+
+    /// \brief The buffered data.
+    std::vector<char> _buffer;
+
+    /// \brief The capacity of the buffer.
+    std::size_t _chunkSize;
+
+};
+
+
+} } // namespace ofx::Time
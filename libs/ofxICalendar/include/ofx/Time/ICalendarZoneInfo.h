@@ -0,0 +1,329 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <libical/ical.h>
+#include "Poco/Mutex.h"
+#include "ofx/Time/ICalendarTimezoneTable.h"
+#include "ofx/Time/MappedFile.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A prebuilt index of the bundled zoneinfo timezones.
+///
+/// The addon bundles one VTIMEZONE .ics file per Olson timezone, listed in
+/// a zones.tab file.  Resolving an undefined TZID through libical reads the
+/// whole zone table the first time and then loads each timezone from its
+/// own file.  compile() instead packs every timezone, with its
+/// ICalendarTimezoneTable, into a single file that open() maps in constant
+/// time.  Looking a timezone up is then a binary search over the mapped
+/// names, without any further file I/O.
+///
+/// The file is written in the byte order and layout of the compiling
+/// platform, so it must be compiled on (or for) the platform that opens
+/// it.  open() rejects files of another layout.
+///
+/// The example ships a file compiled from the bundled zoneinfo for
+/// little-endian platforms in example/bin/data/zoneinfo.bin.  Applications
+/// that need another zoneinfo compile the file when they are built or
+/// deployed, not at startup:
+///
+///     ICalendarZoneInfo::compile(ofToDataPath("zoneinfo"),
+///                                ofToDataPath("zoneinfo.bin"));
+///
+/// Applications open it at startup, before loading any calendars:
+///
+///     ICalendarZoneInfo::getDefault()->open(ofToDataPath("zoneinfo.bin"));
+///
+/// Calendars then resolve the TZIDs they reference but do not define from
+/// the default index, see addTimezones().  The VTIMEZONEs are kept beside
+/// the parsed calendar, which is not modified.
+///
+/// All methods are thread-safe.
+class ICalendarZoneInfo
+{
+public:
+    /// \brief A shared pointer typedef.
+    typedef std::shared_ptr<ICalendarZoneInfo> SharedPtr;
+
+    /// \brief Create an index with no file open.
+    ICalendarZoneInfo();
+
+    /// \brief Destroys the index.
+    ~ICalendarZoneInfo();
+
+    /// \brief Map a compiled zoneinfo file, replacing any open file.
+    /// \param path the path of the file.
+    /// \returns true iff the file was mapped and is valid.
+    bool open(const std::string& path);
+
+    /// \brief Unmap the file.
+    void close();
+
+    /// \returns true iff a file is open.
+    bool isOpen() const;
+
+    /// \returns the number of timezones in the file.
+    std::size_t size() const;
+
+    /// \brief Test whether a TZID names a timezone in the file.
+    ///
+    /// TZIDs match the Olson name of a timezone, optionally preceded by a
+    /// vendor prefix such as "/freeassociation.sourceforge.net/Tzfile/".
+    ///
+    /// \param tzid the TZID to find.
+    /// \returns true iff the timezone was found.
+    bool hasTimezone(const std::string& tzid) const;
+
+    /// \brief Create a VTIMEZONE component for a TZID.
+    /// \param tzid the TZID to find.  The component uses it as its TZID.
+    /// \returns a new component that the caller must free, or 0 if the
+    ///          timezone was not found.
+    icalcomponent* newTimezoneComponent(const std::string& tzid) const;
+
+    /// \brief Get the offset table of a timezone.
+    /// \param tzid the TZID to find.
+    /// \returns the table, or an empty pointer if the timezone was not
+    ///          found.
+    ICalendarTimezoneTable::SharedPtr getTimezoneTable(const std::string& tzid) const;
+
+    /// \brief Add the VTIMEZONEs of the given TZIDs to a component.
+    ///
+    /// Each TZID that pTimezones does not define yet is looked up in the
+    /// file, and the timezone is added to pTimezones with its table shared
+    /// through ICalendarTimezoneTable::insert().  TZIDs that are not found
+    /// are left to libical.
+    ///
+    /// \param tzids the TZIDs to add, e.g. from
+    ///        ICalendarUtils::findMissingTimezones().
+    /// \param pTimezones the component to add the VTIMEZONEs to.
+    /// \returns the number of VTIMEZONEs added.
+    std::size_t addTimezones(const std::set<std::string>& tzids,
+                             icalcomponent* pTimezones) const;
+
+    /// \brief Compile a zoneinfo directory into a file.
+    ///
+    /// The directory holds a zones.tab file naming each timezone and one
+    /// <name>.ics file per timezone, like libs/libical/share/libical/zoneinfo.
+    /// Building the tables asks libical for every change from
+    /// ICalendarTimezoneTable::DEFAULT_FIRST_YEAR to DEFAULT_LAST_YEAR, so
+    /// this takes some seconds.  The file is replaced atomically.
+    ///
+    /// \param directory the zoneinfo directory.
+    /// \param path the path of the file to write.
+    /// \returns true iff the file was written.
+    static bool compile(const std::string& directory, const std::string& path);
+
+    /// \brief Get the index used by the calendar classes.
+    ///
+    /// No file is open until the application opens one.
+    ///
+    /// \returns the shared index.
+    static SharedPtr getDefault();
+
+    enum
+    {
+        /// \brief The version of the file layout.
+        VERSION = 1,
+
+        /// \brief The index of a timezone that was not found.
+        NO_ZONE = -1
+    };
+
+private:
+    ICalendarZoneInfo(const ICalendarZoneInfo&);
+    ICalendarZoneInfo& operator = (const ICalendarZoneInfo&);
+
+    /// \brief The file header.
+    struct Header
+    {
+        /// \brief The file signature, MAGIC.
+        char magic[8];
+
+        /// \brief The layout version.
+        uint32_t version;
+
+        /// \brief 0x01020304 in the byte order of the file.
+        uint32_t byteOrder;
+
+        /// \brief The number of timezones.
+        uint32_t numZones;
+
+        /// \brief The number of transitions of all timezones.
+        uint32_t numTransitions;
+
+        /// \brief The first year covered by the tables.
+        int32_t firstYear;
+
+        /// \brief The last year covered by the tables.
+        int32_t lastYear;
+
+        /// \brief The file offset of the timezone records.
+        uint64_t zonesOffset;
+
+        /// \brief The file offset of the transition records.
+        uint64_t transitionsOffset;
+
+        /// \brief The file offset of the string pool.
+        uint64_t stringsOffset;
+
+        /// \brief The size of the string pool.
+        uint64_t stringsSize;
+    };
+
+    /// \brief A timezone record.  Records are sorted by name.
+    struct Zone
+    {
+        /// \brief The pool offset of the NUL-terminated Olson name.
+        uint32_t name;
+
+        /// \brief The pool offset of the NUL-terminated VTIMEZONE.
+        uint32_t definition;
+
+        /// \brief The index of the first transition.
+        uint32_t firstTransition;
+
+        /// \brief The number of transitions.
+        uint32_t numTransitions;
+
+        /// \brief See ICalendarTimezoneTable::getLocalStart().
+        int64_t localStart;
+
+        /// \brief See ICalendarTimezoneTable::getInitialOffset().
+        int32_t offset;
+
+        /// \brief 1 iff daylight time applies before the first transition.
+        uint32_t isDaylight;
+    };
+
+    /// \brief A transition record.
+    struct Transition
+    {
+        /// \brief The instant of the change in epoch seconds.
+        int64_t time;
+
+        /// \brief The UTC offset in seconds after the change.
+        int32_t offset;
+
+        /// \brief The UTC offset in seconds before the change.
+        int32_t previousOffset;
+
+        /// \brief IS_DAYLIGHT and WAS_DAYLIGHT flags.
+        uint32_t flags;
+
+        /// \brief Padding, always 0.
+        uint32_t reserved;
+    };
+
+    enum
+    {
+        /// \brief Daylight time applies after the change.
+        IS_DAYLIGHT = 1,
+
+        /// \brief Daylight time applied before the change.
+        WAS_DAYLIGHT = 2
+    };
+
+    /// \brief Find a timezone by TZID.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param tzid the TZID to find.
+    /// \returns the index of the timezone or NO_ZONE.
+    int find(const char* tzid) const;
+
+    /// \brief Find a timezone by its exact Olson name.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param name the name to find.
+    /// \returns the index of the timezone or NO_ZONE.
+    int findName(const char* name) const;
+
+    /// \brief Get the table of a timezone, restoring it on first use.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param index the index of the timezone.
+    /// \returns the table.
+    ICalendarTimezoneTable::SharedPtr getTable(int index) const;
+
+    /// \brief Create a VTIMEZONE component with the given TZID.
+    ///
+    /// The caller must hold _mutex.
+    ///
+    /// \param index the index of the timezone.
+    /// \param tzid the TZID of the component.
+    /// \returns a new component that the caller must free, or 0.
+    icalcomponent* newComponent(int index, const char* tzid) const;
+
+    /// \brief Check the header and records of the mapped file.
+    /// \returns true iff the file is a valid compiled zoneinfo file.
+    bool validate() const;
+
+    /// \brief Forget the mapped file.
+    ///
+    /// The caller must hold _mutex.
+    void reset();
+
+    /// \brief The file signature.
+    static const char MAGIC[8];
+
+    /// \brief The mapped file.
+    MappedFile _file;
+
+    /// \brief The header, or 0 if no file is open.
+    const Header* _pHeader;
+
+    /// \brief The timezone records.
+    const Zone* _pZones;
+
+    /// \brief The transition records.
+    const Transition* _pTransitions;
+
+    /// \brief The string pool.
+    const char* _pStrings;
+
+    /// \brief The tables restored so far, by timezone index.
+    mutable std::vector<ICalendarTimezoneTable::SharedPtr> _tables;
+
+    /// \brief The mutex guarding all members.
+    mutable Poco::Mutex _mutex;
+
+};
+
+
+} } // namespace ofx::Time
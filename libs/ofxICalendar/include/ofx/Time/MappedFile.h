@@ -0,0 +1,85 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+namespace ofx {
+namespace Time {
+
+
+/// \brief A read-only view of a whole local file.
+///
+/// On POSIX systems the file is memory-mapped with a sequential access
+/// hint, so its contents are paged in on demand and never copied to the
+/// heap.  Elsewhere, or if the file can not be mapped, it is read into a
+/// heap buffer.
+class MappedFile
+{
+public:
+    /// \brief Create an empty MappedFile.
+    MappedFile();
+
+    /// \brief Unmaps the file.
+    virtual ~MappedFile();
+
+    /// \brief Map a file, replacing any previously mapped file.
+    /// \param path the path of the file to map.
+    /// \returns true iff the file was mapped.  Empty files are mapped
+    /// successfully with a size of 0.
+    bool open(const std::string& path);
+
+    /// \brief Unmap the file.
+    void close();
+
+    /// \returns a pointer to the file contents or 0 if the file is empty or
+    /// not mapped.  The contents are not NUL-terminated.
+    const char* getData() const;
+
+    /// \returns the size of the file contents in bytes.
+    std::size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator = (const MappedFile&);
+
+    /// \brief The start of the mapping, or 0 if the file is not mapped.
+    void* _pMapped;
+
+    /// \brief The size of the file contents.
+    std::size_t _size;
+
+    /// \brief The file contents if the file could not be mapped.
+    std::vector<char> _buffer;
+
+};
+
+
+} } // namespace ofx::Time
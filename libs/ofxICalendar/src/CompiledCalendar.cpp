@@ -0,0 +1,705 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/CompiledCalendar.h"
+#include <algorithm>
+#include <cstring>
+#include "ofLog.h"
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+CompiledCalendar::CompiledCalendar():
+    _lastModified(0),
+    _numRemoved(0),
+    _numStale(0)
+{
+    _strings.push_back('\0');
+}
+
+
+CompiledCalendar::~CompiledCalendar()
+{
+}
+
+
+void CompiledCalendar::compile(icalcomponent* pCalendar)
+{
+    clear();
+
+    if (!pCalendar)
+    {
+        return;
+    }
+
+    std::size_t count = icalcomponent_count_components(pCalendar,
+                                                       ICAL_VEVENT_COMPONENT);
+
+    _components.reserve(count);
+    _uids.reserve(count);
+    _uidLengths.reserve(count);
+    _summaries.reserve(count);
+    _locations.reserve(count);
+    _starts.reserve(count);
+    _ends.reserve(count);
+    _lastModifieds.reserve(count);
+    _recurrenceIDs.reserve(count);
+    _sequences.reserve(count);
+    _recurrences.reserve(count);
+    _timezones.reserve(count);
+    _nextRows.reserve(count);
+    _index.reset(count);
+
+    StringOffsets offsets;
+
+    icalcomponent* pComponent = icalcomponent_get_first_component(pCalendar,
+                                                                  ICAL_ANY_COMPONENT);
+
+    while (pComponent)
+    {
+        if (ICAL_VEVENT_COMPONENT == icalcomponent_isa(pComponent))
+        {
+            // Also tracks the newest LAST-MODIFIED.
+            append(pComponent, &offsets);
+        }
+        else
+        {
+            Poco::Timestamp::TimeVal lastModified = getLastModified(pComponent);
+
+            if (lastModified > _lastModified)
+            {
+                _lastModified = lastModified;
+            }
+        }
+
+        pComponent = icalcomponent_get_next_component(pCalendar,
+                                                      ICAL_ANY_COMPONENT);
+    }
+}
+
+
+void CompiledCalendar::merge(icalcomponent* pUpdate,
+                             ICalendarChangeSet& changes)
+{
+    changes.clear();
+
+    if (!pUpdate)
+    {
+        return;
+    }
+
+    // VEVENTs without a UID are removed from pUpdate below, so collect the
+    // components first.
+    std::vector<icalcomponent*> components;
+
+    icalcomponent* pComponent = icalcomponent_get_first_component(pUpdate,
+                                                                  ICAL_ANY_COMPONENT);
+
+    while (pComponent)
+    {
+        components.push_back(pComponent);
+        pComponent = icalcomponent_get_next_component(pUpdate,
+                                                      ICAL_ANY_COMPONENT);
+    }
+
+    std::size_t count = _components.size();
+    std::vector<unsigned char> matched(count, 0);
+    Poco::Timestamp::TimeVal newestModified = 0;
+
+    // Replace the tables of TZIDs whose VTIMEZONE changed before any row is
+    // read again, so modified and added rows use the new definitions.
+    std::vector<ICalendarTimezoneTable::SharedPtr> replaced;
+
+    std::vector<icalcomponent*>::const_iterator iter = components.begin();
+
+    while (iter != components.end())
+    {
+        if (ICAL_VTIMEZONE_COMPONENT == icalcomponent_isa(*iter))
+        {
+            icalproperty* pProperty = icalcomponent_get_first_property(*iter,
+                                                                       ICAL_TZID_PROPERTY);
+
+            const char* pTZID = pProperty ? icalproperty_get_tzid(pProperty) : 0;
+
+            TimezoneTables::iterator tableIter = pTZID ? _timezoneTables.find(pTZID) : _timezoneTables.end();
+
+            if (tableIter != _timezoneTables.end())
+            {
+                ICalendarTimezoneTable::SharedPtr table = ICalendarTimezoneTable::get(icalcomponent_get_timezone(pUpdate, pTZID));
+
+                if (table != tableIter->second)
+                {
+                    replaced.push_back(tableIter->second);
+                    tableIter->second = table;
+                }
+            }
+        }
+
+        ++iter;
+    }
+
+    iter = components.begin();
+
+    while (iter != components.end())
+    {
+        pComponent = *iter;
+
+        Poco::Timestamp::TimeVal lastModified = getLastModified(pComponent);
+
+        if (lastModified > newestModified)
+        {
+            newestModified = lastModified;
+        }
+
+        if (ICAL_VEVENT_COMPONENT == icalcomponent_isa(pComponent))
+        {
+            const char* pUID = getUID(pComponent);
+            std::size_t length = pUID ? std::strlen(pUID) : 0;
+
+            if (0 == length)
+            {
+                ofLogVerbose("CompiledCalendar::merge()") << "UID string was missing, skipping.";
+
+                icalcomponent_remove_component(pUpdate, pComponent);
+                icalcomponent_free(pComponent);
+            }
+            else
+            {
+                Poco::Timestamp::TimeVal recurrenceID = toTimeVal(icalcomponent_get_recurrenceid(pComponent));
+
+                // Duplicates of a UID and RECURRENCE-ID are matched in order.
+                std::size_t row = find(pUID, length, recurrenceID);
+
+                while (row != ICalendarEventIndex::NO_ROW &&
+                       (row >= count || matched[row] || _recurrenceIDs[row] != recurrenceID))
+                {
+                    row = _nextRows[row];
+                }
+
+                if (ICalendarEventIndex::NO_ROW == row)
+                {
+                    changes.added.push_back(std::string(pUID, length));
+                    changes.rows.push_back(append(pComponent, 0));
+                }
+                else
+                {
+                    matched[row] = 1;
+
+                    _components[row] = pComponent;
+
+                    if (getSequence(pComponent) != _sequences[row] ||
+                        lastModified != _lastModifieds[row])
+                    {
+                        matched[row] = 2;
+
+                        changes.modified.push_back(std::string(pUID, length));
+                        changes.rows.push_back(row);
+
+                        fill(row, 0);
+                        ++_numStale;
+                    }
+                }
+            }
+        }
+
+        ++iter;
+    }
+
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        // Unmodified rows in a changed timezone are read again as well.
+        if (1 == matched[row] &&
+            _timezones[row] &&
+            std::find(replaced.begin(), replaced.end(), _timezones[row]) != replaced.end())
+        {
+            changes.modified.push_back(std::string(getUID(row), _uidLengths[row]));
+            changes.rows.push_back(row);
+
+            fill(row, 0);
+            ++_numStale;
+        }
+        else if (!matched[row] && _components[row])
+        {
+            if (_uidLengths[row] > 0)
+            {
+                changes.removed.push_back(std::string(getUID(row), _uidLengths[row]));
+            }
+
+            changes.rows.push_back(row);
+
+            remove(row);
+        }
+    }
+
+    _lastModified = newestModified;
+}
+
+
+void CompiledCalendar::clear()
+{
+    _components.clear();
+    _uids.clear();
+    _uidLengths.clear();
+    _summaries.clear();
+    _locations.clear();
+    _starts.clear();
+    _ends.clear();
+    _lastModifieds.clear();
+    _recurrenceIDs.clear();
+    _sequences.clear();
+    _recurrences.clear();
+    _timezones.clear();
+    _nextRows.clear();
+    _index.clear();
+    _timezoneTables.clear();
+    _strings.assign(1, '\0');
+    _lastModified = 0;
+    _numRemoved = 0;
+    _numStale = 0;
+}
+
+
+void CompiledCalendar::swap(CompiledCalendar& other)
+{
+    _components.swap(other._components);
+    _uids.swap(other._uids);
+    _uidLengths.swap(other._uidLengths);
+    _summaries.swap(other._summaries);
+    _locations.swap(other._locations);
+    _starts.swap(other._starts);
+    _ends.swap(other._ends);
+    _lastModifieds.swap(other._lastModifieds);
+    _recurrenceIDs.swap(other._recurrenceIDs);
+    _sequences.swap(other._sequences);
+    _recurrences.swap(other._recurrences);
+    _timezones.swap(other._timezones);
+    _nextRows.swap(other._nextRows);
+    _strings.swap(other._strings);
+    _index.swap(other._index);
+    _timezoneTables.swap(other._timezoneTables);
+    std::swap(_lastModified, other._lastModified);
+    std::swap(_numRemoved, other._numRemoved);
+    std::swap(_numStale, other._numStale);
+}
+
+
+std::size_t CompiledCalendar::size() const
+{
+    return _components.size();
+}
+
+
+bool CompiledCalendar::empty() const
+{
+    return _components.empty();
+}
+
+
+std::size_t CompiledCalendar::getNumRemoved() const
+{
+    return _numRemoved;
+}
+
+
+bool CompiledCalendar::isFragmented() const
+{
+    return _numStale * 2 > _components.size();
+}
+
+
+bool CompiledCalendar::isRemoved(std::size_t row) const
+{
+    return 0 == _components[row];
+}
+
+
+std::size_t CompiledCalendar::find(const std::string& uid) const
+{
+    return _index.find(uid);
+}
+
+
+icalcomponent* CompiledCalendar::getComponent(std::size_t row) const
+{
+    return _components[row];
+}
+
+
+const char* CompiledCalendar::getUID(std::size_t row) const
+{
+    return &_strings[_uids[row]];
+}
+
+
+std::size_t CompiledCalendar::getUIDLength(std::size_t row) const
+{
+    return _uidLengths[row];
+}
+
+
+const char* CompiledCalendar::getSummary(std::size_t row) const
+{
+    return &_strings[_summaries[row]];
+}
+
+
+const char* CompiledCalendar::getLocation(std::size_t row) const
+{
+    return &_strings[_locations[row]];
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getStart(std::size_t row) const
+{
+    return _starts[row];
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getEnd(std::size_t row) const
+{
+    return _ends[row];
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getLastModified(std::size_t row) const
+{
+    return _lastModifieds[row];
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getRecurrenceID(std::size_t row) const
+{
+    return _recurrenceIDs[row];
+}
+
+
+int CompiledCalendar::getSequence(std::size_t row) const
+{
+    return _sequences[row];
+}
+
+
+bool CompiledCalendar::hasRecurrence(std::size_t row) const
+{
+    return _recurrences[row] != 0;
+}
+
+
+const ICalendarTimezoneTable* CompiledCalendar::getTimezoneTable(std::size_t row) const
+{
+    return _timezones[row].get();
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getLastModified() const
+{
+    return _lastModified;
+}
+
+
+std::size_t CompiledCalendar::append(icalcomponent* pComponent,
+                                     StringOffsets* pOffsets)
+{
+    std::size_t row = _components.size();
+
+    // UIDs are unique, so they are appended rather than interned.
+    const char* pUID = getUID(pComponent);
+    std::size_t uidLength = pUID ? std::strlen(pUID) : 0;
+    std::size_t uidOffset = 0;
+
+    if (uidLength > 0)
+    {
+        uidOffset = _strings.size();
+        _strings.insert(_strings.end(), pUID, pUID + uidLength + 1);
+    }
+
+    _components.push_back(pComponent);
+    _uids.push_back(uidOffset);
+    _uidLengths.push_back(uidLength);
+    _summaries.push_back(0);
+    _locations.push_back(0);
+    _starts.push_back(0);
+    _ends.push_back(0);
+    _lastModifieds.push_back(0);
+    _recurrenceIDs.push_back(0);
+    _sequences.push_back(-1);
+    _recurrences.push_back(0);
+    _timezones.push_back(ICalendarTimezoneTable::SharedPtr());
+    _nextRows.push_back(ICalendarEventIndex::NO_ROW);
+
+    fill(row, pOffsets);
+
+    if (uidLength > 0 && !_index.insert(pUID, uidLength, row))
+    {
+        // Another VEVENT shares this UID, so link this row to the end of
+        // its list.
+        std::size_t last = _index.find(pUID, uidLength);
+
+        while (_nextRows[last] != ICalendarEventIndex::NO_ROW)
+        {
+            last = _nextRows[last];
+        }
+
+        _nextRows[last] = row;
+    }
+
+    return row;
+}
+
+
+void CompiledCalendar::fill(std::size_t row, StringOffsets* pOffsets)
+{
+    icalcomponent* pComponent = _components[row];
+
+    const char* pSummary = 0;
+    const char* pLocation = 0;
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_SUMMARY_PROPERTY);
+
+    if (pProperty)
+    {
+        pSummary = icalproperty_get_summary(pProperty);
+    }
+
+    pProperty = icalcomponent_get_first_property(pComponent,
+                                                 ICAL_LOCATION_PROPERTY);
+
+    if (pProperty)
+    {
+        pLocation = icalproperty_get_location(pProperty);
+    }
+
+    bool recurrence = icalcomponent_get_first_property(pComponent, ICAL_RRULE_PROPERTY) ||
+                      icalcomponent_get_first_property(pComponent, ICAL_RDATE_PROPERTY);
+
+    Poco::Timestamp::TimeVal lastModified = getLastModified(pComponent);
+
+    if (lastModified > _lastModified)
+    {
+        _lastModified = lastModified;
+    }
+
+    struct icaltimetype dtstart = icalcomponent_get_dtstart(pComponent);
+
+    struct icaltimetype dtend = icalcomponent_get_dtend(pComponent);
+    struct icaltimetype recurrenceID = icalcomponent_get_recurrenceid(pComponent);
+
+    _summaries[row] = intern(pSummary, pOffsets);
+    _locations[row] = intern(pLocation, pOffsets);
+
+    {
+        // Converting to UTC may expand a builtin timezone.
+        Poco::Mutex::ScopedLock lock(ICalendarUtils::getTimezoneMutex());
+        _starts[row] = toTimeVal(dtstart);
+        _ends[row] = toTimeVal(dtend);
+        _recurrenceIDs[row] = toTimeVal(recurrenceID);
+    }
+
+    _lastModifieds[row] = lastModified;
+    _sequences[row] = getSequence(pComponent);
+    _recurrences[row] = recurrence ? 1 : 0;
+    _timezones[row] = findTimezoneTable(pComponent, dtstart);
+}
+
+
+void CompiledCalendar::remove(std::size_t row)
+{
+    const char* pUID = getUID(row);
+    std::size_t uidLength = _uidLengths[row];
+
+    if (uidLength > 0)
+    {
+        std::size_t first = _index.find(pUID, uidLength);
+
+        if (first == row)
+        {
+            _index.erase(pUID, uidLength);
+
+            if (_nextRows[row] != ICalendarEventIndex::NO_ROW)
+            {
+                _index.insert(pUID, uidLength, _nextRows[row]);
+            }
+        }
+        else
+        {
+            std::size_t previous = first;
+
+            while (previous != ICalendarEventIndex::NO_ROW &&
+                   _nextRows[previous] != row)
+            {
+                previous = _nextRows[previous];
+            }
+
+            if (previous != ICalendarEventIndex::NO_ROW)
+            {
+                _nextRows[previous] = _nextRows[row];
+            }
+        }
+    }
+
+    _components[row] = 0;
+    _uids[row] = 0;
+    _uidLengths[row] = 0;
+    _summaries[row] = 0;
+    _locations[row] = 0;
+    _starts[row] = 0;
+    _ends[row] = 0;
+    _lastModifieds[row] = 0;
+    _recurrenceIDs[row] = 0;
+    _sequences[row] = -1;
+    _recurrences[row] = 0;
+    _timezones[row].reset();
+    _nextRows[row] = ICalendarEventIndex::NO_ROW;
+
+    ++_numRemoved;
+    ++_numStale;
+}
+
+
+std::size_t CompiledCalendar::find(const char* pUID,
+                                   std::size_t length,
+                                   Poco::Timestamp::TimeVal recurrenceID) const
+{
+    std::size_t row = _index.find(pUID, length);
+
+    while (row != ICalendarEventIndex::NO_ROW &&
+           _recurrenceIDs[row] != recurrenceID)
+    {
+        row = _nextRows[row];
+    }
+
+    return row;
+}
+
+
+std::size_t CompiledCalendar::intern(const char* pString,
+                                     StringOffsets* pOffsets)
+{
+    if (!pString || '\0' == *pString)
+    {
+        return 0;
+    }
+
+    if (!pOffsets)
+    {
+        std::size_t offset = _strings.size();
+        _strings.insert(_strings.end(), pString, pString + std::strlen(pString) + 1);
+        return offset;
+    }
+
+    std::pair<StringOffsets::iterator, bool> result = pOffsets->insert(std::make_pair(std::string(pString),
+                                                                                      _strings.size()));
+
+    if (result.second)
+    {
+        _strings.insert(_strings.end(), pString, pString + result.first->first.size() + 1);
+    }
+
+    return result.first->second;
+}
+
+
+ICalendarTimezoneTable::SharedPtr CompiledCalendar::findTimezoneTable(icalcomponent* pComponent,
+                                                                      const struct icaltimetype& dtstart)
+{
+    if (icaltime_is_null_time(dtstart) ||
+        dtstart.is_date ||
+        !dtstart.zone ||
+        dtstart.zone == icaltimezone_get_utc_timezone())
+    {
+        return ICalendarTimezoneTable::SharedPtr();
+    }
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_DTSTART_PROPERTY);
+
+    icalparameter* pParameter = pProperty ? icalproperty_get_first_parameter(pProperty,
+                                                                             ICAL_TZID_PARAMETER) : 0;
+
+    const char* pTZID = pParameter ? icalparameter_get_tzid(pParameter) : 0;
+
+    if (!pTZID)
+    {
+        return ICalendarTimezoneTable::SharedPtr();
+    }
+
+    TimezoneTables::iterator iter = _timezoneTables.find(pTZID);
+
+    if (iter == _timezoneTables.end())
+    {
+        ICalendarTimezoneTable::SharedPtr table = ICalendarTimezoneTable::get(const_cast<icaltimezone*>(dtstart.zone));
+        iter = _timezoneTables.insert(std::make_pair(std::string(pTZID), table)).first;
+    }
+
+    return iter->second;
+}
+
+
+const char* CompiledCalendar::getUID(icalcomponent* pComponent)
+{
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_UID_PROPERTY);
+
+    return pProperty ? icalproperty_get_uid(pProperty) : 0;
+}
+
+
+int CompiledCalendar::getSequence(icalcomponent* pComponent)
+{
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_SEQUENCE_PROPERTY);
+
+    return pProperty ? icalproperty_get_sequence(pProperty) : -1;
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::getLastModified(icalcomponent* pComponent)
+{
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_LASTMODIFIED_PROPERTY);
+
+    return pProperty ? toTimeVal(icalproperty_get_lastmodified(pProperty)) : 0;
+}
+
+
+Poco::Timestamp::TimeVal CompiledCalendar::toTimeVal(struct icaltimetype time)
+{
+    if (!icaltime_is_null_time(time) && icaltime_is_valid_time(time))
+    {
+        return Poco::Timestamp::fromEpochTime(icaltime_as_timet(time)).epochMicroseconds();
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+
+} } // namespace ofx::Time
@@ -24,6 +24,13 @@
 
 
 #include "ofx/Time/ICalendar.h"
+#include <algorithm>
+#include <set>
+#include "ofx/Time/ICalendarParser.h"
+#include "ofx/Time/ICalendarUtils.h"
+#include "ofx/Time/ICalendarZoneInfo.h"
+#include "ofx/Time/MappedFile.h"
+#include "Poco/String.h"
 
 
 namespace ofx {
@@ -31,64 +38,170 @@ namespace Time {
 
 
 const Poco::Timespan ICalendar::DEFAULT_UPDATE_INTERVAL = 0;
+const Poco::Timespan ICalendar::DEFAULT_INSTANCE_CACHE_HORIZON = 7 * Poco::Timespan::DAYS;
+
+
+class ICalendar::ExpansionJob: public ICalendarExpansionPool::Job
+{
+public:
+    ExpansionJob(const CompiledCalendar& compiled,
+                 ICalendarRecurrenceCache& recurrenceCache,
+                 int64_t start,
+                 int64_t end):
+        _compiled(compiled),
+        _recurrenceCache(recurrenceCache),
+        _start(start),
+        _end(end),
+        _instances((compiled.size() + ICalendarExpansionPool::DEFAULT_CHUNK_SIZE - 1) / ICalendarExpansionPool::DEFAULT_CHUNK_SIZE),
+        _missingUIDs(_instances.size(), 0)
+    {
+    }
+
+    void process(std::size_t chunk)
+    {
+        std::size_t row = chunk * ICalendarExpansionPool::DEFAULT_CHUNK_SIZE;
+        std::size_t last = std::min(row + ICalendarExpansionPool::DEFAULT_CHUNK_SIZE, _compiled.size());
+
+        ICalendarRecurrenceCache::Spans spans;
+        ICalendarRecurrenceCache::Spans::const_iterator iter;
+
+        for (; row < last; ++row)
+        {
+            if (_compiled.isRemoved(row))
+            {
+                continue;
+            }
+            else if (_compiled.getUIDLength(row) > 0)
+            {
+                spans.clear();
+
+                _recurrenceCache.query(_compiled, row, _start, _end, spans);
+
+                iter = spans.begin();
+
+                while (iter != spans.end())
+                {
+                    ICalendarInstanceIndex::Instance instance;
+                    instance.start = iter->start;
+                    instance.end = iter->end;
+                    instance.row = row;
+                    _instances[chunk].push_back(instance);
+                    ++iter;
+                }
+            }
+            else
+            {
+                ++_missingUIDs[chunk];
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        return _instances.size();
+    }
+
+    const ICalendarInstanceIndex::Instances& getInstances(std::size_t chunk) const
+    {
+        return _instances[chunk];
+    }
+
+    std::size_t getMissingUIDs(std::size_t chunk) const
+    {
+        return _missingUIDs[chunk];
+    }
+
+private:
+    const CompiledCalendar& _compiled;
+    ICalendarRecurrenceCache& _recurrenceCache;
+    int64_t _start;
+    int64_t _end;
+    std::vector<ICalendarInstanceIndex::Instances> _instances;
+    std::vector<std::size_t> _missingUIDs;
+
+};
 
 
 ICalendar::ICalendar(const std::string& uri, unsigned long long autoRefreshInterval):
-    _pICalendar(0),
     _uri(""),
 //    _autoUpdateTimer(0, autoRefreshInterval),
-    _nextUpdate(0),
     _autoUpdateInterval(autoRefreshInterval),
-    _calendarBuffer("")
+    _scheduler(ICalendarRefreshScheduler::getDefault()),
+    _expansionPool(ICalendarExpansionPool::getDefault()),
+    _instanceCacheHorizon(DEFAULT_INSTANCE_CACHE_HORIZON.totalMilliseconds()),
+    _incrementalUpdates(false),
+    _reloads(0),
+    _unchangedReloads(0),
+    _notModifiedReloads(0),
+    _failedReloads(0),
+    _cacheGeneration(0),
+    _isWritingCache(false),
+    _cacheWriter(*this, &ICalendar::writeCache),
+    _cacheThread("ICalendar")
 {
     ofAddListener(ofEvents().update, this, &ICalendar::update);
 
     setURI(uri);
 
+    _scheduler->schedule(this, _autoUpdateInterval);
+
 //    _autoUpdateTimer.start(Poco::TimerCallback<ICalendar>(*this, &ICalendar::onAutoUpdate));
 }
 
 
 ICalendar::ICalendar(const ICalendar& other):
-    _pICalendar(0),
+    _snapshot(other.getSnapshot()),
     _uri(other._uri),
     _autoUpdateInterval(other._autoUpdateInterval),
+    _scheduler(other._scheduler),
+    _expansionPool(other._expansionPool),
+    _instanceCacheHorizon(other._instanceCacheHorizon.load()),
 //
 //    _autoUpdateTimer(other._autoUpdateTimer.getStartInterval(),
 //                     other._autoUpdateTimer.getPeriodicInterval()),
-    _calendarBuffer(other._calendarBuffer)
+    _incrementalUpdates(other._incrementalUpdates.load()),
+    _reloads(0),
+    _unchangedReloads(0),
+    _notModifiedReloads(0),
+    _failedReloads(0),
+    _cacheGeneration(0),
+    _isWritingCache(false),
+    _cacheWriter(*this, &ICalendar::writeCache),
+    _cacheThread("ICalendar")
 {
-    if(other._pICalendar)
-    {
-        _pICalendar = icalcomponent_new_clone(other._pICalendar);
-    }
-
+    // Snapshots are immutable, so the copy shares the other's snapshot
+    // rather than cloning its icalcomponent.  The copy is not scheduled,
+    // so copying a calendar does not add reloads of its URI.
     ofAddListener(ofEvents().update, this, &ICalendar::update);
 }
 
 
 ICalendar& ICalendar::operator = (ICalendar other)
 {
-    std::swap(_pICalendar, other._pICalendar);
+    ofScopedLock lock(_mutex);
+    std::atomic_store(&_snapshot, other.getSnapshot());
+    setValidators(ContentValidators());
     return *this;
 }
 
 
 ICalendar::~ICalendar()
 {
+    // Waits for a reload in progress on a scheduler thread.
+    _scheduler->unschedule(this);
     ofRemoveListener(ofEvents().update, this, &ICalendar::update);
 
-    if (_pICalendar)
+    // Lets the cache writer finish the newest queued snapshot.
+    if (_cacheThread.isRunning())
     {
-        icalcomponent_free(_pICalendar);
-        _pICalendar = 0;
+        _cacheThread.join();
     }
 }
 
 
 bool ICalendar::isLoaded() const
 {
-    return _pICalendar;
+    return getSnapshot() != 0;
 }
 
 
@@ -97,6 +210,10 @@ void ICalendar::setURI(const std::string& uri)
     try
     {
         _uri = Poco::URI(uri); // set the uri
+
+        // Content from a different URI must always be parsed.
+        ofScopedLock lock(_mutex);
+        setValidators(ContentValidators());
     }
     catch (const Poco::SyntaxException& exc)
     {
@@ -114,6 +231,7 @@ Poco::URI ICalendar::getURI() const
 void ICalendar::setAutoRefreshInterval(unsigned long long autoRefreshInterval)
 {
     _autoUpdateInterval = autoRefreshInterval;
+    _scheduler->schedule(this, _autoUpdateInterval);
 
 //    if (0 == _autoUpdateTimer.getPeriodicInterval())
 //    {
@@ -132,21 +250,93 @@ unsigned long long ICalendar::getAutoRefreshInterval() const
 }
 
 
+void ICalendar::setInstanceCacheHorizon(unsigned long long horizon)
+{
+    _instanceCacheHorizon = horizon;
+
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
+    {
+        snapshot->setInstanceIndex(ICalendarSnapshot::InstanceIndexPtr());
+    }
+}
+
+
+unsigned long long ICalendar::getInstanceCacheHorizon() const
+{
+    return _instanceCacheHorizon;
+}
+
+
+void ICalendar::setIncrementalUpdates(bool incrementalUpdates)
+{
+    _incrementalUpdates = incrementalUpdates;
+}
+
+
+bool ICalendar::getIncrementalUpdates() const
+{
+    return _incrementalUpdates;
+}
+
+
+void ICalendar::setCachePath(const std::string& path)
+{
+    {
+        ofScopedLock lock(_mutex);
+        _cachePath = path;
+    }
+
+    if (path.empty() || isLoaded())
+    {
+        return;
+    }
+
+    ContentValidators validators;
+
+    ICalendarSnapshot::SharedPtr snapshot = ICalendarSnapshotCache::load(path, validators);
+
+    if (snapshot)
+    {
+        ofScopedLock lock(_mutex);
+
+        // A parse or reload that finished while the cache was loading has
+        // newer content.
+        if (!getSnapshot() && !std::atomic_load(&_pendingSnapshot))
+        {
+            std::atomic_store(&_snapshot, snapshot);
+            setValidators(validators);
+        }
+    }
+}
+
+
+std::string ICalendar::getCachePath() const
+{
+    ofScopedLock lock(_mutex);
+    return _cachePath;
+}
+
+
 bool ICalendar::parse(const ofBuffer& buffer)
 {
     if (buffer.size() > 0)
     {
-        icalcomponent* _pNewICalendar = icalcomponent_new_from_string(buffer.getData());
+        icalcomponent* _pNewICalendar = parseBuffer(buffer);
 
         if (_pNewICalendar)
         {
-            std::swap(_pICalendar, _pNewICalendar);
+            ICalendarSnapshot::SharedPtr snapshot = makeSnapshot(_pNewICalendar);
+            ContentValidators validators = makeValidators(buffer);
 
-            if (_pNewICalendar)
             {
-                icalcomponent_free(_pNewICalendar); // free the old
+                ofScopedLock lock(_mutex);
+                std::atomic_store(&_snapshot, snapshot);
+                setValidators(validators);
             }
 
+            saveCache(snapshot, validators);
             return true;
         }
         else
@@ -163,14 +353,116 @@ bool ICalendar::parse(const ofBuffer& buffer)
 }
 
 
+bool ICalendar::parse(std::istream& stream)
+{
+    icalcomponent* _pNewICalendar = ICalendarParser::parse(stream);
+
+    if (_pNewICalendar)
+    {
+        ICalendarSnapshot::SharedPtr snapshot = makeSnapshot(_pNewICalendar);
+
+        {
+            ofScopedLock lock(_mutex);
+            std::atomic_store(&_snapshot, snapshot);
+            setValidators(ContentValidators());
+        }
+
+        saveCache(snapshot, ContentValidators());
+        return true;
+    }
+    else
+    {
+        ofLogError("ICalendar::parse()") << "Stream could not be loaded.";
+        return false;
+    }
+}
+
+
+bool ICalendar::merge(const ofBuffer& buffer)
+{
+    if (!isLoaded())
+    {
+        return parse(buffer);
+    }
+
+    if (buffer.size() > 0)
+    {
+        icalcomponent* pUpdate = parseBuffer(buffer);
+
+        if (pUpdate)
+        {
+            ICalendarSnapshot::SharedPtr base;
+            ICalendarSnapshot::SharedPtr snapshot;
+            ContentValidators validators = makeValidators(buffer);
+
+            {
+                ofScopedLock lock(_mutex);
+                base = getSnapshot();
+                snapshot = mergeSnapshot(base, pUpdate);
+                std::atomic_store(&_snapshot, snapshot);
+                setValidators(validators);
+            }
+
+            if (snapshot != base)
+            {
+                saveCache(snapshot, validators);
+            }
+
+            return true;
+        }
+        else
+        {
+            ofLogError("ICalendar::merge()") << "Buffer could not be loaded.";
+            return false;
+        }
+    }
+    else
+    {
+        ofLogError("ICalendar::merge()") << "Buffer was empty.";
+        return false;
+    }
+}
+
+
+ICalendarChangeSet ICalendar::getLastChangeSet() const
+{
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
+    {
+        return snapshot->getChangeSet();
+    }
+    else
+    {
+        return ICalendarChangeSet();
+    }
+}
+
+
+ICalendar::ReloadStatistics ICalendar::getReloadStatistics() const
+{
+    ReloadStatistics statistics;
+    statistics.reloads = _reloads;
+    statistics.unchanged = _unchangedReloads;
+    statistics.notModified = _notModifiedReloads;
+    statistics.failures = _failedReloads;
+    return statistics;
+}
+
+
 std::string ICalendar::getProductID() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        icalcomponent* pCalendar = snapshot->getComponent();
+
         icalproperty* pProperty = 0;
         const char* pProductId = 0;
 
-        pProperty = icalcomponent_get_first_property(_pICalendar,
+        pProperty = icalcomponent_get_first_property(pCalendar,
                                                      ICAL_PRODID_PROPERTY);
         if (pProperty)
         {
@@ -201,12 +493,17 @@ std::string ICalendar::getProductID() const
 
 std::string ICalendar::getVersion() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        icalcomponent* pCalendar = snapshot->getComponent();
+
         icalproperty* pProperty = 0;
         const char* pVersion = 0;
 
-        pProperty = icalcomponent_get_first_property(_pICalendar,
+        pProperty = icalcomponent_get_first_property(pCalendar,
                                                      ICAL_VERSION_PROPERTY);
         if (pProperty)
         {
@@ -238,11 +535,16 @@ std::string ICalendar::getVersion() const
 
 std::string ICalendar::getName() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        icalcomponent* pCalendar = snapshot->getComponent();
+
         std::string name = "";
 
-        if (ICalendarUtils::getExtensionValue(_pICalendar,
+        if (ICalendarUtils::getExtensionValue(pCalendar,
                                               "X-WR-CALNAME",
                                               name))
         {
@@ -264,11 +566,16 @@ std::string ICalendar::getName() const
 
 std::string ICalendar::getDescription() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        icalcomponent* pCalendar = snapshot->getComponent();
+
         std::string name = "";
 
-        if (ICalendarUtils::getExtensionValue(_pICalendar,
+        if (ICalendarUtils::getExtensionValue(pCalendar,
                                               "X-WR-CALDESC",
                                               name))
         {
@@ -290,12 +597,17 @@ std::string ICalendar::getDescription() const
 
 std::string ICalendar::getScale() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+        icalcomponent* pCalendar = snapshot->getComponent();
+
         icalproperty* pProperty = 0;
         const char* pScale = 0;
 
-        pProperty = icalcomponent_get_first_property(_pICalendar,
+        pProperty = icalcomponent_get_first_property(pCalendar,
                                                      ICAL_CALSCALE_PROPERTY);
         if (pProperty)
         {
@@ -326,10 +638,13 @@ std::string ICalendar::getScale() const
 
 std::size_t ICalendar::getNumEvents() const
 {
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
-        return icalcomponent_count_components(_pICalendar,
-                                              ICAL_VEVENT_COMPONENT);
+        const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
+
+        return compiled.size() - compiled.getNumRemoved();
     }
     else
     {
@@ -341,38 +656,13 @@ std::size_t ICalendar::getNumEvents() const
 
 Poco::Timestamp ICalendar::getLastModified() const
 {
-    if (_pICalendar)
-    {
-        Poco::Timestamp lastModification(0);
-
-        icalcomponent* pEventComponent = icalcomponent_get_first_component(_pICalendar,
-                                                                           ICAL_ANY_COMPONENT);
-
-        while (pEventComponent)
-        {
-
-            icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent,
-                                                                       ICAL_LASTMODIFIED_PROPERTY);
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
 
-            if (pProperty)
-            {
-                Poco::Timestamp timestamp;
-
-                if (ICalendarUtils::timeToTimestamp(icalproperty_get_lastmodified(pProperty),
-                                                    timestamp))
-                {
-                    if (timestamp > lastModification)
-                    {
-                        lastModification = timestamp;
-                    }
-                }
-            }
-
-            pEventComponent = icalcomponent_get_next_component(_pICalendar,
-                                                               ICAL_ANY_COMPONENT);
-        }
+    if (snapshot)
+    {
+        const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
 
-        return lastModification;
+        return Poco::Timestamp(compiled.getLastModified());
     }
     else
     {
@@ -382,40 +672,48 @@ Poco::Timestamp ICalendar::getLastModified() const
 }
 
 
+uint64_t ICalendar::getGeneration() const
+{
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    return snapshot ? snapshot->getGeneration() : 0;
+}
+
+
+ICalendarSnapshot::SharedPtr ICalendar::getSnapshot() const
+{
+    return std::atomic_load(&_snapshot);
+}
+
 
 ICalendar::Events ICalendar::getEvents() const
 {
     ICalendar::Events events;
 
-    if (_pICalendar)
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
     {
-        icalcomponent* pEventComponent = icalcomponent_get_first_component(_pICalendar,
-                                                                           ICAL_VEVENT_COMPONENT);
+        const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
 
-        while (pEventComponent)
-        {
-            icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent, ICAL_UID_PROPERTY);
+        events.reserve(compiled.size() - compiled.getNumRemoved());
 
-            if (pProperty)
+        for (std::size_t row = 0; row < compiled.size(); ++row)
+        {
+            if (compiled.isRemoved(row))
             {
-                const char* pUID = icalproperty_get_uid(pProperty);
-
-                if (pUID)
-                {
-                    events.push_back(ICalendarEvent((ICalendarInterface*)this, std::string(pUID)));
-                }
-                else
-                {
-                    ofLogWarning("ICalendar::getEvents()") << "UID string was malformed, skipping.";
-                }
+                continue;
+            }
+            else if (compiled.getUIDLength(row) > 0)
+            {
+                events.push_back(ICalendarEvent((ICalendarInterface*)this,
+                                                std::string(compiled.getUID(row),
+                                                            compiled.getUIDLength(row))));
             }
             else
             {
                 ofLogError("ICalendar::getEvents()") << "UID string was missing, skipping.";
             }
-
-            pEventComponent = icalcomponent_get_next_component(_pICalendar,
-                                                               ICAL_VEVENT_COMPONENT);
         }
 
         return events;
@@ -460,71 +758,100 @@ ICalendar::EventInstances ICalendar::getEventInstances(const Interval& interval)
 {
     ICalendar::EventInstances instances;
 
-    if (_pICalendar)
-    {
-        std::vector<Interval> intervals;
-        std::vector<Interval>::iterator iter;
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
 
-        icalcomponent* pEventComponent = 0;
-        icalproperty* pProperty = 0;
+    if (snapshot)
+    {
+        const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
 
-        struct icaltimetype start = icaltime_from_timet(interval.getStart().epochTime(), false);
-        struct icaltimetype end = icaltime_from_timet(interval.getEnd().epochTime(), false);
+        unsigned long long instanceCacheHorizon = _instanceCacheHorizon;
 
-        pEventComponent = icalcomponent_get_first_component(_pICalendar,
-                                                            ICAL_VEVENT_COMPONENT);
+        ICalendarSnapshot::InstanceIndexPtr instanceIndex = snapshot->getInstanceIndex();
 
-        while (pEventComponent)
+        if (instanceCacheHorizon > 0 && !(instanceIndex && instanceIndex->covers(interval)))
         {
-            pProperty = icalcomponent_get_first_property(pEventComponent,
-                                                         ICAL_UID_PROPERTY);
+            Interval window = getInstanceCacheWindow(instanceCacheHorizon);
 
-            if (pProperty)
+            // Only rebuild if the new horizon can answer this query.
+            if (interval.getStart() >= window.getStart() &&
+                interval.getEnd() <= window.getEnd())
             {
-                const char* pUID = icalproperty_get_uid(pProperty);
+                instanceIndex = buildInstanceIndex(*snapshot, window);
+            }
+        }
 
-                if (pUID)
-                {
-                    std::string uid(pUID);
-
-                    intervals.clear();
-
-                    icalcomponent_foreach_recurrence(pEventComponent,
-                                                     start,
-                                                     end,
-                                                     &ICalendarEvent::recurrencesCallback,
-                                                     &intervals);
-                    iter = intervals.begin();
-
-                    while (iter != intervals.end())
-                    {
-                        instances.push_back(ICalendarEventInstance(ICalendarEvent(
-                                                                                  (ICalendarInterface*)this,
-                                                                                  uid),
-                                                                   *iter));
-                        ++iter;
-                    }
+        if (instanceCacheHorizon > 0 && instanceIndex && instanceIndex->covers(interval))
+        {
+            ICalendarInstanceIndex::Instances results;
 
-                }
-                else
-                {
-                    ofLogWarning("ICalendar::getEvents()") << "UID string was malformed, skipping.";
-                }
+            instanceIndex->query(interval, results);
+
+            instances.reserve(results.size());
+
+            ICalendarInstanceIndex::Instances::const_iterator iter = results.begin();
+
+            while (iter != results.end())
+            {
+                std::string uid(compiled.getUID(iter->row),
+                                compiled.getUIDLength(iter->row));
+
+                instances.push_back(ICalendarEventInstance(ICalendarEvent((ICalendarInterface*)this,
+                                                                          uid),
+                                                           Interval(Poco::Timestamp::fromEpochTime(iter->start),
+                                                                    Poco::Timestamp::fromEpochTime(iter->end))));
+                ++iter;
             }
-            else
+
+            return instances;
+        }
+
+        int64_t start = interval.getStart().epochTime();
+        int64_t end = interval.getEnd().epochTime();
+
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
+        snapshot->prepareExpansion(end);
+
+        ExpansionJob job(compiled, snapshot->getRecurrenceCache(), start, end);
+
+        _expansionPool->execute(job, job.size());
+
+        // Chunks are read back in row order, like a serial expansion.
+        std::string uid;
+        std::size_t row = compiled.size();
+
+        for (std::size_t chunk = 0; chunk < job.size(); ++chunk)
+        {
+            for (std::size_t i = 0; i < job.getMissingUIDs(chunk); ++i)
             {
                 ofLogError("ICalendar::getEventInstances()") << "UID string was missing, skipping.";
             }
 
-            pEventComponent = icalcomponent_get_next_component(_pICalendar,
-                                                               ICAL_VEVENT_COMPONENT);
+            const ICalendarInstanceIndex::Instances& results = job.getInstances(chunk);
+
+            ICalendarInstanceIndex::Instances::const_iterator iter = results.begin();
+
+            while (iter != results.end())
+            {
+                if (iter->row != row)
+                {
+                    row = iter->row;
+                    uid.assign(compiled.getUID(row), compiled.getUIDLength(row));
+                }
+
+                instances.push_back(ICalendarEventInstance(ICalendarEvent((ICalendarInterface*)this,
+                                                                          uid),
+                                                           Interval(Poco::Timestamp::fromEpochTime(iter->start),
+                                                                    Poco::Timestamp::fromEpochTime(iter->end))));
+                ++iter;
+            }
         }
 
         return instances;
     }
     else
     {
-        ofLogError("ICalendar::getEvents()") << "Calendar is not loaded.";
+        ofLogError("ICalendar::getEventInstances()") << "Calendar is not loaded.";
         return instances;
     }
 }
@@ -538,28 +865,465 @@ ICalendar::EventInstances ICalendar::getEventInstances(const Poco::Timestamp& ti
 
 icalcomponent* ICalendar::getComponent()
 {
-    return _pICalendar;
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    return snapshot ? snapshot->getComponent() : 0;
 }
 
 
 icalcomponent* ICalendar::getComponent() const
 {
-    return _pICalendar;
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    return snapshot ? snapshot->getComponent() : 0;
 }
 
 
-void ICalendar::update(ofEventArgs& args)
+icalcomponent* ICalendar::getEventComponentForUID(const std::string& uid) const
+{
+    ICalendarSnapshot::SharedPtr snapshot = getSnapshot();
+
+    if (snapshot)
+    {
+        const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
+
+        std::size_t row = compiled.find(uid);
+
+        if (row != ICalendarEventIndex::NO_ROW)
+        {
+            return compiled.getComponent(row);
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        ofLogError("ICalendar::getEventComponentForUID()") << "Calendar is not loaded.";
+        return 0;
+    }
+}
+
+
+void ICalendar::reload()
+{
+    if (!_uri.empty())
+    {
+        ++_reloads;
+
+        ContentValidators validators;
+        LoadStatus status = LOAD_FAILED;
+
+        icalcomponent* pCalendar = loadComponent(_uri, validators, status);
+
+        if (LOAD_UNCHANGED == status)
+        {
+            ++_unchangedReloads;
+
+            // The server may send the same content with a new ETag or
+            // Last-Modified, which the next conditional request must use.
+            ofScopedLock lock(_mutex);
+
+            if (_validators.hasHash && _validators.hash == validators.hash)
+            {
+                // A pending snapshot of other content is stale now.
+                std::atomic_store(&_pendingSnapshot, ICalendarSnapshot::SharedPtr());
+                setValidators(validators);
+            }
+
+            return;
+        }
+        else if (LOAD_NOT_MODIFIED == status)
+        {
+            ++_notModifiedReloads;
+            return;
+        }
+        else if (!pCalendar)
+        {
+            ++_failedReloads;
+            return;
+        }
+
+        ICalendarSnapshot::SharedPtr base = getSnapshot();
+        ICalendarSnapshot::SharedPtr snapshot;
+
+        if (_incrementalUpdates && base)
+        {
+            // Merging against the current snapshot is correct even if an
+            // older pending snapshot is dropped, because each feed is
+            // complete.
+            snapshot = mergeSnapshot(base, pCalendar);
+        }
+        else
+        {
+            snapshot = makeSnapshot(pCalendar);
+        }
+
+        {
+            ofScopedLock lock(_mutex);
+
+            if (snapshot != base)
+            {
+                // The validators become current with the snapshot, so a
+                // conditional request never skips content readers have not
+                // seen yet.
+                std::atomic_store(&_pendingSnapshot, snapshot);
+                _pendingValidators = validators;
+            }
+            else
+            {
+                // A merge that changed nothing still matches this content,
+                // and a pending snapshot of other content is stale now.
+                std::atomic_store(&_pendingSnapshot, ICalendarSnapshot::SharedPtr());
+                setValidators(validators);
+            }
+        }
+
+        if (snapshot != base)
+        {
+            saveCache(snapshot, validators);
+        }
+    }
+}
+
+
+void ICalendar::startThread(bool mutexBlocks, bool verbose)
+{
+    _scheduler->schedule(this, _autoUpdateInterval, true);
+}
+
+
+void ICalendar::stopThread()
+{
+    _scheduler->unschedule(this);
+}
+
+
+void ICalendar::waitForThread(bool callStopThread)
+{
+    // Unscheduling waits for a reload in progress.
+    _scheduler->unschedule(this);
+}
+
+
+bool ICalendar::isThreadRunning() const
+{
+    return _scheduler->isScheduled(const_cast<ICalendar*>(this));
+}
+
+
+void ICalendar::setValidators(const ContentValidators& validators)
+{
+    _validators = validators;
+}
+
+
+ICalendar::ContentValidators ICalendar::getValidators() const
 {
     ofScopedLock lock(_mutex);
+    return _validators;
+}
+
+
+bool ICalendar::isContentUnchanged(uint64_t contentHash) const
+{
+    ofScopedLock lock(_mutex);
+    return _validators.hasHash && _validators.hash == contentHash;
+}
+
+
+ICalendarSnapshot::InstanceIndexPtr ICalendar::buildInstanceIndex(const ICalendarSnapshot& snapshot,
+                                                                  const Interval& window) const
+{
+    std::shared_ptr<ICalendarInstanceIndex> index = std::make_shared<ICalendarInstanceIndex>();
+
+    {
+        Poco::Mutex::ScopedLock lock(snapshot.getMutex());
+        snapshot.prepareExpansion(window.getEnd().epochTime());
+        index->build(snapshot.getCompiledCalendar(), window, _expansionPool.get());
+    }
+
+    snapshot.setInstanceIndex(index);
+
+    return index;
+}
+
+
+void ICalendar::saveCache(const ICalendarSnapshot::SharedPtr& snapshot,
+                          const ContentValidators& validators)
+{
+    if (getCachePath().empty())
+    {
+        return;
+    }
+
+    ofScopedLock lock(_cacheMutex);
+
+    // A reload on a scheduler thread may finish after a newer parse.
+    if (snapshot->getGeneration() <= _cacheGeneration)
+    {
+        return;
+    }
+
+    _cacheGeneration = snapshot->getGeneration();
+    _pendingCacheSnapshot = snapshot;
+    _pendingCacheValidators = validators;
 
-    if (_calendarBuffer.size() > 0)
+    if (!_isWritingCache)
     {
-        parse(_calendarBuffer);
-        _calendarBuffer.clear();
+        // The previous writer has cleared the flag and is exiting.
+        if (_cacheThread.isRunning())
+        {
+            _cacheThread.join();
+        }
+
+        _isWritingCache = true;
+        _cacheThread.start(_cacheWriter);
     }
 }
 
 
+void ICalendar::writeCache()
+{
+    for (;;)
+    {
+        ICalendarSnapshot::SharedPtr snapshot;
+        ContentValidators validators;
+
+        {
+            ofScopedLock lock(_cacheMutex);
+
+            if (!_pendingCacheSnapshot)
+            {
+                _isWritingCache = false;
+                return;
+            }
+
+            snapshot.swap(_pendingCacheSnapshot);
+            validators = _pendingCacheValidators;
+        }
+
+        std::string path = getCachePath();
+
+        if (path.empty())
+        {
+            continue;
+        }
+
+        unsigned long long instanceCacheHorizon = _instanceCacheHorizon;
+
+        if (instanceCacheHorizon > 0 && !snapshot->getInstanceIndex())
+        {
+            buildInstanceIndex(*snapshot, getInstanceCacheWindow(instanceCacheHorizon));
+        }
+
+        // Snapshots are written in the order they were queued, so the file
+        // is never replaced by an older snapshot.
+        ICalendarSnapshotCache::save(path, *snapshot, validators);
+    }
+}
+
+
+Interval ICalendar::getInstanceCacheWindow(unsigned long long horizon)
+{
+    Poco::Timestamp now;
+    Poco::Timespan span(horizon * Poco::Timespan::MILLISECONDS);
+    return Interval(now - span.totalMicroseconds(),
+                    now + span.totalMicroseconds());
+}
+
+
+ICalendar::ContentValidators ICalendar::makeValidators(const ofBuffer& buffer)
+{
+    ContentValidators validators;
+    validators.hash = ICalendarUtils::hashContent(buffer.getData(), buffer.size());
+    validators.hasHash = true;
+    return validators;
+}
+
+
+std::string ICalendar::getHeader(const ofHttpResponse& response,
+                                 const std::string& name)
+{
+#if OF_VERSION_MAJOR > 0 || OF_VERSION_MINOR >= 10
+    std::map<std::string, std::string>::const_iterator iter = response.headers.begin();
+
+    while (iter != response.headers.end())
+    {
+        if (0 == Poco::icompare(iter->first, name))
+        {
+            return iter->second;
+        }
+
+        ++iter;
+    }
+#endif
+
+    return "";
+}
+
+
+icalcomponent* ICalendar::parseBuffer(const ofBuffer& buffer)
+{
+    // The parser reads the buffer in place, so it need not be
+    // NUL-terminated and libical does not copy it.
+    ICalendarParser parser;
+    parser.parse(buffer.getData(), buffer.size());
+    return parser.finish();
+}
+
+
+icalcomponent* ICalendar::resolveTimezones(icalcomponent* pCalendar,
+                                           const ICalendarSnapshot* pBase)
+{
+    std::set<std::string> tzids;
+
+    ICalendarUtils::findMissingTimezones(pCalendar, tzids);
+
+    if (tzids.empty())
+    {
+        return 0;
+    }
+
+    icalcomponent* pTimezones = icalcomponent_new(ICAL_VCALENDAR_COMPONENT);
+
+    if (pBase)
+    {
+        // Unchanged rows keep resolving TZIDs the feed stopped defining.
+        Poco::Mutex::ScopedLock lock(pBase->getMutex());
+        ICalendarUtils::copyTimezones(pBase->getComponent(), tzids, pTimezones);
+        ICalendarUtils::copyTimezones(pBase->getTimezones(), tzids, pTimezones);
+    }
+
+    ICalendarZoneInfo::getDefault()->addTimezones(tzids, pTimezones);
+
+    if (!icalcomponent_get_first_component(pTimezones, ICAL_VTIMEZONE_COMPONENT))
+    {
+        icalcomponent_free(pTimezones);
+        return 0;
+    }
+
+    icalcomponent_add_component(pTimezones, pCalendar);
+
+    return pTimezones;
+}
+
+
+ICalendarSnapshot::SharedPtr ICalendar::makeSnapshot(icalcomponent* pCalendar)
+{
+    // Resolve undefined TZIDs before libical looks them up on its own.
+    icalcomponent* pTimezones = resolveTimezones(pCalendar, 0);
+
+    CompiledCalendar compiled;
+    compiled.compile(pCalendar);
+
+    ICalendarChangeSet changes;
+    changes.replaced = true;
+
+    return ICalendarSnapshot::SharedPtr(new ICalendarSnapshot(pCalendar,
+                                                              pTimezones,
+                                                              compiled,
+                                                              changes));
+}
+
+
+ICalendarSnapshot::SharedPtr ICalendar::mergeSnapshot(const ICalendarSnapshot::SharedPtr& base,
+                                                      icalcomponent* pUpdate)
+{
+    icalcomponent* pTimezones = resolveTimezones(pUpdate, base.get());
+
+    // Only the table's arrays are copied.  The base's libical tree is left
+    // to the base snapshot and the update's tree is adopted instead.
+    CompiledCalendar compiled(base->getCompiledCalendar());
+
+    ICalendarChangeSet changes;
+
+    compiled.merge(pUpdate, changes);
+
+    if (changes.empty())
+    {
+        icalcomponent_free(pTimezones ? pTimezones : pUpdate);
+        return base;
+    }
+
+    ICalendarSnapshot::InstanceIndexPtr baseIndex = base->getInstanceIndex();
+    std::shared_ptr<ICalendarInstanceIndex> instanceIndex;
+
+    if (compiled.isFragmented())
+    {
+        // Reclaim removed rows and superseded strings.  Rows are
+        // renumbered, so the instance cache is rebuilt lazily.
+        compiled.compile(pUpdate);
+        changes.rows.clear();
+    }
+    else if (baseIndex)
+    {
+        // The new tree is not shared yet, so it can be expanded unlocked,
+        // but builtin timezones are shared with other calendars.
+        int year = icaltime_from_timet_with_zone(static_cast<time_t>(baseIndex->getHorizon().getEnd().epochTime()),
+                                                 0,
+                                                 icaltimezone_get_utc_timezone()).year;
+
+        std::vector<std::size_t>::const_iterator iter = changes.rows.begin();
+
+        while (iter != changes.rows.end())
+        {
+            if (!compiled.isRemoved(*iter))
+            {
+                ICalendarUtils::prepareTimezones(compiled.getComponent(*iter), year);
+            }
+
+            ++iter;
+        }
+
+        instanceIndex = std::make_shared<ICalendarInstanceIndex>(*baseIndex);
+        instanceIndex->update(compiled, changes.rows);
+    }
+
+    ICalendarSnapshot::SharedPtr snapshot(new ICalendarSnapshot(pUpdate,
+                                                                pTimezones,
+                                                                compiled,
+                                                                changes));
+
+    snapshot->setInstanceIndex(instanceIndex);
+
+    return snapshot;
+}
+
+
+bool ICalendar::publishPendingSnapshot()
+{
+    // Checked without the lock, so frames without a reload do not contend
+    // with a reload in progress.
+    if (!std::atomic_load(&_pendingSnapshot))
+    {
+        return false;
+    }
+
+    ofScopedLock lock(_mutex);
+
+    ICalendarSnapshot::SharedPtr snapshot = std::atomic_exchange(&_pendingSnapshot,
+                                                                 ICalendarSnapshot::SharedPtr());
+
+    if (snapshot)
+    {
+        // The previous snapshot is freed when its last reader drops it.
+        std::atomic_store(&_snapshot, snapshot);
+        setValidators(_pendingValidators);
+        return true;
+    }
+
+    return false;
+}
+
+
+void ICalendar::update(ofEventArgs& args)
+{
+    publishPendingSnapshot();
+}
+
+
 //void ICalendar::onAutoUpdate(Poco::Timer& timer)
 //{
 //    if (!_uri.empty())
@@ -575,21 +1339,137 @@ void ICalendar::update(ofEventArgs& args)
 //}
 
 
-bool ICalendar::loadURI(const Poco::URI& uri, ofBuffer& buffer)
+icalcomponent* ICalendar::loadComponent(const Poco::URI& uri,
+                                        ContentValidators& validators,
+                                        LoadStatus& status)
+{
+    icalcomponent* pCalendar = 0;
+
+    status = LOAD_FAILED;
+
+    if (uri.getScheme() == "file" || uri.getScheme().empty())
+    {
+        Poco::File file(ofToDataPath(uri.getPath(), true));
+
+        if (!file.exists())
+        {
+            ofLogError("ICalendar::loadComponent()") << "File: " << file.path() << " not found.";
+            return 0;
+        }
+
+        // Hash and parse the mapped file in place so that it is never
+        // copied to the heap.
+        MappedFile mappedFile;
+
+        if (!mappedFile.open(file.path()))
+        {
+            ofLogError("ICalendar::loadComponent()") << "File: " << file.path() << " could not be opened.";
+            return 0;
+        }
+
+        validators.hash = ICalendarUtils::hashContent(mappedFile.getData(),
+                                                      mappedFile.size());
+        validators.hasHash = true;
+
+        if (isContentUnchanged(validators.hash))
+        {
+            status = LOAD_UNCHANGED;
+            return 0;
+        }
+
+        ICalendarParser parser;
+        parser.parse(mappedFile.getData(), mappedFile.size());
+        pCalendar = parser.finish();
+    }
+    else
+    {
+        ofBuffer buffer;
+
+        LoadStatus loadStatus = loadURI(uri, buffer, validators);
+
+        if (LOAD_OK != loadStatus)
+        {
+            status = loadStatus;
+            return 0;
+        }
+
+        if (0 == buffer.size())
+        {
+            ofLogError("ICalendar::loadComponent()") << "Buffer was empty.";
+            return 0;
+        }
+
+        validators.hash = ICalendarUtils::hashContent(buffer.getData(),
+                                                      buffer.size());
+        validators.hasHash = true;
+
+        if (isContentUnchanged(validators.hash))
+        {
+            status = LOAD_UNCHANGED;
+            return 0;
+        }
+
+        pCalendar = parseBuffer(buffer);
+    }
+
+    if (pCalendar)
+    {
+        status = LOAD_OK;
+    }
+    else
+    {
+        ofLogError("ICalendar::loadComponent()") << "URI: " << uri.toString() << " could not be parsed.";
+    }
+
+    return pCalendar;
+}
+
+
+ICalendar::LoadStatus ICalendar::loadURI(const Poco::URI& uri,
+                                         ofBuffer& buffer,
+                                         ContentValidators& validators)
 {
     if (_uri.getScheme() == "http" || _uri.getScheme() == "https")
     {
-        ofHttpResponse response = ofLoadURL(_uri.toString());
+        ofHttpRequest request(uri.toString(), uri.toString());
+
+#if OF_VERSION_MAJOR > 0 || OF_VERSION_MINOR >= 10
+        // HTTP headers are exposed by openFrameworks 0.10 and later.  Older
+        // versions always fetch the whole calendar.
+        ContentValidators current = getValidators();
+
+        // Only ask for a 304 if the current calendar came from a response
+        // carrying these validators.
+        if (!current.entityTag.empty())
+        {
+            request.headers["If-None-Match"] = current.entityTag;
+        }
+
+        if (!current.lastModified.empty())
+        {
+            request.headers["If-Modified-Since"] = current.lastModified;
+        }
+#endif
+
+        ofURLFileLoader loader;
+        ofHttpResponse response = loader.handleRequest(request);
 
         if (200 == response.status)
         {
             buffer = response.data;
-            return true;
+            validators.entityTag = getHeader(response, "ETag");
+            validators.lastModified = getHeader(response, "Last-Modified");
+            return LOAD_OK;
+        }
+        else if (304 == response.status)
+        {
+            ofLogVerbose("ICalendar::loadURI()") << "URI: " << uri.toString() << " not modified.";
+            return LOAD_NOT_MODIFIED;
         }
         else
         {
             ofLogError("ICalendar::loadURI()") << "URI: " << uri.toString() << ": " << response.error;
-            return false;
+            return LOAD_FAILED;
         }
     }
     else if(_uri.getScheme() == "file" || _uri.getScheme().empty())
@@ -599,18 +1479,18 @@ bool ICalendar::loadURI(const Poco::URI& uri, ofBuffer& buffer)
         if(file.exists())
         {
             buffer = ofBufferFromFile(file.path());
-            return true;
+            return LOAD_OK;
         }
         else
         {
             ofLogError("ICalendar::loadURI()") << "File: " << file.path() << " not found.";
-            return false;
+            return LOAD_FAILED;
         }
     }
     else
     {
         ofLogError("ICalendar::loadURI()") << "Unknown URI Scheme: " << _uri.getScheme();
-        return false;
+        return LOAD_FAILED;
     }
 }
 
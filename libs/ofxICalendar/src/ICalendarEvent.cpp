@@ -24,6 +24,8 @@
 
 
 #include "ofx/Time/ICalendarEvent.h"
+#include <algorithm>
+#include "ofx/Time/ICalendarRecurrenceIterator.h"
 
 
 namespace ofx {
@@ -51,7 +53,18 @@ std::string ICalendarEvent::getDescription() const
 
 std::string ICalendarEvent::getSummary() const
 {
-    return getProperty(ICAL_SUMMARY_PROPERTY);
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
+
+    if (row != ICalendarEventIndex::NO_ROW)
+    {
+        return snapshot->getCompiledCalendar().getSummary(row);
+    }
+    else
+    {
+        ofLogError("Event::getSummary()") << "The icalcomponent is not loaded.";
+        return "";
+    }
 }
 
 
@@ -63,27 +76,29 @@ std::string ICalendarEvent::getUID() const
 
 std::string ICalendarEvent::getLocation() const
 {
-    return getProperty(ICAL_LOCATION_PROPERTY);
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
+
+    if (row != ICalendarEventIndex::NO_ROW)
+    {
+        return snapshot->getCompiledCalendar().getLocation(row);
+    }
+    else
+    {
+        ofLogError("Event::getLocation()") << "The icalcomponent is not loaded.";
+        return "";
+    }
 }
 
 
 int ICalendarEvent::getSequence() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
 
-    if (pEventComponent)
+    if (row != ICalendarEventIndex::NO_ROW)
     {
-        icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent,
-                                                                   ICAL_SEQUENCE_PROPERTY);
-        if (pProperty)
-        {
-            return icalproperty_get_sequence(pProperty);
-        }
-        else
-        {
-            ofLogVerbose("Event::getSequence()") << "No sequence property found, returning -1.";
-            return -1;
-        }
+        return snapshot->getCompiledCalendar().getSequence(row);
     }
     else
     {
@@ -107,33 +122,12 @@ std::string ICalendarEvent::getName() const
 
 Poco::Timestamp ICalendarEvent::getLastModified() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
 
-    if (pEventComponent)
+    if (row != ICalendarEventIndex::NO_ROW)
     {
-        icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent,
-                                                                   ICAL_LASTMODIFIED_PROPERTY);
-
-        if (pProperty)
-        {
-            Poco::Timestamp timestamp;
-
-            if (ICalendarUtils::timeToTimestamp(icalproperty_get_lastmodified(pProperty),
-                                                timestamp))
-            {
-                return timestamp;
-            }
-            else
-            {
-                ofLogVerbose("Event::getLastModified()") << "Invalid timestamp.";
-                return Poco::Timestamp(0);
-            }
-        }
-        else
-        {
-            ofLogVerbose("Event::getLastModified()") << "The icalproperty is 0";
-            return Poco::Timestamp(0);
-        }
+        return Poco::Timestamp(snapshot->getCompiledCalendar().getLastModified(row));
     }
     else
     {
@@ -145,10 +139,13 @@ Poco::Timestamp ICalendarEvent::getLastModified() const
     
 Poco::Timestamp ICalendarEvent::getTimestamp() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    icalcomponent* pEventComponent = getEventComponent(snapshot.get());
 
     if (pEventComponent)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
         Poco::Timestamp timestamp;
 
         if (ICalendarUtils::timeToTimestamp(icalcomponent_get_dtstamp(pEventComponent),
@@ -172,10 +169,13 @@ Poco::Timestamp ICalendarEvent::getTimestamp() const
 
 Poco::Timestamp ICalendarEvent::getCreated() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    icalcomponent* pEventComponent = getEventComponent(snapshot.get());
 
     if (pEventComponent)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
         icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent,
                                                                    ICAL_CREATED_PROPERTY);
 
@@ -222,22 +222,12 @@ std::string ICalendarEvent::getOwner() const
 
 Poco::Timestamp ICalendarEvent::getStart() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
 
-    if (pEventComponent)
+    if (row != ICalendarEventIndex::NO_ROW)
     {
-        Poco::Timestamp timestamp;
-
-        if (ICalendarUtils::timeToTimestamp(icalcomponent_get_dtstart(pEventComponent),
-                                            timestamp))
-        {
-            return timestamp;
-        }
-        else
-        {
-            ofLogVerbose("Event::getStart()") << "Invalid timestamp.";
-            return Poco::Timestamp(0);
-        }
+        return Poco::Timestamp(snapshot->getCompiledCalendar().getStart(row));
     }
     else
     {
@@ -249,22 +239,12 @@ Poco::Timestamp ICalendarEvent::getStart() const
 
 Poco::Timestamp ICalendarEvent::getEnd() const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
 
-    if (pEventComponent)
+    if (row != ICalendarEventIndex::NO_ROW)
     {
-        Poco::Timestamp timestamp;
-
-        if (ICalendarUtils::timeToTimestamp(icalcomponent_get_dtend(pEventComponent),
-                                            timestamp))
-        {
-            return timestamp;
-        }
-        else
-        {
-            ofLogVerbose("Event::getEnd()") << "Invalid timestamp.";
-            return Poco::Timestamp(0);
-        }
+        return Poco::Timestamp(snapshot->getCompiledCalendar().getEnd(row));
     }
     else
     {
@@ -445,15 +425,157 @@ Poco::Timestamp ICalendarEvent::getEnd() const
 
 bool ICalendarEvent::hasInstances(const Interval& interval) const
 {
-    // TODO: improve efficiency
-    return !getInstances(interval).empty();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
+
+    if (row == ICalendarEventIndex::NO_ROW)
+    {
+        ofLogError("Event::hasInstances()") << "The icalcomponent is not loaded.";
+        return false;
+    }
+
+    const CompiledCalendar& compiled = snapshot->getCompiledCalendar();
+    icalcomponent* pEventComponent = compiled.getComponent(row);
+
+    Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
+    int64_t baseStart = 0;
+    int64_t baseEnd = 0;
+
+    if (!ICalendarUtils::getBaseSpan(pEventComponent, baseStart, baseEnd))
+    {
+        return false;
+    }
+
+    int64_t limitStart = interval.getStart().epochTime();
+    int64_t limitEnd = interval.getEnd().epochTime();
+
+    // The remainder mirrors icalcomponent_foreach_recurrence(), but returns
+    // as soon as the first overlapping occurrence is found.
+
+    struct icaltimetype dtstart = icalcomponent_get_dtstart(pEventComponent);
+
+    const ICalendarTimezoneTable* pTable = compiled.getTimezoneTable(row);
+
+    if (ICalendarUtils::spansOverlap(baseStart, baseEnd, limitStart, limitEnd) &&
+        !ICalendarUtils::isExcluded(pEventComponent, dtstart, dtstart, pTable))
+    {
+        return true;
+    }
+
+    if (!compiled.hasRecurrence(row))
+    {
+        return false;
+    }
+
+    int64_t duration = baseEnd - baseStart;
+    struct icaltimetype end = icaltime_from_timet(interval.getEnd().epochTime(), false);
+    int64_t endTime = ICalendarUtils::toUTC(end, 0, 0);
+
+    // Occurrences that start more than a day before the interval, less
+    // their duration, can not overlap it whatever the timezone offsets.
+    struct icaltimetype seekTime = icaltime_from_timet(limitStart - std::max(duration, int64_t(0)) - 24 * 60 * 60,
+                                                       false);
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent,
+                                                               ICAL_RRULE_PROPERTY);
+
+    while (pProperty)
+    {
+        ICalendarRecurrenceIterator iterator(icalproperty_get_rrule(pProperty), dtstart);
+
+        // The first occurrence is always DTSTART, which was tested above.
+        iterator.next();
+        iterator.seek(seekTime);
+
+        struct icaltimetype time = iterator.next();
+
+        while (!icaltime_is_null_time(time))
+        {
+            if (time.is_date ? icaltime_compare(time, end) > 0 : ICalendarUtils::toUTC(time, dtstart.zone, pTable) > endTime)
+            {
+                break;
+            }
+
+            int64_t start = baseStart + icaldurationtype_as_int(icaltime_subtract(time, dtstart));
+
+            if (ICalendarUtils::spansOverlap(start, start + duration, limitStart, limitEnd))
+            {
+                // Checking exclusions moves the component's property
+                // iterator, so the RRULE loop position must be restored.
+                bool isExcluded = ICalendarUtils::isExcluded(pEventComponent,
+                                                             dtstart,
+                                                             time,
+                                                             pTable);
+
+                if (!isExcluded)
+                {
+                    return true;
+                }
+
+                icalproperty* pRule = icalcomponent_get_first_property(pEventComponent,
+                                                                       ICAL_RRULE_PROPERTY);
+
+                while (pRule && pRule != pProperty)
+                {
+                    pRule = icalcomponent_get_next_property(pEventComponent,
+                                                            ICAL_RRULE_PROPERTY);
+                }
+            }
+
+            time = iterator.next();
+        }
+
+        pProperty = icalcomponent_get_next_property(pEventComponent,
+                                                    ICAL_RRULE_PROPERTY);
+    }
+
+    pProperty = icalcomponent_get_first_property(pEventComponent,
+                                                 ICAL_RDATE_PROPERTY);
+
+    while (pProperty)
+    {
+        struct icaldatetimeperiodtype period = icalproperty_get_rdate(pProperty);
+
+        // Like libical, only RDATE date-times are supported.
+        if (!icaltime_is_null_time(period.time))
+        {
+            int64_t start = baseStart + icaldurationtype_as_int(icaltime_subtract(period.time, dtstart));
+
+            if (ICalendarUtils::spansOverlap(start, start + duration, limitStart, limitEnd))
+            {
+                bool isExcluded = ICalendarUtils::isExcluded(pEventComponent,
+                                                             dtstart,
+                                                             period.time,
+                                                             pTable);
+
+                if (!isExcluded)
+                {
+                    return true;
+                }
+
+                icalproperty* pDate = icalcomponent_get_first_property(pEventComponent,
+                                                                       ICAL_RDATE_PROPERTY);
+
+                while (pDate && pDate != pProperty)
+                {
+                    pDate = icalcomponent_get_next_property(pEventComponent,
+                                                            ICAL_RDATE_PROPERTY);
+                }
+            }
+        }
+
+        pProperty = icalcomponent_get_next_property(pEventComponent,
+                                                    ICAL_RDATE_PROPERTY);
+    }
+
+    return false;
 }
 
 
 bool ICalendarEvent::hasInstances(const Poco::Timestamp& timestamp) const
 {
-    // TODO: improve efficiency
-    return !getInstances(timestamp).empty();
+    return hasInstances(Interval(timestamp, timestamp));
 }
 
 
@@ -461,20 +583,33 @@ ICalendarEvent::Instances ICalendarEvent::getInstances(const Interval& interval)
 {
     Instances instances;
 
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    std::size_t row = getRow(snapshot.get());
 
-    if (pEventComponent)
+    if (row != ICalendarEventIndex::NO_ROW)
     {
-        std::vector<Interval> intervals;
+        ICalendarRecurrenceCache::Spans spans;
+
+        {
+            Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
+            snapshot->getRecurrenceCache().query(snapshot->getCompiledCalendar(),
+                                                 row,
+                                                 interval.getStart().epochTime(),
+                                                 interval.getEnd().epochTime(),
+                                                 spans);
+        }
+
+        instances.reserve(spans.size());
 
-        struct icaltimetype start = icaltime_from_timet(interval.getStart().epochTime(), false);
-        struct icaltimetype end = icaltime_from_timet(interval.getEnd().epochTime(), false);
+        ICalendarRecurrenceCache::Spans::const_iterator iter = spans.begin();
 
-        icalcomponent_foreach_recurrence(pEventComponent,
-                                         start,
-                                         end,
-                                         &ICalendarEvent::recurrencesCallback,
-                                         &instances);
+        while (iter != spans.end())
+        {
+            instances.push_back(Interval(Poco::Timestamp::fromEpochTime(iter->start),
+                                         Poco::Timestamp::fromEpochTime(iter->end)));
+            ++iter;
+        }
     }
     else
     {
@@ -533,10 +668,13 @@ bool ICalendarEvent::operator <= (const ICalendarEvent& event) const
 
 std::string ICalendarEvent::getProperty(icalproperty_kind kind) const
 {
-    icalcomponent* pEventComponent = getEventComponent();
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    icalcomponent* pEventComponent = getEventComponent(snapshot.get());
 
     if (pEventComponent)
     {
+        Poco::Mutex::ScopedLock lock(snapshot->getMutex());
+
         icalproperty* pProperty = icalcomponent_get_first_property(pEventComponent, kind);
 
         if (pProperty)
@@ -653,7 +791,8 @@ icalcomponent* ICalendarEvent::getEventComponentForUID(icalcomponent* pParentCom
 
 bool ICalendarEvent::isValid() const
 {
-    return getEventComponentForUID(_pParent->getComponent(), _uid);
+    ICalendarSnapshot::SharedPtr snapshot = _pParent->getSnapshot();
+    return getRow(snapshot.get()) != ICalendarEventIndex::NO_ROW;
 }
 
 
@@ -674,26 +813,28 @@ bool ICalendarEvent::isValidInterval(const Interval& interval) const
 }
 
 
-icalcomponent* ICalendarEvent::getEventComponent() const
+std::size_t ICalendarEvent::getRow(const ICalendarSnapshot* pSnapshot) const
 {
-    return getEventComponentForUID(_pParent->getComponent(), _uid);
+    if (!pSnapshot)
+    {
+        return ICalendarEventIndex::NO_ROW;
+    }
+
+    return pSnapshot->getCompiledCalendar().find(_uid);
 }
 
 
-void ICalendarEvent::recurrencesCallback(icalcomponent* component,
-                                         struct icaltime_span* timeSpan,
-                                         void* data)
+icalcomponent* ICalendarEvent::getEventComponent(const ICalendarSnapshot* pSnapshot) const
 {
-    if (data)
-    {
-        std::vector<Interval>* intervals = reinterpret_cast<std::vector<Interval>*>(data);
+    std::size_t row = getRow(pSnapshot);
 
-        intervals->push_back(Interval(Poco::Timestamp::fromEpochTime(timeSpan->start),
-                                      Poco::Timestamp::fromEpochTime(timeSpan->end)));
+    if (row != ICalendarEventIndex::NO_ROW)
+    {
+        return pSnapshot->getCompiledCalendar().getComponent(row);
     }
     else
     {
-        ofLogError("Event::recurrancesCallback()") << "Instances vector is == 0";
+        return 0;
     }
 }
 
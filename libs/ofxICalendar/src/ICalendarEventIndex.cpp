@@ -0,0 +1,244 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarEventIndex.h"
+#include <algorithm>
+#include <cstring>
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+const std::size_t ICalendarEventIndex::NO_ROW = std::size_t(-1);
+
+
+ICalendarEventIndex::ICalendarEventIndex(): _size(0)
+{
+}
+
+
+ICalendarEventIndex::~ICalendarEventIndex()
+{
+}
+
+
+void ICalendarEventIndex::reset(std::size_t count)
+{
+    // Keep the load factor at or below 0.5 so probe sequences stay short.
+    std::size_t capacity = 8;
+
+    while (capacity < count * 2)
+    {
+        capacity <<= 1;
+    }
+
+    Entry empty = { 0, 0, 0, NO_ROW };
+
+    _entries.assign(capacity, empty);
+    _keys.clear();
+    _size = 0;
+}
+
+
+void ICalendarEventIndex::clear()
+{
+    _entries.clear();
+    _keys.clear();
+    _size = 0;
+}
+
+
+void ICalendarEventIndex::swap(ICalendarEventIndex& other)
+{
+    _entries.swap(other._entries);
+    _keys.swap(other._keys);
+    std::swap(_size, other._size);
+}
+
+
+bool ICalendarEventIndex::insert(const char* pUID,
+                                 std::size_t length,
+                                 std::size_t row)
+{
+    if (!pUID || NO_ROW == row)
+    {
+        return false;
+    }
+
+    reserve(_size + 1);
+
+    uint64_t hash = ICalendarUtils::hash(pUID, length);
+    std::size_t slot = findSlot(pUID, length, hash);
+
+    if (_entries[slot].row != NO_ROW)
+    {
+        // Keep the first row to match a linear document-order search.
+        return false;
+    }
+
+    Entry entry = { hash, _keys.size(), length, row };
+
+    _keys.insert(_keys.end(), pUID, pUID + length);
+    _entries[slot] = entry;
+    ++_size;
+
+    return true;
+}
+
+
+bool ICalendarEventIndex::erase(const char* pUID, std::size_t length)
+{
+    if (_entries.empty() || !pUID)
+    {
+        return false;
+    }
+
+    std::size_t mask = _entries.size() - 1;
+    std::size_t slot = findSlot(pUID, length, ICalendarUtils::hash(pUID, length));
+
+    if (NO_ROW == _entries[slot].row)
+    {
+        return false;
+    }
+
+    // Backward-shift deletion: move later entries of the probe sequence into
+    // the hole so that no tombstones are needed.
+    std::size_t next = (slot + 1) & mask;
+
+    while (_entries[next].row != NO_ROW)
+    {
+        std::size_t home = static_cast<std::size_t>(_entries[next].hash) & mask;
+
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            _entries[slot] = _entries[next];
+            slot = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    Entry empty = { 0, 0, 0, NO_ROW };
+
+    _entries[slot] = empty;
+    --_size;
+
+    return true;
+}
+
+
+std::size_t ICalendarEventIndex::find(const std::string& uid) const
+{
+    return find(uid.c_str(), uid.size());
+}
+
+
+std::size_t ICalendarEventIndex::find(const char* pUID,
+                                      std::size_t length) const
+{
+    if (_entries.empty() || !pUID)
+    {
+        return NO_ROW;
+    }
+
+    return _entries[findSlot(pUID, length, ICalendarUtils::hash(pUID, length))].row;
+}
+
+
+std::size_t ICalendarEventIndex::size() const
+{
+    return _size;
+}
+
+
+bool ICalendarEventIndex::empty() const
+{
+    return 0 == _size;
+}
+
+
+void ICalendarEventIndex::reserve(std::size_t count)
+{
+    if (count * 2 <= _entries.size())
+    {
+        return;
+    }
+
+    // Grow and reinsert.  The keys stay in the pool, so this only moves the
+    // entries.
+    std::vector<Entry> entries;
+    entries.swap(_entries);
+
+    std::vector<char> keys;
+    keys.swap(_keys);
+
+    reset(count);
+
+    _keys.swap(keys);
+
+    std::vector<Entry>::const_iterator iter = entries.begin();
+
+    while (iter != entries.end())
+    {
+        if (iter->row != NO_ROW)
+        {
+            _entries[findSlot(_keys.data() + iter->offset, iter->length, iter->hash)] = *iter;
+            ++_size;
+        }
+
+        ++iter;
+    }
+}
+
+
+std::size_t ICalendarEventIndex::findSlot(const char* pUID,
+                                          std::size_t length,
+                                          uint64_t hash) const
+{
+    std::size_t mask = _entries.size() - 1;
+    std::size_t slot = static_cast<std::size_t>(hash) & mask;
+
+    while (_entries[slot].row != NO_ROW)
+    {
+        const Entry& entry = _entries[slot];
+
+        if (entry.hash == hash &&
+            entry.length == length &&
+            0 == std::memcmp(_keys.data() + entry.offset, pUID, length))
+        {
+            break;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+
+} } // namespace ofx::Time
@@ -24,6 +24,7 @@
 
 
 #include "ofx/Time/ICalendarEventInstance.h"
+#include "ofx/Time/ICalendarUtils.h"
 
 
 namespace ofx {
@@ -33,7 +34,8 @@ namespace Time {
 ICalendarEventInstance::ICalendarEventInstance(const ICalendarEvent& event,
                                                const Interval& interval):
     _event(event),
-    _interval(interval)
+    _interval(interval),
+    _occurrenceKey(makeOccurrenceKey(event._uid, interval.getStart()))
 {
 }
 
@@ -61,39 +63,100 @@ bool ICalendarEventInstance::isValidEventInstance() const
 }
 
 
+uint64_t ICalendarEventInstance::getOccurrenceKey() const
+{
+    return _occurrenceKey;
+}
+
+
+bool ICalendarEventInstance::isSameOccurrence(const ICalendarEventInstance& other) const
+{
+    return _occurrenceKey == other._occurrenceKey &&
+           _interval.getStart() == other._interval.getStart() &&
+           _event._uid == other._event._uid;
+}
+
+
 bool ICalendarEventInstance::operator == (const ICalendarEventInstance& other) const
 {
-    return _event == other._event && _interval == other._interval;
+    return 0 == compare(other);
 }
 
 
 bool ICalendarEventInstance::operator != (const ICalendarEventInstance& other) const
 {
-    return _event != other._event || _interval != other._interval;
+    return 0 != compare(other);
 }
 
 
 bool ICalendarEventInstance::operator >  (const ICalendarEventInstance& other) const
 {
-    return _event > other._event;
+    return compare(other) > 0;
 }
 
 
 bool ICalendarEventInstance::operator >= (const ICalendarEventInstance& other) const
 {
-    return _event >= other._event;
+    return compare(other) >= 0;
 }
 
 
 bool ICalendarEventInstance::operator <  (const ICalendarEventInstance& other) const
 {
-    return _event < other._event;
+    return compare(other) < 0;
 }
 
 
 bool ICalendarEventInstance::operator <= (const ICalendarEventInstance& other) const
 {
-    return _event <= other._event;
+    return compare(other) <= 0;
+}
+
+
+uint64_t ICalendarEventInstance::makeOccurrenceKey(const std::string& uid,
+                                                   const Poco::Timestamp& start)
+{
+    // Mix the start into the UID hash and finalize it (the XXH64
+    // avalanche), so occurrences of one event spread over the whole range.
+    uint64_t key = ICalendarUtils::hash(uid.data(), uid.size());
+
+    key ^= static_cast<uint64_t>(start.epochMicroseconds()) * 0x9E3779B185EBCA87ULL;
+    key ^= key >> 33;
+    key *= 0xC2B2AE3D27D4EB4FULL;
+    key ^= key >> 29;
+    key *= 0x165667B19E3779F9ULL;
+    key ^= key >> 32;
+
+    return key;
+}
+
+
+int ICalendarEventInstance::compare(const ICalendarEventInstance& other) const
+{
+    if (_occurrenceKey != other._occurrenceKey)
+    {
+        return _occurrenceKey < other._occurrenceKey ? -1 : 1;
+    }
+
+    // Only a collision or the same occurrence gets here.
+    int result = _event._uid.compare(other._event._uid);
+
+    if (0 != result)
+    {
+        return result;
+    }
+
+    if (_interval.getStart() != other._interval.getStart())
+    {
+        return _interval.getStart() < other._interval.getStart() ? -1 : 1;
+    }
+
+    if (_interval.getEnd() != other._interval.getEnd())
+    {
+        return _interval.getEnd() < other._interval.getEnd() ? -1 : 1;
+    }
+
+    return 0;
 }
 
 
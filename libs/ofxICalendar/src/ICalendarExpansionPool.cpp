@@ -0,0 +1,207 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarExpansionPool.h"
+#include <exception>
+#include "Poco/Environment.h"
+#include "Poco/ScopedUnlock.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarExpansionPool::Job::~Job()
+{
+}
+
+
+ICalendarExpansionPool::ICalendarExpansionPool(std::size_t numWorkers):
+    _numWorkers(numWorkers),
+    _pJob(0),
+    _numChunks(0),
+    _nextChunk(0),
+    _generation(0),
+    _numActive(0),
+    _stopping(false)
+{
+}
+
+
+ICalendarExpansionPool::~ICalendarExpansionPool()
+{
+    {
+        Poco::Mutex::ScopedLock lock(_mutex);
+        _stopping = true;
+        _condition.broadcast();
+    }
+
+    for (std::size_t i = 0; i < _workers.size(); ++i)
+    {
+        _workers[i]->join();
+        delete _workers[i];
+    }
+}
+
+
+void ICalendarExpansionPool::execute(Job& job, std::size_t numChunks)
+{
+    if (numChunks < 2 || 0 == _numWorkers || !_executeMutex.tryLock())
+    {
+        for (std::size_t chunk = 0; chunk < numChunks; ++chunk)
+        {
+            process(job, chunk);
+        }
+
+        return;
+    }
+
+    {
+        Poco::Mutex::ScopedLock lock(_mutex);
+
+        startWorkers();
+
+        _pJob = &job;
+        _numChunks = numChunks;
+        _nextChunk = 0;
+        ++_generation;
+
+        _condition.broadcast();
+    }
+
+    work(job, numChunks);
+
+    {
+        Poco::Mutex::ScopedLock lock(_mutex);
+
+        // Every chunk has been claimed, but workers may still be
+        // processing theirs.  Workers that wake later find no job.
+        while (_numActive > 0)
+        {
+            _condition.wait(_mutex);
+        }
+
+        _pJob = 0;
+    }
+
+    _executeMutex.unlock();
+}
+
+
+std::size_t ICalendarExpansionPool::getNumWorkers() const
+{
+    return _numWorkers;
+}
+
+
+void ICalendarExpansionPool::run()
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    uint64_t generation = 0;
+
+    while (!_stopping)
+    {
+        if (!_pJob || generation == _generation)
+        {
+            _condition.wait(_mutex);
+            continue;
+        }
+
+        generation = _generation;
+
+        Job* pJob = _pJob;
+        std::size_t numChunks = _numChunks;
+
+        ++_numActive;
+
+        {
+            Poco::ScopedUnlock<Poco::Mutex> unlock(_mutex);
+            work(*pJob, numChunks);
+        }
+
+        --_numActive;
+
+        _condition.broadcast();
+    }
+}
+
+
+std::size_t ICalendarExpansionPool::getDefaultNumWorkers()
+{
+    unsigned processors = Poco::Environment::processorCount();
+    return processors > 1 ? processors - 1 : 0;
+}
+
+
+ICalendarExpansionPool::SharedPtr ICalendarExpansionPool::getDefault()
+{
+    static SharedPtr pool(new ICalendarExpansionPool());
+    return pool;
+}
+
+
+void ICalendarExpansionPool::work(Job& job, std::size_t numChunks)
+{
+    std::size_t chunk = _nextChunk++;
+
+    while (chunk < numChunks)
+    {
+        process(job, chunk);
+        chunk = _nextChunk++;
+    }
+}
+
+
+void ICalendarExpansionPool::process(Job& job, std::size_t chunk)
+{
+    try
+    {
+        job.process(chunk);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("ICalendarExpansionPool::process()") << exc.what();
+    }
+}
+
+
+void ICalendarExpansionPool::startWorkers()
+{
+    if (_workers.empty())
+    {
+        for (std::size_t i = 0; i < _numWorkers; ++i)
+        {
+            Poco::Thread* pThread = new Poco::Thread("ICalendarExpansionPool");
+            pThread->start(*this);
+            _workers.push_back(pThread);
+        }
+    }
+}
+
+
+} } // namespace ofx::Time
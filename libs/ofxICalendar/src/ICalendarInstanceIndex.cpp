@@ -0,0 +1,428 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarInstanceIndex.h"
+#include <algorithm>
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarInstanceIndex::ICalendarInstanceIndex():
+    _maxLevel(-1),
+    _isBuilt(false)
+{
+}
+
+
+ICalendarInstanceIndex::~ICalendarInstanceIndex()
+{
+}
+
+
+class ICalendarInstanceIndex::BuildJob: public ICalendarExpansionPool::Job
+{
+public:
+    BuildJob(const CompiledCalendar& compiled, const Interval& horizon):
+        _compiled(compiled),
+        _horizon(horizon),
+        _chunks((compiled.size() + ICalendarExpansionPool::DEFAULT_CHUNK_SIZE - 1) / ICalendarExpansionPool::DEFAULT_CHUNK_SIZE)
+    {
+    }
+
+    void process(std::size_t chunk)
+    {
+        std::size_t row = chunk * ICalendarExpansionPool::DEFAULT_CHUNK_SIZE;
+        std::size_t end = std::min(row + ICalendarExpansionPool::DEFAULT_CHUNK_SIZE, _compiled.size());
+
+        for (; row < end; ++row)
+        {
+            ICalendarInstanceIndex::expand(_compiled, row, _horizon, _chunks[chunk]);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return _chunks.size();
+    }
+
+    void append(Instances& instances) const
+    {
+        std::size_t total = instances.size();
+
+        for (std::size_t i = 0; i < _chunks.size(); ++i)
+        {
+            total += _chunks[i].size();
+        }
+
+        instances.reserve(total);
+
+        for (std::size_t i = 0; i < _chunks.size(); ++i)
+        {
+            instances.insert(instances.end(), _chunks[i].begin(), _chunks[i].end());
+        }
+    }
+
+private:
+    const CompiledCalendar& _compiled;
+    const Interval& _horizon;
+    std::vector<Instances> _chunks;
+
+};
+
+
+void ICalendarInstanceIndex::build(const CompiledCalendar& compiled,
+                                   const Interval& horizon,
+                                   ICalendarExpansionPool* pPool)
+{
+    clear();
+
+    if (pPool)
+    {
+        // Chunks are appended in row order, like the serial loop.
+        BuildJob job(compiled, horizon);
+        pPool->execute(job, job.size());
+        job.append(_instances);
+    }
+    else
+    {
+        for (std::size_t row = 0; row < compiled.size(); ++row)
+        {
+            expand(compiled, row, horizon, _instances);
+        }
+    }
+
+    // Rows are expanded in document order, so a stable sort keeps instances
+    // with equal starts in document order.
+    std::stable_sort(_instances.begin(), _instances.end(), compareStart);
+
+    buildTree();
+
+    _horizon = horizon;
+    _isBuilt = true;
+}
+
+
+void ICalendarInstanceIndex::update(const CompiledCalendar& compiled,
+                                    const std::vector<std::size_t>& rows)
+{
+    if (!_isBuilt)
+    {
+        return;
+    }
+
+    std::vector<unsigned char> changed(compiled.size(), 0);
+
+    std::vector<std::size_t>::const_iterator rowIter = rows.begin();
+
+    while (rowIter != rows.end())
+    {
+        if (*rowIter < changed.size())
+        {
+            changed[*rowIter] = 1;
+        }
+
+        ++rowIter;
+    }
+
+    Instances kept;
+    kept.reserve(_instances.size());
+
+    Instances::const_iterator iter = _instances.begin();
+
+    while (iter != _instances.end())
+    {
+        if (iter->row >= changed.size() || !changed[iter->row])
+        {
+            kept.push_back(*iter);
+        }
+
+        ++iter;
+    }
+
+    Instances expanded;
+
+    for (std::size_t row = 0; row < changed.size(); ++row)
+    {
+        if (changed[row])
+        {
+            expand(compiled, row, _horizon, expanded);
+        }
+    }
+
+    std::stable_sort(expanded.begin(), expanded.end(), compareStart);
+
+    _instances.resize(kept.size() + expanded.size());
+
+    std::merge(kept.begin(),
+               kept.end(),
+               expanded.begin(),
+               expanded.end(),
+               _instances.begin(),
+               compareStart);
+
+    buildTree();
+}
+
+
+void ICalendarInstanceIndex::clear()
+{
+    _instances.clear();
+    _maxEnds.clear();
+    _maxLevel = -1;
+    _horizon = Interval();
+    _isBuilt = false;
+}
+
+
+bool ICalendarInstanceIndex::isBuilt() const
+{
+    return _isBuilt;
+}
+
+
+bool ICalendarInstanceIndex::covers(const Interval& interval) const
+{
+    return _isBuilt &&
+           interval.getStart() >= _horizon.getStart() &&
+           interval.getEnd() <= _horizon.getEnd();
+}
+
+
+const Interval& ICalendarInstanceIndex::getHorizon() const
+{
+    return _horizon;
+}
+
+
+void ICalendarInstanceIndex::query(const Interval& interval,
+                                   Instances& results) const
+{
+    if (_maxLevel < 0)
+    {
+        return;
+    }
+
+    int64_t start = interval.getStart().epochTime();
+    int64_t end = interval.getEnd().epochTime();
+
+    // The tree is pruned with closed-interval tests against each instance's
+    // hull, which are a superset of libical's overlap rule even for spans
+    // that end before they start.  The exact rule is then applied to each
+    // candidate.
+    struct Node
+    {
+        int level;
+        std::size_t index;
+        bool leftDone;
+    };
+
+    std::size_t n = _instances.size();
+
+    // Each level pushes at most two nodes.
+    Node stack[128];
+    int top = 0;
+
+    Node root = { _maxLevel, (std::size_t(1) << _maxLevel) - 1, false };
+    stack[top++] = root;
+
+    while (top > 0)
+    {
+        Node node = stack[--top];
+
+        if (node.level <= 3)
+        {
+            // Small subtrees are scanned linearly.
+            std::size_t i0 = node.index >> node.level << node.level;
+            std::size_t i1 = std::min(i0 + (std::size_t(1) << (node.level + 1)) - 1, n);
+
+            for (std::size_t i = i0; i < i1 && getLow(_instances[i]) <= end; ++i)
+            {
+                const Instance& instance = _instances[i];
+
+                if (ICalendarUtils::spansOverlap(instance.start, instance.end, start, end))
+                {
+                    results.push_back(instance);
+                }
+            }
+        }
+        else if (!node.leftDone)
+        {
+            std::size_t left = node.index - (std::size_t(1) << (node.level - 1));
+
+            Node self = { node.level, node.index, true };
+            stack[top++] = self;
+
+            if (left >= n || _maxEnds[left] >= start)
+            {
+                Node child = { node.level - 1, left, false };
+                stack[top++] = child;
+            }
+        }
+        else if (node.index < n && getLow(_instances[node.index]) <= end)
+        {
+            const Instance& instance = _instances[node.index];
+
+            if (ICalendarUtils::spansOverlap(instance.start, instance.end, start, end))
+            {
+                results.push_back(instance);
+            }
+
+            Node child = { node.level - 1,
+                           node.index + (std::size_t(1) << (node.level - 1)),
+                           false };
+            stack[top++] = child;
+        }
+    }
+}
+
+
+void ICalendarInstanceIndex::expand(const CompiledCalendar& compiled,
+                                    std::size_t row,
+                                    const Interval& horizon,
+                                    Instances& instances)
+{
+    // Rows without a UID can not be referenced and removed rows have no
+    // component.
+    if (0 == compiled.getUIDLength(row) || compiled.isRemoved(row))
+    {
+        return;
+    }
+
+    ExpansionData data;
+    data.pInstances = &instances;
+    data.row = row;
+
+    // libical's overlap test is strict, so the expansion is widened by a
+    // second on each side to keep instances that only touch the horizon,
+    // such as zero-length instances at its start.  Queries apply the exact
+    // rule, so the extra instances are never returned for an interval
+    // inside the horizon.
+    ICalendarUtils::forEachRecurrence(compiled.getComponent(row),
+                                      icaltime_from_timet(horizon.getStart().epochTime() - 1, false),
+                                      icaltime_from_timet(horizon.getEnd().epochTime() + 1, false),
+                                      &ICalendarInstanceIndex::expansionCallback,
+                                      &data,
+                                      compiled.getTimezoneTable(row));
+}
+
+
+void ICalendarInstanceIndex::buildTree()
+{
+    // Build the implicit interval tree.  Leaves are at even indices (level
+    // 0), and a node at level k has its k lowest bits set.  Each node stores
+    // the maximum end of its subtree.  A node whose right subtree falls off
+    // the end of the array uses the maximum end of the last complete node.
+    std::size_t n = _instances.size();
+
+    _maxEnds.resize(n);
+
+    if (n > 0)
+    {
+        std::size_t lastIndex = 0;
+        int64_t last = 0;
+
+        for (std::size_t i = 0; i < n; i += 2)
+        {
+            lastIndex = i;
+            last = _maxEnds[i] = getHigh(_instances[i]);
+        }
+
+        int k = 1;
+
+        for (; (std::size_t(1) << k) <= n; ++k)
+        {
+            std::size_t x = std::size_t(1) << (k - 1);
+            std::size_t i0 = (x << 1) - 1;
+            std::size_t step = x << 2;
+
+            for (std::size_t i = i0; i < n; i += step)
+            {
+                int64_t endLeft = _maxEnds[i - x];
+                int64_t endRight = i + x < n ? _maxEnds[i + x] : last;
+                _maxEnds[i] = std::max(getHigh(_instances[i]), std::max(endLeft, endRight));
+            }
+
+            lastIndex = ((lastIndex >> k) & 1) ? lastIndex - x : lastIndex + x;
+
+            if (lastIndex < n && _maxEnds[lastIndex] > last)
+            {
+                last = _maxEnds[lastIndex];
+            }
+        }
+
+        _maxLevel = k - 1;
+    }
+    else
+    {
+        _maxLevel = -1;
+    }
+}
+
+
+std::size_t ICalendarInstanceIndex::size() const
+{
+    return _instances.size();
+}
+
+
+bool ICalendarInstanceIndex::compareStart(const Instance& lhs,
+                                          const Instance& rhs)
+{
+    int64_t lhsLow = getLow(lhs);
+    int64_t rhsLow = getLow(rhs);
+
+    return lhsLow < rhsLow || (lhsLow == rhsLow && lhs.row < rhs.row);
+}
+
+
+int64_t ICalendarInstanceIndex::getLow(const Instance& instance)
+{
+    return std::min(instance.start, instance.end);
+}
+
+
+int64_t ICalendarInstanceIndex::getHigh(const Instance& instance)
+{
+    return std::max(instance.start, instance.end);
+}
+
+
+void ICalendarInstanceIndex::expansionCallback(icalcomponent* component,
+                                               struct icaltime_span* timeSpan,
+                                               void* data)
+{
+    ExpansionData* pData = reinterpret_cast<ExpansionData*>(data);
+
+    Instance instance = { timeSpan->start, timeSpan->end, pData->row };
+
+    pData->pInstances->push_back(instance);
+}
+
+
+} } // namespace ofx::Time
@@ -0,0 +1,222 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+
+#include "ofx/Time/ICalendarParser.h"
+#include <cstring>
+#include <vector>
+#include "ofx/Time/MappedFile.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarParser::ICalendarParser():
+    _pParser(icalparser_new()),
+    _pRoot(0),
+    _hasContentLine(false)
+{
+}
+
+
+ICalendarParser::~ICalendarParser()
+{
+    if (_pRoot)
+    {
+        icalcomponent_free(_pRoot);
+        _pRoot = 0;
+    }
+
+    if (_pParser)
+    {
+        icalparser_free(_pParser);
+        _pParser = 0;
+    }
+}
+
+
+void ICalendarParser::parse(const char* pData, std::size_t size)
+{
+    if (!pData)
+    {
+        return;
+    }
+
+    // Like icalparser_parse(), don't abort on malformed data.
+    icalerrorstate errorState = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, ICAL_ERROR_NONFATAL);
+
+    const char* pEnd = pData + size;
+
+    while (pData < pEnd)
+    {
+        const char* pNewline = static_cast<const char*>(std::memchr(pData,
+                                                                    '\n',
+                                                                    pEnd - pData));
+
+        if (!pNewline)
+        {
+            _partialLine.append(pData, pEnd);
+            break;
+        }
+
+        if (_partialLine.empty())
+        {
+            addPhysicalLine(pData, pNewline - pData);
+        }
+        else
+        {
+            _partialLine.append(pData, pNewline);
+            addPhysicalLine(_partialLine.data(), _partialLine.size());
+            _partialLine.clear();
+        }
+
+        pData = pNewline + 1;
+    }
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, errorState);
+}
+
+
+icalcomponent* ICalendarParser::finish()
+{
+    icalerrorstate errorState = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, ICAL_ERROR_NONFATAL);
+
+    if (!_partialLine.empty())
+    {
+        addPhysicalLine(_partialLine.data(), _partialLine.size());
+        _partialLine.clear();
+    }
+
+    addContentLine();
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, errorState);
+
+    // Start over with a fresh parser so unclosed components are dropped.
+    icalparser_free(_pParser);
+    _pParser = icalparser_new();
+
+    icalcomponent* pRoot = _pRoot;
+    _pRoot = 0;
+    return pRoot;
+}
+
+
+icalcomponent* ICalendarParser::parse(std::istream& stream,
+                                      std::size_t chunkSize)
+{
+    ICalendarParser parser;
+    std::vector<char> chunk(chunkSize > 0 ? chunkSize : DEFAULT_CHUNK_SIZE);
+
+    while (stream)
+    {
+        stream.read(&chunk[0], chunk.size());
+        parser.parse(&chunk[0], static_cast<std::size_t>(stream.gcount()));
+    }
+
+    return parser.finish();
+}
+
+
+icalcomponent* ICalendarParser::parseFile(const std::string& path)
+{
+    MappedFile file;
+
+    if (!file.open(path))
+    {
+        return 0;
+    }
+
+    ICalendarParser parser;
+    parser.parse(file.getData(), file.size());
+    return parser.finish();
+}
+
+
+void ICalendarParser::addPhysicalLine(const char* pLine, std::size_t length)
+{
+    if (length > 0 && '\r' == pLine[length - 1])
+    {
+        --length;
+    }
+
+    if (length > 0 && (' ' == pLine[0] || '\t' == pLine[0]) && _hasContentLine)
+    {
+        // A folded continuation.  The leading whitespace is part of the
+        // line break, as in icalparser_get_line().
+        _contentLine.append(pLine + 1, length - 1);
+    }
+    else
+    {
+        addContentLine();
+        _contentLine.assign(pLine, length);
+        _hasContentLine = true;
+    }
+}
+
+
+void ICalendarParser::addContentLine()
+{
+    if (!_hasContentLine)
+    {
+        return;
+    }
+
+    _hasContentLine = false;
+
+    if (_contentLine.empty())
+    {
+        return;
+    }
+
+    icalcomponent* pComponent = icalparser_add_line(_pParser, &_contentLine[0]);
+
+    if (pComponent)
+    {
+        // Group multiple top-level components the way icalparser_parse()
+        // does.
+        if (!_pRoot)
+        {
+            _pRoot = pComponent;
+        }
+        else if (icalcomponent_isa(_pRoot) != ICAL_XROOT_COMPONENT)
+        {
+            icalcomponent* pXRoot = icalcomponent_new(ICAL_XROOT_COMPONENT);
+            icalcomponent_add_component(pXRoot, _pRoot);
+            icalcomponent_add_component(pXRoot, pComponent);
+            _pRoot = pXRoot;
+        }
+        else
+        {
+            icalcomponent_add_component(_pRoot, pComponent);
+        }
+    }
+}
+
+
+} } // namespace ofx::Time
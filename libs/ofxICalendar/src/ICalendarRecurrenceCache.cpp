@@ -0,0 +1,184 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarRecurrenceCache.h"
+#include <algorithm>
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+const int64_t ICalendarRecurrenceCache::DEFAULT_HORIZON = 30 * 24 * 60 * 60;
+
+
+ICalendarRecurrenceCache::Entry::Entry():
+    isExpanded(false),
+    windowStart(0),
+    windowEnd(0),
+    maxLength(0)
+{
+}
+
+
+ICalendarRecurrenceCache::ICalendarRecurrenceCache(int64_t horizon):
+    _horizon(horizon)
+{
+}
+
+
+ICalendarRecurrenceCache::~ICalendarRecurrenceCache()
+{
+}
+
+
+void ICalendarRecurrenceCache::query(const CompiledCalendar& compiled,
+                                     std::size_t row,
+                                     int64_t start,
+                                     int64_t end,
+                                     Spans& results)
+{
+    if (row >= compiled.size() || compiled.isRemoved(row))
+    {
+        return;
+    }
+
+    prepare(compiled);
+
+    Entry& entry = _entries[row];
+
+    if (!entry.isExpanded || start < entry.windowStart || end > entry.windowEnd)
+    {
+        expand(compiled, row, start - _horizon, end + _horizon, entry);
+    }
+
+    // A span can only overlap the query if its lower bound lies within
+    // maxLength before the query start.
+    Span first = { start - entry.maxLength, start - entry.maxLength };
+
+    Spans::const_iterator iter = std::lower_bound(entry.spans.begin(),
+                                                  entry.spans.end(),
+                                                  first,
+                                                  compareLow);
+
+    while (iter != entry.spans.end() && std::min(iter->start, iter->end) <= end)
+    {
+        if (ICalendarUtils::spansOverlap(iter->start, iter->end, start, end))
+        {
+            results.push_back(*iter);
+        }
+
+        ++iter;
+    }
+}
+
+
+void ICalendarRecurrenceCache::prepare(const CompiledCalendar& compiled)
+{
+    if (_entries.size() < compiled.size())
+    {
+        _entries.resize(compiled.size());
+    }
+}
+
+
+void ICalendarRecurrenceCache::clear()
+{
+    _entries.clear();
+}
+
+
+std::size_t ICalendarRecurrenceCache::size() const
+{
+    std::size_t total = 0;
+
+    std::vector<Entry>::const_iterator iter = _entries.begin();
+
+    while (iter != _entries.end())
+    {
+        total += iter->spans.size();
+        ++iter;
+    }
+
+    return total;
+}
+
+
+void ICalendarRecurrenceCache::expand(const CompiledCalendar& compiled,
+                                      std::size_t row,
+                                      int64_t windowStart,
+                                      int64_t windowEnd,
+                                      Entry& entry)
+{
+    entry.spans.clear();
+
+    ICalendarUtils::forEachRecurrence(compiled.getComponent(row),
+                                      icaltime_from_timet(static_cast<time_t>(windowStart), false),
+                                      icaltime_from_timet(static_cast<time_t>(windowEnd), false),
+                                      &ICalendarRecurrenceCache::expansionCallback,
+                                      &entry.spans,
+                                      compiled.getTimezoneTable(row));
+
+    // Multiple RRULEs are expanded one after the other.
+    std::stable_sort(entry.spans.begin(), entry.spans.end(), compareLow);
+
+    entry.maxLength = 0;
+
+    Spans::const_iterator iter = entry.spans.begin();
+
+    while (iter != entry.spans.end())
+    {
+        int64_t length = iter->end > iter->start ? iter->end - iter->start : iter->start - iter->end;
+        entry.maxLength = std::max(entry.maxLength, length);
+        ++iter;
+    }
+
+    entry.windowStart = windowStart;
+    entry.windowEnd = windowEnd;
+    entry.isExpanded = true;
+}
+
+
+void ICalendarRecurrenceCache::expansionCallback(icalcomponent* component,
+                                                 struct icaltime_span* timeSpan,
+                                                 void* data)
+{
+    Spans* pSpans = reinterpret_cast<Spans*>(data);
+
+    Span span = { timeSpan->start, timeSpan->end };
+
+    pSpans->push_back(span);
+}
+
+
+bool ICalendarRecurrenceCache::compareLow(const Span& lhs, const Span& rhs)
+{
+    return std::min(lhs.start, lhs.end) < std::min(rhs.start, rhs.end);
+}
+
+
+} } // namespace ofx::Time
@@ -0,0 +1,457 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarRecurrenceIterator.h"
+#include <algorithm>
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarRecurrenceIterator::ICalendarRecurrenceIterator(const struct icalrecurrencetype& rule,
+                                                         const struct icaltimetype& dtstart):
+    _first(icaltime_null_time()),
+    _until(rule.until),
+    _count(rule.count),
+    _pattern(PATTERN_LIBICAL),
+    _pIterator(icalrecur_iterator_new(rule, dtstart)),
+    _pending(icaltime_null_time()),
+    _origin(0),
+    _timeOfDay(0),
+    _periodLength(1),
+    _secondIndex(0),
+    _period(0),
+    _slot(0),
+    _isFinished(false)
+{
+    if (_pIterator)
+    {
+        _pattern = setup(rule, dtstart);
+        _pending = icalrecur_iterator_next(_pIterator);
+    }
+
+    if (icaltime_is_null_time(_pending))
+    {
+        _isFinished = true;
+    }
+    else if (PATTERN_LIBICAL != _pattern)
+    {
+        // The first occurrence is all that is needed from libical.
+        icalrecur_iterator_free(_pIterator);
+        _pIterator = 0;
+
+        anchor(_pending);
+    }
+}
+
+
+ICalendarRecurrenceIterator::~ICalendarRecurrenceIterator()
+{
+    if (_pIterator)
+    {
+        icalrecur_iterator_free(_pIterator);
+    }
+}
+
+
+struct icaltimetype ICalendarRecurrenceIterator::next()
+{
+    if (!icaltime_is_null_time(_pending))
+    {
+        struct icaltimetype time = _pending;
+        _pending = icaltime_null_time();
+        return time;
+    }
+
+    if (_isFinished)
+    {
+        return icaltime_null_time();
+    }
+
+    if (PATTERN_LIBICAL == _pattern)
+    {
+        struct icaltimetype time = icalrecur_iterator_next(_pIterator);
+        _isFinished = icaltime_is_null_time(time);
+        return time;
+    }
+
+    // The checks below are the ones icalrecur_iterator_next() makes, so
+    // that COUNT and UNTIL end the rule at the same place.  The first
+    // occurrence is number 0.
+    if (_count > 0 && 1 + getSlotIndex() - _secondIndex >= _count)
+    {
+        _isFinished = true;
+        return icaltime_null_time();
+    }
+
+    int64_t wallClock = getSlotTime();
+    int64_t days = ICalendarUtils::floorDivide(wallClock, 86400);
+    int64_t seconds = wallClock - days * 86400;
+
+    struct icaltimetype time = _first;
+
+    ICalendarUtils::civilFromDays(days, time.year, time.month, time.day);
+
+    if (!time.is_date)
+    {
+        time.hour = static_cast<int>(seconds / 3600);
+        time.minute = static_cast<int>(seconds / 60 % 60);
+        time.second = static_cast<int>(seconds % 60);
+    }
+
+    // libical ends all rules in 2038 to stay within a 32-bit time_t.
+    if (time.year >= 2038 ||
+        (!icaltime_is_null_time(_until) && icaltime_compare(time, _until) > 0))
+    {
+        _isFinished = true;
+        return icaltime_null_time();
+    }
+
+    advance();
+
+    return time;
+}
+
+
+void ICalendarRecurrenceIterator::seek(const struct icaltimetype& time)
+{
+    struct icaltimetype local = time;
+
+    if (_first.zone && !time.is_date)
+    {
+        local = icaltime_convert_to_zone(time, const_cast<icaltimezone*>(_first.zone));
+    }
+
+    int64_t target = ICalendarUtils::toWallClock(local);
+
+    if (!icaltime_is_null_time(_pending))
+    {
+        if (ICalendarUtils::toWallClock(_pending) >= target)
+        {
+            return;
+        }
+
+        _pending = icaltime_null_time();
+    }
+
+    if (_isFinished)
+    {
+        return;
+    }
+
+    if (PATTERN_LIBICAL == _pattern)
+    {
+        do
+        {
+            _pending = icalrecur_iterator_next(_pIterator);
+        }
+        while (!icaltime_is_null_time(_pending) && ICalendarUtils::toWallClock(_pending) < target);
+
+        _isFinished = icaltime_is_null_time(_pending);
+
+        return;
+    }
+
+    int64_t period = 0;
+
+    switch (_pattern)
+    {
+        case PATTERN_FIXED:
+            period = -ICalendarUtils::floorDivide(_origin - target, _periodLength);
+            break;
+        case PATTERN_WEEKLY:
+            period = ICalendarUtils::floorDivide(target - _origin, _periodLength * 86400);
+            break;
+        case PATTERN_MONTHLY:
+        {
+            int year = 0;
+            int month = 0;
+            int day = 0;
+
+            ICalendarUtils::civilFromDays(ICalendarUtils::floorDivide(target, 86400), year, month, day);
+
+            int64_t months = int64_t(year) * 12 + month - 1;
+
+            period = ICalendarUtils::floorDivide(months - _origin, _periodLength);
+            break;
+        }
+        case PATTERN_LIBICAL:
+            break;
+    }
+
+    if (period > _period)
+    {
+        _period = period;
+        _slot = 0;
+    }
+
+    // The target lies within the current period, so this takes at most one
+    // step per slot.
+    while (getSlotTime() < target)
+    {
+        advance();
+    }
+}
+
+
+bool ICalendarRecurrenceIterator::isSeekable() const
+{
+    return PATTERN_LIBICAL != _pattern;
+}
+
+
+ICalendarRecurrenceIterator::Pattern ICalendarRecurrenceIterator::setup(const struct icalrecurrencetype& rule,
+                                                                        const struct icaltimetype& dtstart)
+{
+    if (rule.interval < 1 ||
+        rule.by_second[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_minute[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_hour[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_year_day[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_week_no[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_month[0] != ICAL_RECURRENCE_ARRAY_MAX ||
+        rule.by_set_pos[0] != ICAL_RECURRENCE_ARRAY_MAX)
+    {
+        return PATTERN_LIBICAL;
+    }
+
+    bool hasDays = rule.by_day[0] != ICAL_RECURRENCE_ARRAY_MAX;
+    bool hasMonthDays = rule.by_month_day[0] != ICAL_RECURRENCE_ARRAY_MAX;
+
+    int64_t unit = 0;
+
+    switch (rule.freq)
+    {
+        case ICAL_SECONDLY_RECURRENCE:
+            unit = 1;
+            break;
+        case ICAL_MINUTELY_RECURRENCE:
+            unit = 60;
+            break;
+        case ICAL_HOURLY_RECURRENCE:
+            unit = 3600;
+            break;
+        case ICAL_DAILY_RECURRENCE:
+            unit = 86400;
+            break;
+        case ICAL_WEEKLY_RECURRENCE:
+            break;
+        case ICAL_MONTHLY_RECURRENCE:
+        {
+            if (hasDays)
+            {
+                return PATTERN_LIBICAL;
+            }
+
+            if (hasMonthDays)
+            {
+                for (int i = 0; i < ICAL_BY_MONTHDAY_SIZE && rule.by_month_day[i] != ICAL_RECURRENCE_ARRAY_MAX; ++i)
+                {
+                    _slots.push_back(rule.by_month_day[i]);
+                }
+            }
+            else
+            {
+                _slots.push_back(dtstart.day);
+            }
+
+            // Days that are missing from some months, days counted from the
+            // end of the month and lists that libical would iterate out of
+            // order are left to libical.
+            if (!isIncreasing(_slots) || _slots.front() < 1 || _slots.back() > 28)
+            {
+                return PATTERN_LIBICAL;
+            }
+
+            _periodLength = rule.interval;
+
+            return PATTERN_MONTHLY;
+        }
+        default:
+            return PATTERN_LIBICAL;
+    }
+
+    if (hasMonthDays)
+    {
+        return PATTERN_LIBICAL;
+    }
+
+    if (unit > 0 && !hasDays)
+    {
+        if (dtstart.is_date && unit < 86400)
+        {
+            return PATTERN_LIBICAL;
+        }
+
+        _periodLength = unit * rule.interval;
+        _slots.push_back(0);
+
+        return PATTERN_FIXED;
+    }
+
+    // A daily rule limited to some weekdays is a weekly rule as long as it
+    // does not skip days.
+    if (unit > 0 && (unit != 86400 || rule.interval != 1))
+    {
+        return PATTERN_LIBICAL;
+    }
+
+    if (hasDays)
+    {
+        for (int i = 0; i < ICAL_BY_DAY_SIZE && rule.by_day[i] != ICAL_RECURRENCE_ARRAY_MAX; ++i)
+        {
+            // Days such as 1MO are positional and left to libical.
+            if (0 != icalrecurrencetype_day_position(rule.by_day[i]))
+            {
+                return PATTERN_LIBICAL;
+            }
+
+            _slots.push_back(icalrecurrencetype_day_day_of_week(rule.by_day[i]) - 1);
+        }
+    }
+    else
+    {
+        _slots.push_back(icaltime_day_of_week(dtstart) - 1);
+    }
+
+    std::sort(_slots.begin(), _slots.end());
+
+    // libical returns repeated days more than once, and aligns the weeks of
+    // rules that skip weeks by WKST once there are several days.
+    if (std::adjacent_find(_slots.begin(), _slots.end()) != _slots.end() ||
+        (0 == unit && rule.interval > 1 && _slots.size() > 1))
+    {
+        return PATTERN_LIBICAL;
+    }
+
+    _periodLength = 7 * (unit > 0 ? 1 : rule.interval);
+
+    return PATTERN_WEEKLY;
+}
+
+
+void ICalendarRecurrenceIterator::anchor(const struct icaltimetype& first)
+{
+    _first = first;
+    _timeOfDay = ICalendarUtils::toWallClock(first) - ICalendarUtils::daysFromCivil(first.year, first.month, first.day) * 86400;
+
+    int key = 0;
+
+    switch (_pattern)
+    {
+        case PATTERN_FIXED:
+            _origin = ICalendarUtils::toWallClock(first);
+            break;
+        case PATTERN_WEEKLY:
+        {
+            // Periods start on the Sunday on or before the first occurrence;
+            // 1970-01-01 was a Thursday.
+            int64_t day = ICalendarUtils::daysFromCivil(first.year, first.month, first.day);
+            key = static_cast<int>(day + 4 - ICalendarUtils::floorDivide(day + 4, 7) * 7);
+            _origin = (day - key) * 86400 + _timeOfDay;
+            break;
+        }
+        case PATTERN_MONTHLY:
+            key = first.day;
+            _origin = int64_t(first.year) * 12 + first.month - 1;
+            break;
+        case PATTERN_LIBICAL:
+            break;
+    }
+
+    // Continue with the first slot after the first occurrence.  For daily
+    // rules limited to some weekdays, libical returns DTSTART first even if
+    // it is not one of them.
+    _period = 0;
+    _slot = std::upper_bound(_slots.begin(), _slots.end(), key) - _slots.begin();
+
+    if (_slot >= _slots.size())
+    {
+        _slot = 0;
+        ++_period;
+    }
+
+    _secondIndex = getSlotIndex();
+}
+
+
+int64_t ICalendarRecurrenceIterator::getSlotIndex() const
+{
+    return _period * static_cast<int64_t>(_slots.size()) + static_cast<int64_t>(_slot);
+}
+
+
+int64_t ICalendarRecurrenceIterator::getSlotTime() const
+{
+    switch (_pattern)
+    {
+        case PATTERN_FIXED:
+            return _origin + _period * _periodLength;
+        case PATTERN_WEEKLY:
+            return _origin + (_period * _periodLength + _slots[_slot]) * 86400;
+        case PATTERN_MONTHLY:
+        {
+            int64_t months = _origin + _period * _periodLength;
+            int64_t year = ICalendarUtils::floorDivide(months, 12);
+            int month = static_cast<int>(months - year * 12) + 1;
+
+            return ICalendarUtils::daysFromCivil(static_cast<int>(year), month, _slots[_slot]) * 86400 + _timeOfDay;
+        }
+        case PATTERN_LIBICAL:
+            break;
+    }
+
+    return 0;
+}
+
+
+void ICalendarRecurrenceIterator::advance()
+{
+    if (++_slot >= _slots.size())
+    {
+        _slot = 0;
+        ++_period;
+    }
+}
+
+
+bool ICalendarRecurrenceIterator::isIncreasing(const std::vector<int>& values)
+{
+    for (std::size_t i = 1; i < values.size(); ++i)
+    {
+        if (values[i - 1] >= values[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+} } // namespace ofx::Time
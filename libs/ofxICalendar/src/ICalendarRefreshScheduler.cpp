@@ -0,0 +1,272 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarRefreshScheduler.h"
+#include <exception>
+#include <limits>
+#include "Poco/ScopedUnlock.h"
+#include "Poco/Timespan.h"
+#include "ofLog.h"
+#include "ofx/Time/ICalendar.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarRefreshScheduler::ICalendarRefreshScheduler(std::size_t numWorkers):
+    _numWorkers(numWorkers > 0 ? numWorkers : 1),
+    _nextTicket(0),
+    _stopping(false)
+{
+}
+
+
+ICalendarRefreshScheduler::~ICalendarRefreshScheduler()
+{
+    {
+        Poco::Mutex::ScopedLock lock(_mutex);
+        _stopping = true;
+        _condition.broadcast();
+    }
+
+    for (std::size_t i = 0; i < _workers.size(); ++i)
+    {
+        _workers[i]->join();
+        delete _workers[i];
+    }
+}
+
+
+void ICalendarRefreshScheduler::schedule(ICalendar* pCalendar,
+                                         unsigned long long interval,
+                                         bool immediately)
+{
+    if (0 == interval)
+    {
+        unschedule(pCalendar);
+        return;
+    }
+
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    Registrations::iterator iter = _registrations.find(pCalendar);
+
+    if (iter == _registrations.end())
+    {
+        Registration registration;
+        registration.ticket = 0;
+        registration.running = false;
+        iter = _registrations.insert(std::make_pair(pCalendar, registration)).first;
+    }
+
+    Registration& registration = iter->second;
+
+    registration.interval = interval;
+    registration.deadline = Poco::Timestamp();
+
+    if (!immediately)
+    {
+        registration.deadline += interval * Poco::Timespan::MILLISECONDS;
+    }
+
+    if (registration.running)
+    {
+        // The worker pushes the new deadline when it is done.
+        registration.ticket = ++_nextTicket;
+    }
+    else
+    {
+        push(pCalendar, registration);
+    }
+
+    startWorkers();
+
+    _condition.broadcast();
+}
+
+
+void ICalendarRefreshScheduler::unschedule(ICalendar* pCalendar)
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    Registrations::iterator iter = _registrations.find(pCalendar);
+
+    while (iter != _registrations.end() && iter->second.running)
+    {
+        _condition.wait(_mutex);
+        iter = _registrations.find(pCalendar);
+    }
+
+    if (iter != _registrations.end())
+    {
+        // The heap entry is discarded when it reaches the top.
+        _registrations.erase(iter);
+    }
+}
+
+
+bool ICalendarRefreshScheduler::isScheduled(ICalendar* pCalendar) const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    return _registrations.find(pCalendar) != _registrations.end();
+}
+
+
+std::size_t ICalendarRefreshScheduler::getNumScheduled() const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    return _registrations.size();
+}
+
+
+std::size_t ICalendarRefreshScheduler::getNumWorkers() const
+{
+    return _numWorkers;
+}
+
+
+void ICalendarRefreshScheduler::run()
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    while (!_stopping)
+    {
+        if (_deadlines.empty())
+        {
+            _condition.wait(_mutex);
+            continue;
+        }
+
+        Deadline next = _deadlines.top();
+
+        Registrations::iterator iter = _registrations.find(next.pCalendar);
+
+        if (iter == _registrations.end()
+        ||  iter->second.ticket != next.ticket
+        ||  iter->second.running)
+        {
+            // Unscheduled, rescheduled or already being reloaded.
+            _deadlines.pop();
+            continue;
+        }
+
+        Poco::Timestamp now;
+
+        if (now < next.deadline)
+        {
+            Poco::Timestamp::TimeDiff wait = (next.deadline - now + 999) / Poco::Timespan::MILLISECONDS;
+
+            if (wait > std::numeric_limits<long>::max())
+            {
+                wait = std::numeric_limits<long>::max();
+            }
+
+            _condition.tryWait(_mutex, static_cast<long>(wait));
+            continue;
+        }
+
+        _deadlines.pop();
+
+        iter->second.running = true;
+
+        {
+            Poco::ScopedUnlock<Poco::Mutex> unlock(_mutex);
+
+            try
+            {
+                next.pCalendar->reload();
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("ICalendarRefreshScheduler::run()") << exc.what();
+            }
+        }
+
+        // The registration can not have been erased, because unschedule()
+        // waits while it is running.
+        iter = _registrations.find(next.pCalendar);
+
+        Registration& registration = iter->second;
+
+        registration.running = false;
+
+        if (registration.ticket == next.ticket)
+        {
+            registration.deadline = Poco::Timestamp() + registration.interval * Poco::Timespan::MILLISECONDS;
+        }
+
+        // Otherwise it was rescheduled while running and keeps its new
+        // deadline.
+        push(next.pCalendar, registration);
+
+        _condition.broadcast();
+    }
+}
+
+
+ICalendarRefreshScheduler::SharedPtr ICalendarRefreshScheduler::getDefault()
+{
+    static SharedPtr scheduler(new ICalendarRefreshScheduler());
+    return scheduler;
+}
+
+
+bool ICalendarRefreshScheduler::Deadline::operator > (const Deadline& other) const
+{
+    return deadline > other.deadline;
+}
+
+
+void ICalendarRefreshScheduler::push(ICalendar* pCalendar,
+                                     Registration& registration)
+{
+    registration.ticket = ++_nextTicket;
+
+    Deadline entry;
+    entry.deadline = registration.deadline;
+    entry.pCalendar = pCalendar;
+    entry.ticket = registration.ticket;
+
+    _deadlines.push(entry);
+}
+
+
+void ICalendarRefreshScheduler::startWorkers()
+{
+    if (_workers.empty())
+    {
+        for (std::size_t i = 0; i < _numWorkers; ++i)
+        {
+            Poco::Thread* pThread = new Poco::Thread("ICalendarRefreshScheduler");
+            pThread->start(*this);
+            _workers.push_back(pThread);
+        }
+    }
+}
+
+
+} } // namespace ofx::Time
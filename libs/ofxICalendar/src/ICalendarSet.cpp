@@ -0,0 +1,328 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarSet.h"
+#include <algorithm>
+#include <limits>
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarSet::ICalendarSet()
+{
+}
+
+
+ICalendarSet::~ICalendarSet()
+{
+}
+
+
+void ICalendarSet::add(ICalendar::SharedPtr calendar)
+{
+    if (!calendar)
+    {
+        ofLogError("ICalendarSet::add()") << "Calendar is null.";
+        return;
+    }
+
+    ofScopedLock lock(_mutex);
+
+    if (std::find(_calendars.begin(), _calendars.end(), calendar) == _calendars.end())
+    {
+        _calendars.push_back(calendar);
+    }
+}
+
+
+bool ICalendarSet::remove(ICalendar::SharedPtr calendar)
+{
+    ofScopedLock lock(_mutex);
+
+    Calendars::iterator iter = std::find(_calendars.begin(), _calendars.end(), calendar);
+
+    if (iter == _calendars.end())
+    {
+        return false;
+    }
+
+    _bounds.erase(iter->get());
+    _calendars.erase(iter);
+    return true;
+}
+
+
+void ICalendarSet::clear()
+{
+    ofScopedLock lock(_mutex);
+    _calendars.clear();
+    _bounds.clear();
+}
+
+
+ICalendarSet::Calendars ICalendarSet::getCalendars() const
+{
+    ofScopedLock lock(_mutex);
+    return _calendars;
+}
+
+
+std::size_t ICalendarSet::size() const
+{
+    ofScopedLock lock(_mutex);
+    return _calendars.size();
+}
+
+
+bool ICalendarSet::empty() const
+{
+    ofScopedLock lock(_mutex);
+    return _calendars.empty();
+}
+
+
+void ICalendarSet::setAutoRefreshInterval(unsigned long long autoRefreshInterval)
+{
+    Calendars calendars = getCalendars();
+
+    Calendars::iterator iter = calendars.begin();
+
+    while (iter != calendars.end())
+    {
+        (*iter)->setAutoRefreshInterval(autoRefreshInterval);
+        ++iter;
+    }
+}
+
+
+ICalendar::EventInstances ICalendarSet::getEventInstances(const Interval& interval) const
+{
+    Calendars calendars = getCalendars();
+
+    int64_t start = interval.getStart().epochTime();
+    int64_t end = interval.getEnd().epochTime();
+
+    // Each calendar is queried on its own, without holding _mutex.
+    std::vector<ICalendar::EventInstances> results(calendars.size());
+    std::vector<Stream> streams;
+    streams.reserve(calendars.size());
+    std::size_t total = 0;
+
+    for (std::size_t i = 0; i < calendars.size(); ++i)
+    {
+        ICalendarSnapshot::SharedPtr snapshot = calendars[i]->getSnapshot();
+
+        if (!snapshot)
+        {
+            continue;
+        }
+
+        Bounds bounds = getBounds(calendars[i].get(), *snapshot);
+
+        if (bounds.isEmpty || bounds.end < start || bounds.start > end)
+        {
+            continue;
+        }
+
+        ICalendar::EventInstances& instances = results[i];
+
+        instances = calendars[i]->getEventInstances(interval);
+
+        if (instances.empty())
+        {
+            continue;
+        }
+
+        // Instances from the instance index are already sorted, but those
+        // expanded row by row are in document order.
+        if (!std::is_sorted(instances.begin(), instances.end(), compareStart))
+        {
+            std::stable_sort(instances.begin(), instances.end(), compareStart);
+        }
+
+        Stream stream;
+        stream.pInstances = &instances;
+        stream.position = 0;
+        stream.start = instances[0].getInterval().getStart();
+        stream.calendar = i;
+
+        streams.push_back(stream);
+
+        total += instances.size();
+    }
+
+    ICalendar::EventInstances merged;
+    merged.reserve(total);
+
+    std::make_heap(streams.begin(), streams.end(), compareStreams);
+
+    while (!streams.empty())
+    {
+        std::pop_heap(streams.begin(), streams.end(), compareStreams);
+
+        Stream& stream = streams.back();
+
+        merged.push_back((*stream.pInstances)[stream.position]);
+
+        if (++stream.position < stream.pInstances->size())
+        {
+            stream.start = (*stream.pInstances)[stream.position].getInterval().getStart();
+            std::push_heap(streams.begin(), streams.end(), compareStreams);
+        }
+        else
+        {
+            streams.pop_back();
+        }
+    }
+
+    return merged;
+}
+
+
+ICalendar::EventInstances ICalendarSet::getEventInstances(const Poco::Timestamp& timestamp) const
+{
+    return getEventInstances(Interval(timestamp, timestamp));
+}
+
+
+ICalendarSet::Bounds ICalendarSet::getBounds(const ICalendar* pCalendar,
+                                             const ICalendarSnapshot& snapshot) const
+{
+    {
+        ofScopedLock lock(_mutex);
+
+        BoundsCache::const_iterator iter = _bounds.find(pCalendar);
+
+        if (iter != _bounds.end() && iter->second.generation == snapshot.getGeneration())
+        {
+            return iter->second;
+        }
+    }
+
+    Bounds bounds = computeBounds(snapshot);
+
+    ofScopedLock lock(_mutex);
+
+    // The calendar may have been removed while the bounds were computed.
+    Calendars::const_iterator iter = _calendars.begin();
+
+    while (iter != _calendars.end())
+    {
+        if (iter->get() == pCalendar)
+        {
+            _bounds[pCalendar] = bounds;
+            break;
+        }
+
+        ++iter;
+    }
+
+    return bounds;
+}
+
+
+ICalendarSet::Bounds ICalendarSet::computeBounds(const ICalendarSnapshot& snapshot)
+{
+    const int64_t MIN_TIME = std::numeric_limits<int64_t>::min();
+    const int64_t MAX_TIME = std::numeric_limits<int64_t>::max();
+
+    Bounds bounds;
+    bounds.generation = snapshot.getGeneration();
+    bounds.start = MAX_TIME;
+    bounds.end = MIN_TIME;
+    bounds.isEmpty = true;
+
+    const CompiledCalendar& compiled = snapshot.getCompiledCalendar();
+
+    // RDATE lookups walk the libical tree.
+    Poco::Mutex::ScopedLock lock(snapshot.getMutex());
+
+    for (std::size_t row = 0; row < compiled.size(); ++row)
+    {
+        // Rows without a UID are never expanded.
+        if (compiled.isRemoved(row) || 0 == compiled.getUIDLength(row))
+        {
+            continue;
+        }
+
+        bounds.isEmpty = false;
+
+        if (0 == compiled.getStart(row))
+        {
+            // Events without a valid DTSTART are not bounded.
+            bounds.start = MIN_TIME;
+            bounds.end = MAX_TIME;
+            break;
+        }
+
+        int64_t eventStart = Poco::Timestamp(compiled.getStart(row)).epochTime();
+        int64_t eventEnd = 0 == compiled.getEnd(row) ? eventStart : Poco::Timestamp(compiled.getEnd(row)).epochTime();
+
+        int64_t low = std::min(eventStart, eventEnd) - BOUNDS_MARGIN;
+        int64_t high = std::max(eventStart, eventEnd) + BOUNDS_MARGIN;
+
+        if (compiled.hasRecurrence(row))
+        {
+            high = MAX_TIME;
+
+            if (icalcomponent_get_first_property(compiled.getComponent(row),
+                                                 ICAL_RDATE_PROPERTY))
+            {
+                low = MIN_TIME;
+            }
+        }
+
+        bounds.start = std::min(bounds.start, low);
+        bounds.end = std::max(bounds.end, high);
+    }
+
+    return bounds;
+}
+
+
+bool ICalendarSet::compareStart(const ICalendarEventInstance& lhs,
+                                const ICalendarEventInstance& rhs)
+{
+    return lhs.getInterval().getStart() < rhs.getInterval().getStart();
+}
+
+
+bool ICalendarSet::compareStreams(const Stream& lhs, const Stream& rhs)
+{
+    // std::make_heap() builds a max-heap, so the order is reversed.
+    if (lhs.start != rhs.start)
+    {
+        return lhs.start > rhs.start;
+    }
+
+    return lhs.calendar > rhs.calendar;
+}
+
+
+} } // namespace ofx::Time
@@ -0,0 +1,150 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+#include "ofx/Time/ICalendarSnapshot.h"
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+std::atomic<uint64_t> ICalendarSnapshot::_nextGeneration(1);
+
+
+ICalendarSnapshot::ICalendarSnapshot(icalcomponent* pCalendar,
+                                     icalcomponent* pTimezones,
+                                     CompiledCalendar& compiled,
+                                     const ICalendarChangeSet& changes):
+    _pCalendar(pCalendar),
+    _pTimezones(pTimezones),
+    _changes(changes),
+    _generation(_nextGeneration++),
+    _preparedYear(0)
+{
+    _compiled.swap(compiled);
+}
+
+
+ICalendarSnapshot::~ICalendarSnapshot()
+{
+    // libical frees a component with its subcomponents and refuses to free
+    // a subcomponent on its own.
+    if (_pTimezones)
+    {
+        icalcomponent_free(_pTimezones);
+        _pTimezones = 0;
+        _pCalendar = 0;
+    }
+    else if (_pCalendar)
+    {
+        icalcomponent_free(_pCalendar);
+        _pCalendar = 0;
+    }
+}
+
+
+icalcomponent* ICalendarSnapshot::getComponent() const
+{
+    return _pCalendar;
+}
+
+
+icalcomponent* ICalendarSnapshot::getTimezones() const
+{
+    return _pTimezones;
+}
+
+
+const CompiledCalendar& ICalendarSnapshot::getCompiledCalendar() const
+{
+    return _compiled;
+}
+
+
+const ICalendarChangeSet& ICalendarSnapshot::getChangeSet() const
+{
+    return _changes;
+}
+
+
+uint64_t ICalendarSnapshot::getGeneration() const
+{
+    return _generation;
+}
+
+
+ICalendarSnapshot::InstanceIndexPtr ICalendarSnapshot::getInstanceIndex() const
+{
+    return std::atomic_load(&_instanceIndex);
+}
+
+
+void ICalendarSnapshot::setInstanceIndex(InstanceIndexPtr instanceIndex) const
+{
+    std::atomic_store(&_instanceIndex, instanceIndex);
+}
+
+
+ICalendarRecurrenceCache& ICalendarSnapshot::getRecurrenceCache() const
+{
+    return _recurrenceCache;
+}
+
+
+void ICalendarSnapshot::prepareExpansion(int64_t end) const
+{
+    icaltimezone* pUTC = icaltimezone_get_utc_timezone();
+
+    int year = icaltime_from_timet_with_zone(static_cast<time_t>(end + ICalendarRecurrenceCache::DEFAULT_HORIZON),
+                                             0,
+                                             pUTC).year;
+
+    if (year <= _preparedYear)
+    {
+        return;
+    }
+
+    _recurrenceCache.prepare(_compiled);
+
+    for (std::size_t row = 0; row < _compiled.size(); ++row)
+    {
+        if (!_compiled.isRemoved(row))
+        {
+            ICalendarUtils::prepareTimezones(_compiled.getComponent(row), year);
+        }
+    }
+
+    _preparedYear = year;
+}
+
+
+Poco::Mutex& ICalendarSnapshot::getMutex() const
+{
+    return _mutex;
+}
+
+
+} } // namespace ofx::Time
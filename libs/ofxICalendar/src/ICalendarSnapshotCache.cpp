@@ -0,0 +1,752 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarSnapshotCache.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "ofLog.h"
+#include "ofx/Time/ICalendarParser.h"
+#include "ofx/Time/ICalendarWriter.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+const char ICalendarSnapshotCache::MAGIC[8] = { 'o', 'f', 'x', 'I', 'C', 'S', '\0', '\0' };
+const uint64_t ICalendarSnapshotCache::NO_RECORD = ~uint64_t(0);
+
+
+ICalendarSnapshotCache::Validators::Validators():
+    hash(0),
+    hasHash(false)
+{
+}
+
+
+bool ICalendarSnapshotCache::save(const std::string& path,
+                                  const ICalendarSnapshot& snapshot,
+                                  const Validators& validators)
+{
+    const CompiledCalendar& compiled = snapshot.getCompiledCalendar();
+
+    std::vector<char> text;
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.entityTag = append(text, validators.entityTag);
+    header.httpLastModified = append(text, validators.lastModified);
+
+    if (!snapshot.getComponent())
+    {
+        ofLogError("ICalendarSnapshotCache::save()") << "The snapshot has no calendar.";
+        return false;
+    }
+
+    // The resolved VTIMEZONEs are few and small, so they are wrapped in a
+    // VCALENDAR of their own in the text pool.
+    std::string resolvedTimezones;
+
+    if (snapshot.getTimezones())
+    {
+        Poco::Mutex::ScopedLock lock(snapshot.getMutex());
+
+        resolvedTimezones = "BEGIN:VCALENDAR\r\n";
+
+        icalcomponent* pTimezone = icalcomponent_get_first_component(snapshot.getTimezones(),
+                                                                     ICAL_VTIMEZONE_COMPONENT);
+
+        while (pTimezone)
+        {
+            resolvedTimezones += icalcomponent_as_ical_string(pTimezone);
+            pTimezone = icalcomponent_get_next_component(snapshot.getTimezones(),
+                                                         ICAL_VTIMEZONE_COMPONENT);
+        }
+
+        resolvedTimezones += "END:VCALENDAR\r\n";
+    }
+
+    header.resolvedTimezones = append(text, resolvedTimezones);
+
+    // Rows are written without the removed ones and in the document order
+    // of the VEVENTs that load() parses.  merge() appends rows, so the row
+    // order of a merged table can differ from the document order.
+    std::vector<uint64_t> rowMap(compiled.size(), NO_RECORD);
+    std::vector<std::size_t> order;
+
+    {
+        std::unordered_map<const icalcomponent*, std::size_t> rowsByComponent;
+
+        for (std::size_t row = 0; row < compiled.size(); ++row)
+        {
+            if (!compiled.isRemoved(row))
+            {
+                rowsByComponent[compiled.getComponent(row)] = row;
+            }
+        }
+
+        order.reserve(rowsByComponent.size());
+
+        Poco::Mutex::ScopedLock lock(snapshot.getMutex());
+
+        icalcomponent* pComponent = icalcomponent_get_first_component(snapshot.getComponent(),
+                                                                      ICAL_VEVENT_COMPONENT);
+
+        while (pComponent)
+        {
+            std::unordered_map<const icalcomponent*, std::size_t>::const_iterator iter = rowsByComponent.find(pComponent);
+
+            if (iter != rowsByComponent.end())
+            {
+                rowMap[iter->second] = order.size();
+                order.push_back(iter->second);
+            }
+
+            pComponent = icalcomponent_get_next_component(snapshot.getComponent(),
+                                                          ICAL_VEVENT_COMPONENT);
+        }
+    }
+
+    uint64_t numRows = order.size();
+
+    // Each TZID that was looked up gets its own record.
+    std::vector<Timezone> timezones;
+    std::vector<Transition> transitions;
+    std::map<const ICalendarTimezoneTable*, int32_t> timezoneIndexes;
+
+    CompiledCalendar::TimezoneTables::const_iterator tableIter = compiled._timezoneTables.begin();
+
+    while (tableIter != compiled._timezoneTables.end())
+    {
+        const ICalendarTimezoneTable* pTable = tableIter->second.get();
+
+        if (pTable)
+        {
+            Timezone timezone;
+            timezone.tzid = append(text, tableIter->first);
+            timezone.firstTransition = static_cast<uint32_t>(transitions.size());
+            timezone.numTransitions = static_cast<uint32_t>(pTable->getTransitions().size());
+            timezone.localStart = pTable->getLocalStart();
+            timezone.firstYear = pTable->getFirstYear();
+            timezone.lastYear = pTable->getLastYear();
+            timezone.offset = pTable->getInitialOffset();
+            timezone.isDaylight = pTable->isInitiallyDaylight() ? 1 : 0;
+
+            timezoneIndexes.insert(std::make_pair(pTable, static_cast<int32_t>(timezones.size())));
+            timezones.push_back(timezone);
+
+            ICalendarTimezoneTable::Transitions::const_iterator transitionIter = pTable->getTransitions().begin();
+
+            while (transitionIter != pTable->getTransitions().end())
+            {
+                Transition transition;
+                transition.time = transitionIter->time;
+                transition.offset = transitionIter->offset;
+                transition.previousOffset = transitionIter->previousOffset;
+                transition.flags = (transitionIter->isDaylight ? IS_DAYLIGHT : 0) |
+                                   (transitionIter->wasDaylight ? WAS_DAYLIGHT : 0);
+                transition.reserved = 0;
+
+                transitions.push_back(transition);
+
+                ++transitionIter;
+            }
+        }
+
+        ++tableIter;
+    }
+
+    std::vector<Row> rows;
+    rows.reserve(numRows);
+
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        std::size_t row = order[i];
+        std::size_t nextRow = compiled._nextRows[row];
+
+        std::map<const ICalendarTimezoneTable*, int32_t>::const_iterator timezoneIter = timezoneIndexes.find(compiled._timezones[row].get());
+
+        Row record;
+        std::memset(&record, 0, sizeof(record));
+        record.uid = compiled._uids[row];
+        record.uidLength = compiled._uidLengths[row];
+        record.summary = compiled._summaries[row];
+        record.location = compiled._locations[row];
+        record.start = compiled._starts[row];
+        record.end = compiled._ends[row];
+        record.lastModified = compiled._lastModifieds[row];
+        record.recurrenceID = compiled._recurrenceIDs[row];
+        record.nextRow = nextRow < rowMap.size() ? rowMap[nextRow] : NO_RECORD;
+        record.sequence = compiled._sequences[row];
+        record.timezone = timezoneIter != timezoneIndexes.end() ? timezoneIter->second : -1;
+        record.flags = compiled._recurrences[row] ? HAS_RECURRENCE : 0;
+
+        rows.push_back(record);
+    }
+
+    std::vector<Instance> instances;
+
+    ICalendarSnapshot::InstanceIndexPtr instanceIndex = snapshot.getInstanceIndex();
+
+    if (instanceIndex && instanceIndex->isBuilt())
+    {
+        ICalendarInstanceIndex::Instances renumbered;
+        renumbered.reserve(instanceIndex->size());
+
+        ICalendarInstanceIndex::Instances::const_iterator iter = instanceIndex->_instances.begin();
+
+        while (iter != instanceIndex->_instances.end())
+        {
+            if (iter->row < rowMap.size() && NO_RECORD != rowMap[iter->row])
+            {
+                ICalendarInstanceIndex::Instance instance = *iter;
+                instance.row = static_cast<std::size_t>(rowMap[iter->row]);
+                renumbered.push_back(instance);
+            }
+
+            ++iter;
+        }
+
+        // Renumbering may reorder instances with equal starts.
+        std::stable_sort(renumbered.begin(),
+                         renumbered.end(),
+                         &ICalendarInstanceIndex::compareStart);
+
+        instances.reserve(renumbered.size());
+
+        iter = renumbered.begin();
+
+        while (iter != renumbered.end())
+        {
+            Instance instance;
+            instance.start = iter->start;
+            instance.end = iter->end;
+            instance.row = iter->row;
+            instances.push_back(instance);
+
+            ++iter;
+        }
+
+        header.flags |= HAS_INSTANCE_INDEX;
+        header.horizonStart = instanceIndex->getHorizon().getStart().epochMicroseconds();
+        header.horizonEnd = instanceIndex->getHorizon().getEnd().epochMicroseconds();
+    }
+
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.byteOrder = 0x01020304;
+    header.flags |= validators.hasHash ? HAS_HASH : 0;
+    header.numTimezones = static_cast<uint32_t>(timezones.size());
+    header.numTransitions = static_cast<uint32_t>(transitions.size());
+    header.numRows = rows.size();
+    header.numInstances = instances.size();
+    header.contentHash = validators.hash;
+    header.lastModified = compiled.getLastModified();
+    header.rowsOffset = sizeof(Header);
+    header.instancesOffset = header.rowsOffset + rows.size() * sizeof(Row);
+    header.timezonesOffset = header.instancesOffset + instances.size() * sizeof(Instance);
+    header.transitionsOffset = header.timezonesOffset + timezones.size() * sizeof(Timezone);
+    header.stringsOffset = header.transitionsOffset + transitions.size() * sizeof(Transition);
+    header.stringsSize = compiled._strings.size();
+    header.textOffset = header.stringsOffset + header.stringsSize;
+
+    // The calendar text ends the text pool.  It is streamed to the file and
+    // its size is filled in afterwards.
+    header.calendar = text.size();
+
+    // Write a temporary file and rename it, so that a file being loaded is
+    // never truncated.
+    std::string temporaryPath = path + ".tmp";
+
+    try
+    {
+        Poco::FileOutputStream stream(temporaryPath,
+                                      std::ios::out | std::ios::binary | std::ios::trunc);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        if (!rows.empty())
+        {
+            stream.write(reinterpret_cast<const char*>(&rows[0]), rows.size() * sizeof(Row));
+        }
+
+        if (!instances.empty())
+        {
+            stream.write(reinterpret_cast<const char*>(&instances[0]),
+                         instances.size() * sizeof(Instance));
+        }
+
+        if (!timezones.empty())
+        {
+            stream.write(reinterpret_cast<const char*>(&timezones[0]),
+                         timezones.size() * sizeof(Timezone));
+        }
+
+        if (!transitions.empty())
+        {
+            stream.write(reinterpret_cast<const char*>(&transitions[0]),
+                         transitions.size() * sizeof(Transition));
+        }
+
+        stream.write(&compiled._strings[0], compiled._strings.size());
+        stream.write(&text[0], text.size());
+
+        std::streampos calendarStart = stream.tellp();
+
+        {
+            Poco::Mutex::ScopedLock lock(snapshot.getMutex());
+            ICalendarWriter::write(stream, snapshot.getComponent());
+        }
+
+        header.calendarSize = static_cast<uint64_t>(stream.tellp() - calendarStart);
+        header.textSize = text.size() + header.calendarSize + 1;
+
+        stream.put('\0');
+        stream.seekp(0);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.close();
+
+        if (!stream.good())
+        {
+            ofLogError("ICalendarSnapshotCache::save()") << "File: " << temporaryPath << " could not be written.";
+            Poco::File(temporaryPath).remove();
+            return false;
+        }
+
+        Poco::File(temporaryPath).renameTo(path);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("ICalendarSnapshotCache::save()") << exc.displayText();
+        return false;
+    }
+
+    return true;
+}
+
+
+ICalendarSnapshot::SharedPtr ICalendarSnapshotCache::load(const std::string& path,
+                                                          Validators& validators)
+{
+    MappedFile file;
+
+    if (!Poco::File(path).exists())
+    {
+        ofLogVerbose("ICalendarSnapshotCache::load()") << "File: " << path << " does not exist.";
+        return ICalendarSnapshot::SharedPtr();
+    }
+
+    if (!file.open(path))
+    {
+        ofLogError("ICalendarSnapshotCache::load()") << "File: " << path << " could not be opened.";
+        return ICalendarSnapshot::SharedPtr();
+    }
+
+    if (!validate(file))
+    {
+        ofLogError("ICalendarSnapshotCache::load()") << "File: " << path << " is not a snapshot cache written on this platform.";
+        return ICalendarSnapshot::SharedPtr();
+    }
+
+    const Header* pHeader = reinterpret_cast<const Header*>(file.getData());
+    const char* pText = file.getData() + pHeader->textOffset;
+
+    ICalendarParser parser;
+    parser.parse(pText + pHeader->calendar, pHeader->calendarSize);
+
+    icalcomponent* pCalendar = parser.finish();
+
+    if (!pCalendar || ICAL_VCALENDAR_COMPONENT != icalcomponent_isa(pCalendar))
+    {
+        ofLogError("ICalendarSnapshotCache::load()") << "File: " << path << " has no VCALENDAR.";
+
+        if (pCalendar)
+        {
+            icalcomponent_free(pCalendar);
+        }
+
+        return ICalendarSnapshot::SharedPtr();
+    }
+
+    icalcomponent* pTimezones = 0;
+
+    if ('\0' != pText[pHeader->resolvedTimezones])
+    {
+        ICalendarParser timezoneParser;
+        timezoneParser.parse(pText + pHeader->resolvedTimezones,
+                             std::strlen(pText + pHeader->resolvedTimezones));
+
+        pTimezones = timezoneParser.finish();
+
+        if (!pTimezones || ICAL_VCALENDAR_COMPONENT != icalcomponent_isa(pTimezones))
+        {
+            ofLogError("ICalendarSnapshotCache::load()") << "File: " << path << " has invalid VTIMEZONEs.";
+
+            if (pTimezones)
+            {
+                icalcomponent_free(pTimezones);
+            }
+
+            icalcomponent_free(pCalendar);
+            return ICalendarSnapshot::SharedPtr();
+        }
+
+        icalcomponent_add_component(pTimezones, pCalendar);
+    }
+
+    CompiledCalendar compiled;
+
+    if (!restore(file, pCalendar, compiled))
+    {
+        ofLogError("ICalendarSnapshotCache::load()") << "File: " << path << " has a calendar that does not match its rows.";
+        icalcomponent_free(pTimezones ? pTimezones : pCalendar);
+        return ICalendarSnapshot::SharedPtr();
+    }
+
+    ICalendarChangeSet changes;
+    changes.replaced = true;
+
+    ICalendarSnapshot::SharedPtr snapshot(new ICalendarSnapshot(pCalendar,
+                                                                pTimezones,
+                                                                compiled,
+                                                                changes));
+
+    if (pHeader->flags & HAS_INSTANCE_INDEX)
+    {
+        std::shared_ptr<ICalendarInstanceIndex> index = std::make_shared<ICalendarInstanceIndex>();
+        restore(file, *index);
+        snapshot->setInstanceIndex(index);
+    }
+
+    validators.hash = pHeader->contentHash;
+    validators.hasHash = 0 != (pHeader->flags & HAS_HASH);
+    validators.entityTag = pText + pHeader->entityTag;
+    validators.lastModified = pText + pHeader->httpLastModified;
+
+    return snapshot;
+}
+
+
+bool ICalendarSnapshotCache::validate(const MappedFile& file)
+{
+    const char* pData = file.getData();
+    std::size_t size = file.size();
+
+    if (!pData ||
+        size < sizeof(Header) ||
+        0 != reinterpret_cast<uintptr_t>(pData) % sizeof(int64_t))
+    {
+        return false;
+    }
+
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+
+    if (0 != std::memcmp(pHeader->magic, MAGIC, sizeof(MAGIC)) ||
+        VERSION != pHeader->version ||
+        0x01020304 != pHeader->byteOrder ||
+        0 != pHeader->rowsOffset % sizeof(int64_t) ||
+        0 != pHeader->instancesOffset % sizeof(int64_t) ||
+        0 != pHeader->timezonesOffset % sizeof(int64_t) ||
+        0 != pHeader->transitionsOffset % sizeof(int64_t) ||
+        pHeader->rowsOffset > size ||
+        pHeader->numRows > (size - pHeader->rowsOffset) / sizeof(Row) ||
+        pHeader->instancesOffset > size ||
+        pHeader->numInstances > (size - pHeader->instancesOffset) / sizeof(Instance) ||
+        pHeader->timezonesOffset > size ||
+        pHeader->numTimezones > (size - pHeader->timezonesOffset) / sizeof(Timezone) ||
+        pHeader->transitionsOffset > size ||
+        pHeader->numTransitions > (size - pHeader->transitionsOffset) / sizeof(Transition) ||
+        pHeader->stringsOffset > size ||
+        pHeader->stringsSize > size - pHeader->stringsOffset ||
+        0 == pHeader->stringsSize ||
+        '\0' != pData[pHeader->stringsOffset] ||
+        '\0' != pData[pHeader->stringsOffset + pHeader->stringsSize - 1] ||
+        pHeader->textOffset > size ||
+        pHeader->textSize > size - pHeader->textOffset ||
+        0 == pHeader->textSize ||
+        '\0' != pData[pHeader->textOffset + pHeader->textSize - 1] ||
+        pHeader->entityTag >= pHeader->textSize ||
+        pHeader->httpLastModified >= pHeader->textSize ||
+        pHeader->resolvedTimezones >= pHeader->textSize ||
+        pHeader->calendar >= pHeader->textSize ||
+        pHeader->calendarSize >= pHeader->textSize - pHeader->calendar)
+    {
+        return false;
+    }
+
+    const Row* pRows = reinterpret_cast<const Row*>(pData + pHeader->rowsOffset);
+
+    for (uint64_t i = 0; i < pHeader->numRows; ++i)
+    {
+        const Row& row = pRows[i];
+
+        if (row.uid >= pHeader->stringsSize ||
+            row.uidLength >= pHeader->stringsSize - row.uid ||
+            row.summary >= pHeader->stringsSize ||
+            row.location >= pHeader->stringsSize ||
+            (row.nextRow != NO_RECORD && row.nextRow >= pHeader->numRows) ||
+            row.timezone < -1 ||
+            (row.timezone >= 0 && uint32_t(row.timezone) >= pHeader->numTimezones))
+        {
+            return false;
+        }
+    }
+
+    const Instance* pInstances = reinterpret_cast<const Instance*>(pData + pHeader->instancesOffset);
+
+    for (uint64_t i = 0; i < pHeader->numInstances; ++i)
+    {
+        if (pInstances[i].row >= pHeader->numRows)
+        {
+            return false;
+        }
+    }
+
+    const Timezone* pTimezones = reinterpret_cast<const Timezone*>(pData + pHeader->timezonesOffset);
+
+    for (uint32_t i = 0; i < pHeader->numTimezones; ++i)
+    {
+        const Timezone& timezone = pTimezones[i];
+
+        if (timezone.tzid >= pHeader->textSize ||
+            timezone.firstTransition > pHeader->numTransitions ||
+            timezone.numTransitions > pHeader->numTransitions - timezone.firstTransition)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool ICalendarSnapshotCache::restore(const MappedFile& file,
+                                     icalcomponent* pCalendar,
+                                     CompiledCalendar& compiled)
+{
+    const char* pData = file.getData();
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+    const Row* pRows = reinterpret_cast<const Row*>(pData + pHeader->rowsOffset);
+    const Timezone* pTimezones = reinterpret_cast<const Timezone*>(pData + pHeader->timezonesOffset);
+    const Transition* pTransitions = reinterpret_cast<const Transition*>(pData + pHeader->transitionsOffset);
+    const char* pStrings = pData + pHeader->stringsOffset;
+    const char* pText = pData + pHeader->textOffset;
+
+    std::size_t count = static_cast<std::size_t>(pHeader->numRows);
+
+    compiled.clear();
+    compiled._components.reserve(count);
+
+    // Rows were written in the document order of the VEVENTs.
+    icalcomponent* pComponent = icalcomponent_get_first_component(pCalendar,
+                                                                  ICAL_VEVENT_COMPONENT);
+
+    while (pComponent)
+    {
+        std::size_t row = compiled._components.size();
+
+        if (row == count)
+        {
+            return false;
+        }
+
+        const char* pUID = CompiledCalendar::getUID(pComponent);
+        std::size_t length = pUID ? std::strlen(pUID) : 0;
+
+        if (length != pRows[row].uidLength ||
+            0 != std::strncmp(pUID ? pUID : "", pStrings + pRows[row].uid, length))
+        {
+            return false;
+        }
+
+        compiled._components.push_back(pComponent);
+
+        pComponent = icalcomponent_get_next_component(pCalendar,
+                                                      ICAL_VEVENT_COMPONENT);
+    }
+
+    if (compiled._components.size() != count)
+    {
+        return false;
+    }
+
+    std::vector<ICalendarTimezoneTable::SharedPtr> tables(pHeader->numTimezones);
+
+    for (uint32_t i = 0; i < pHeader->numTimezones; ++i)
+    {
+        const Timezone& timezone = pTimezones[i];
+
+        ICalendarTimezoneTable::Transitions transitions(timezone.numTransitions);
+
+        for (std::size_t j = 0; j < transitions.size(); ++j)
+        {
+            const Transition& record = pTransitions[timezone.firstTransition + j];
+
+            transitions[j].time = record.time;
+            transitions[j].localTime = record.time + std::min(record.offset,
+                                                              record.previousOffset);
+            transitions[j].offset = record.offset;
+            transitions[j].previousOffset = record.previousOffset;
+            transitions[j].isDaylight = 0 != (record.flags & IS_DAYLIGHT);
+            transitions[j].wasDaylight = 0 != (record.flags & WAS_DAYLIGHT);
+        }
+
+        tables[i] = std::make_shared<ICalendarTimezoneTable>(timezone.firstYear,
+                                                             timezone.lastYear,
+                                                             timezone.offset,
+                                                             0 != timezone.isDaylight,
+                                                             timezone.localStart,
+                                                             transitions);
+
+        const char* pTZID = pText + timezone.tzid;
+
+        compiled._timezoneTables[pTZID] = tables[i];
+
+        // Share the table with calendars that embed the same VTIMEZONE.
+        // TZIDs that libical resolved to a builtin timezone are not defined
+        // by the calendar or its resolved VTIMEZONEs.
+        icaltimezone* pZone = icalcomponent_get_timezone(pCalendar, pTZID);
+        icalcomponent* pTimezones = icalcomponent_get_parent(pCalendar);
+
+        if (!pZone && pTimezones)
+        {
+            pZone = icalcomponent_get_timezone(pTimezones, pTZID);
+        }
+
+        if (pZone)
+        {
+            ICalendarTimezoneTable::insert(icaltimezone_get_component(pZone), tables[i]);
+        }
+    }
+
+    compiled._uids.resize(count);
+    compiled._uidLengths.resize(count);
+    compiled._summaries.resize(count);
+    compiled._locations.resize(count);
+    compiled._starts.resize(count);
+    compiled._ends.resize(count);
+    compiled._lastModifieds.resize(count);
+    compiled._recurrenceIDs.resize(count);
+    compiled._sequences.resize(count);
+    compiled._recurrences.resize(count);
+    compiled._timezones.resize(count);
+    compiled._nextRows.resize(count);
+
+    // Only the first row of each UID is indexed; the rest are linked from
+    // it.
+    std::vector<unsigned char> linked(count, 0);
+
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        const Row& record = pRows[row];
+
+        compiled._uids[row] = static_cast<std::size_t>(record.uid);
+        compiled._uidLengths[row] = static_cast<std::size_t>(record.uidLength);
+        compiled._summaries[row] = static_cast<std::size_t>(record.summary);
+        compiled._locations[row] = static_cast<std::size_t>(record.location);
+        compiled._starts[row] = record.start;
+        compiled._ends[row] = record.end;
+        compiled._lastModifieds[row] = record.lastModified;
+        compiled._recurrenceIDs[row] = record.recurrenceID;
+        compiled._sequences[row] = record.sequence;
+        compiled._recurrences[row] = (record.flags & HAS_RECURRENCE) ? 1 : 0;
+
+        if (record.timezone >= 0)
+        {
+            compiled._timezones[row] = tables[record.timezone];
+        }
+
+        if (NO_RECORD == record.nextRow)
+        {
+            compiled._nextRows[row] = ICalendarEventIndex::NO_ROW;
+        }
+        else
+        {
+            compiled._nextRows[row] = static_cast<std::size_t>(record.nextRow);
+            linked[compiled._nextRows[row]] = 1;
+        }
+    }
+
+    compiled._strings.assign(pStrings, pStrings + pHeader->stringsSize);
+
+    compiled._index.reset(count);
+
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        if (!linked[row] && compiled._uidLengths[row] > 0)
+        {
+            compiled._index.insert(compiled.getUID(row), compiled._uidLengths[row], row);
+        }
+    }
+
+    compiled._lastModified = pHeader->lastModified;
+
+    return true;
+}
+
+
+void ICalendarSnapshotCache::restore(const MappedFile& file,
+                                     ICalendarInstanceIndex& index)
+{
+    const char* pData = file.getData();
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+    const Instance* pInstances = reinterpret_cast<const Instance*>(pData + pHeader->instancesOffset);
+
+    index.clear();
+    index._instances.resize(static_cast<std::size_t>(pHeader->numInstances));
+
+    for (std::size_t i = 0; i < index._instances.size(); ++i)
+    {
+        index._instances[i].start = pInstances[i].start;
+        index._instances[i].end = pInstances[i].end;
+        index._instances[i].row = static_cast<std::size_t>(pInstances[i].row);
+    }
+
+    // The instances were written in index order.
+    index.buildTree();
+    index._horizon = Interval(Poco::Timestamp(pHeader->horizonStart),
+                              Poco::Timestamp(pHeader->horizonEnd));
+    index._isBuilt = true;
+}
+
+
+uint64_t ICalendarSnapshotCache::append(std::vector<char>& pool,
+                                        const std::string& value)
+{
+    uint64_t offset = pool.size();
+    pool.insert(pool.end(), value.begin(), value.end());
+    pool.push_back('\0');
+    return offset;
+}
+
+
+} } // namespace ofx::Time
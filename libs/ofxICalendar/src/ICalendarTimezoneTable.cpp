@@ -0,0 +1,369 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarTimezoneTable.h"
+#include <algorithm>
+#include "ofx/Time/ICalendarUtils.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarTimezoneTable::Tables ICalendarTimezoneTable::_tables;
+Poco::Mutex ICalendarTimezoneTable::_tablesMutex;
+
+
+ICalendarTimezoneTable::ICalendarTimezoneTable(icaltimezone* pZone,
+                                               int firstYear,
+                                               int lastYear):
+    _firstYear(firstYear),
+    _lastYear(lastYear),
+    _start(ICalendarUtils::daysFromCivil(firstYear, 1, 1) * 86400),
+    _end(ICalendarUtils::daysFromCivil(lastYear + 1, 1, 1) * 86400),
+    _offset(0),
+    _isDaylight(false),
+    _localStart(_start)
+{
+    // Local times lie within a day of UTC, so the changes are read a little
+    // beyond both ends of the range.
+    int64_t time = _start - 2 * 86400;
+    int64_t last = _end + 2 * 86400;
+
+    // Reading the changes expands the timezone, which may be a builtin
+    // timezone shared with other calendars.
+    Poco::Mutex::ScopedLock lock(ICalendarUtils::getTimezoneMutex());
+
+    _offset = getOffsetOfUTC(pZone, time, _isDaylight);
+
+    int offset = _offset;
+    bool isDaylight = _isDaylight;
+
+    // Offsets are sampled daily and each change is then found to the
+    // second with a binary search.
+    while (time < last)
+    {
+        int64_t next = std::min(time + 86400, last);
+
+        bool nextIsDaylight = false;
+        int nextOffset = getOffsetOfUTC(pZone, next, nextIsDaylight);
+
+        if (nextOffset == offset && nextIsDaylight == isDaylight)
+        {
+            time = next;
+            continue;
+        }
+
+        int64_t low = time;
+        int64_t high = next;
+
+        while (high - low > 1)
+        {
+            int64_t middle = low + (high - low) / 2;
+
+            bool middleIsDaylight = false;
+            int middleOffset = getOffsetOfUTC(pZone, middle, middleIsDaylight);
+
+            if (middleOffset == offset && middleIsDaylight == isDaylight)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        Transition transition;
+        transition.time = high;
+        transition.previousOffset = offset;
+        transition.wasDaylight = isDaylight;
+        transition.offset = getOffsetOfUTC(pZone, high, transition.isDaylight);
+        transition.localTime = high + std::min(transition.offset,
+                                               transition.previousOffset);
+
+        _transitions.push_back(transition);
+
+        time = high;
+        offset = transition.offset;
+        isDaylight = transition.isDaylight;
+    }
+
+    // Before the first change of a VTIMEZONE, libical reports an offset of
+    // 0 for UTC times and converts local times irregularly up to a few
+    // hours after the change.  As the range may begin in that state, local
+    // times up to a day after the first change are left to libical.
+    if (0 == _offset && !_isDaylight)
+    {
+        _localStart = _transitions.empty() ? _end : std::max(_start, _transitions.front().time + 86400);
+    }
+}
+
+
+ICalendarTimezoneTable::ICalendarTimezoneTable(int firstYear,
+                                               int lastYear,
+                                               int offset,
+                                               bool isDaylight,
+                                               int64_t localStart,
+                                               const Transitions& transitions):
+    _firstYear(firstYear),
+    _lastYear(lastYear),
+    _start(ICalendarUtils::daysFromCivil(firstYear, 1, 1) * 86400),
+    _end(ICalendarUtils::daysFromCivil(lastYear + 1, 1, 1) * 86400),
+    _offset(offset),
+    _isDaylight(isDaylight),
+    _localStart(localStart),
+    _transitions(transitions)
+{
+}
+
+
+ICalendarTimezoneTable::~ICalendarTimezoneTable()
+{
+}
+
+
+bool ICalendarTimezoneTable::getOffsetOfUTC(int64_t time,
+                                            int& offset,
+                                            bool& isDaylight) const
+{
+    if (time < _start || time >= _end)
+    {
+        return false;
+    }
+
+    Transitions::const_iterator iter = std::upper_bound(_transitions.begin(),
+                                                        _transitions.end(),
+                                                        time,
+                                                        compareTime);
+
+    if (iter == _transitions.begin())
+    {
+        offset = _offset;
+        isDaylight = _isDaylight;
+    }
+    else
+    {
+        --iter;
+        offset = iter->offset;
+        isDaylight = iter->isDaylight;
+    }
+
+    return true;
+}
+
+
+bool ICalendarTimezoneTable::toUTC(int64_t wallClock,
+                                   bool isDaylight,
+                                   int64_t& time) const
+{
+    if (wallClock < _localStart || wallClock >= _end)
+    {
+        return false;
+    }
+
+    Transitions::const_iterator iter = std::upper_bound(_transitions.begin(),
+                                                        _transitions.end(),
+                                                        wallClock,
+                                                        compareLocalTime);
+
+    int offset = _offset;
+
+    if (iter != _transitions.begin())
+    {
+        --iter;
+
+        offset = iter->offset;
+
+        // When clocks go back, local times before the old offset catches up
+        // are repeated.  Like libical, use the previous offset only if it
+        // is the daylight time that was asked for.
+        if (iter->offset < iter->previousOffset &&
+            wallClock < iter->time + iter->previousOffset &&
+            iter->isDaylight != iter->wasDaylight &&
+            iter->isDaylight != isDaylight)
+        {
+            offset = iter->previousOffset;
+        }
+    }
+
+    time = wallClock - offset;
+
+    return true;
+}
+
+
+int ICalendarTimezoneTable::getFirstYear() const
+{
+    return _firstYear;
+}
+
+
+int ICalendarTimezoneTable::getLastYear() const
+{
+    return _lastYear;
+}
+
+
+int ICalendarTimezoneTable::getInitialOffset() const
+{
+    return _offset;
+}
+
+
+bool ICalendarTimezoneTable::isInitiallyDaylight() const
+{
+    return _isDaylight;
+}
+
+
+int64_t ICalendarTimezoneTable::getLocalStart() const
+{
+    return _localStart;
+}
+
+
+const ICalendarTimezoneTable::Transitions& ICalendarTimezoneTable::getTransitions() const
+{
+    return _transitions;
+}
+
+
+ICalendarTimezoneTable::SharedPtr ICalendarTimezoneTable::get(icaltimezone* pZone)
+{
+    if (!pZone || pZone == icaltimezone_get_utc_timezone())
+    {
+        return SharedPtr();
+    }
+
+    icalcomponent* pComponent = icaltimezone_get_component(pZone);
+
+    if (!pComponent)
+    {
+        return SharedPtr();
+    }
+
+    std::string definition(icalcomponent_as_ical_string(pComponent));
+
+    Poco::Mutex::ScopedLock lock(_tablesMutex);
+
+    Tables::iterator iter = _tables.find(definition);
+
+    if (iter != _tables.end())
+    {
+        SharedPtr table = iter->second.lock();
+
+        if (table)
+        {
+            return table;
+        }
+    }
+
+    SharedPtr table = std::make_shared<ICalendarTimezoneTable>(pZone);
+
+    prune();
+
+    _tables[definition] = table;
+
+    return table;
+}
+
+
+void ICalendarTimezoneTable::insert(icalcomponent* pComponent,
+                                    const SharedPtr& table)
+{
+    if (!pComponent || !table)
+    {
+        return;
+    }
+
+    std::string definition(icalcomponent_as_ical_string(pComponent));
+
+    Poco::Mutex::ScopedLock lock(_tablesMutex);
+
+    prune();
+
+    _tables[definition] = table;
+}
+
+
+void ICalendarTimezoneTable::prune()
+{
+    Tables::iterator iter = _tables.begin();
+
+    while (iter != _tables.end())
+    {
+        if (iter->second.expired())
+        {
+            _tables.erase(iter++);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+
+int ICalendarTimezoneTable::getOffsetOfUTC(icaltimezone* pZone,
+                                           int64_t time,
+                                           bool& isDaylight)
+{
+    struct icaltimetype utc = icaltime_null_time();
+
+    int64_t days = ICalendarUtils::floorDivide(time, 86400);
+    int64_t seconds = time - days * 86400;
+
+    ICalendarUtils::civilFromDays(days, utc.year, utc.month, utc.day);
+
+    utc.hour = static_cast<int>(seconds / 3600);
+    utc.minute = static_cast<int>(seconds / 60 % 60);
+    utc.second = static_cast<int>(seconds % 60);
+    utc.is_utc = 1;
+    utc.zone = icaltimezone_get_utc_timezone();
+
+    int daylight = 0;
+    int offset = icaltimezone_get_utc_offset_of_utc_time(pZone, &utc, &daylight);
+
+    isDaylight = daylight != 0;
+
+    return offset;
+}
+
+
+bool ICalendarTimezoneTable::compareLocalTime(int64_t lhs, const Transition& rhs)
+{
+    return lhs < rhs.localTime;
+}
+
+
+bool ICalendarTimezoneTable::compareTime(int64_t lhs, const Transition& rhs)
+{
+    return lhs < rhs.time;
+}
+
+
+} } // namespace ofx::Time
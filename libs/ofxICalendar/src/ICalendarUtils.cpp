@@ -24,12 +24,19 @@
 
 
 #include "ofx/Time/ICalendarUtils.h"
+#include <algorithm>
+#include <climits>
+#include <vector>
+#include "ofx/Time/ICalendarRecurrenceIterator.h"
 
 
 namespace ofx {
 namespace Time {
 
 
+Poco::Mutex ICalendarUtils::_timezoneMutex;
+
+
 bool ICalendarUtils::timeToTimestamp(struct icaltimetype time,
                                      Poco::Timestamp& timestamp)
 {
@@ -100,6 +107,651 @@ bool ICalendarUtils::getExtensionValue(icalcomponent* pComponent,
 }
 
 
+uint64_t ICalendarUtils::hash(const char* data, std::size_t size)
+{
+    uint64_t result = 14695981039346656037ULL;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        result ^= static_cast<unsigned char>(data[i]);
+        result *= 1099511628211ULL;
+    }
+
+    return result;
+}
+
+
+uint64_t ICalendarUtils::hashContent(const char* data,
+                                     std::size_t size,
+                                     uint64_t seed)
+{
+    // XXH64 (https://github.com/Cyan4973/xxHash).  Words are read in host
+    // byte order, which is fine for comparing hashes on one machine.
+    static const uint64_t PRIME1 = 11400714785074694791ULL;
+    static const uint64_t PRIME2 = 14029467366897019727ULL;
+    static const uint64_t PRIME3 = 1609587929392839161ULL;
+    static const uint64_t PRIME4 = 9650029242287828579ULL;
+    static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+    struct XXH64
+    {
+        static uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        static uint64_t read64(const char* p)
+        {
+            uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        static uint32_t read32(const char* p)
+        {
+            uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        static uint64_t round(uint64_t acc, uint64_t input)
+        {
+            acc += input * PRIME2;
+            acc = rotl(acc, 31);
+            return acc * PRIME1;
+        }
+
+        static uint64_t mergeRound(uint64_t acc, uint64_t value)
+        {
+            acc ^= round(0, value);
+            return acc * PRIME1 + PRIME4;
+        }
+    };
+
+    const char* p = data;
+    const char* end = data + size;
+    uint64_t result = 0;
+
+    if (size >= 32)
+    {
+        const char* limit = end - 32;
+
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+
+        do
+        {
+            v1 = XXH64::round(v1, XXH64::read64(p));
+            v2 = XXH64::round(v2, XXH64::read64(p + 8));
+            v3 = XXH64::round(v3, XXH64::read64(p + 16));
+            v4 = XXH64::round(v4, XXH64::read64(p + 24));
+            p += 32;
+        }
+        while (p <= limit);
+
+        result = XXH64::rotl(v1, 1) +
+                 XXH64::rotl(v2, 7) +
+                 XXH64::rotl(v3, 12) +
+                 XXH64::rotl(v4, 18);
+
+        result = XXH64::mergeRound(result, v1);
+        result = XXH64::mergeRound(result, v2);
+        result = XXH64::mergeRound(result, v3);
+        result = XXH64::mergeRound(result, v4);
+    }
+    else
+    {
+        result = seed + PRIME5;
+    }
+
+    result += static_cast<uint64_t>(size);
+
+    while (p + 8 <= end)
+    {
+        result ^= XXH64::round(0, XXH64::read64(p));
+        result = XXH64::rotl(result, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        result ^= static_cast<uint64_t>(XXH64::read32(p)) * PRIME1;
+        result = XXH64::rotl(result, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        result ^= static_cast<uint64_t>(static_cast<unsigned char>(*p)) * PRIME5;
+        result = XXH64::rotl(result, 11) * PRIME1;
+        ++p;
+    }
+
+    result ^= result >> 33;
+    result *= PRIME2;
+    result ^= result >> 29;
+    result *= PRIME3;
+    result ^= result >> 32;
+
+    return result;
+}
+
+
+bool ICalendarUtils::spansOverlap(int64_t start0,
+                                  int64_t end0,
+                                  int64_t start1,
+                                  int64_t end1)
+{
+    return (start0 > start1 && start0 < end1) ||
+           (end0   > start1 && end0   < end1) ||
+           (start1 > start0 && start1 < end0) ||
+           (end1   > start0 && end1   < end0) ||
+           (start0 == start1 && end0 == end1);
+}
+
+
+bool ICalendarUtils::getBaseSpan(icalcomponent* pEventComponent,
+                                 int64_t& start,
+                                 int64_t& end)
+{
+    if (!pEventComponent)
+    {
+        return false;
+    }
+
+    struct icaltimetype dtstart = icalcomponent_get_dtstart(pEventComponent);
+
+    if (icaltime_is_null_time(dtstart))
+    {
+        return false;
+    }
+
+    icaltime_span span = icaltime_span_new(dtstart,
+                                           icalcomponent_get_dtend(pEventComponent),
+                                           1);
+
+    start = span.start;
+    end = span.end;
+
+    return true;
+}
+
+
+void ICalendarUtils::forEachRecurrence(icalcomponent* pComponent,
+                                       struct icaltimetype start,
+                                       struct icaltimetype end,
+                                       void (*callback)(icalcomponent* component,
+                                                        struct icaltime_span* span,
+                                                        void* data),
+                                       void* data,
+                                       const ICalendarTimezoneTable* pTable)
+{
+    if (!pComponent || !callback)
+    {
+        return;
+    }
+
+    // This follows icalcomponent_foreach_recurrence() step by step, so that
+    // the spans, their order and the exclusions are the same.
+    struct icaltimetype dtstart = icalcomponent_get_dtstart(pComponent);
+
+    if (icaltime_is_null_time(dtstart))
+    {
+        return;
+    }
+
+    icaltimezone* pUTC = icaltimezone_get_utc_timezone();
+
+    icaltime_span baseSpan = icaltime_span_new(dtstart,
+                                               icalcomponent_get_dtend(pComponent),
+                                               1);
+
+    icaltime_span limitSpan;
+    limitSpan.start = icaltime_as_timet_with_zone(start, pUTC);
+    limitSpan.end = icaltime_is_null_time(end) ? INT_MAX : icaltime_as_timet_with_zone(end, pUTC);
+    limitSpan.is_busy = 1;
+
+    if (!isExcluded(pComponent, dtstart, dtstart, pTable) &&
+        icaltime_span_overlaps(&baseSpan, &limitSpan))
+    {
+        callback(pComponent, &baseSpan, data);
+    }
+
+    time_t duration = baseSpan.end - baseSpan.start;
+
+    int64_t endTime = toUTC(end, 0, 0);
+
+    // Recurrences that start more than a day before the limit, less their
+    // duration, can not overlap it whatever the timezone offsets.
+    struct icaltimetype seekTime = icaltime_from_timet(limitSpan.start - std::max(duration, time_t(0)) - 24 * 60 * 60,
+                                                       false);
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_RRULE_PROPERTY);
+
+    while (pProperty)
+    {
+        ICalendarRecurrenceIterator iterator(icalproperty_get_rrule(pProperty), dtstart);
+
+        // Like libical, assume the first occurrence is DTSTART.
+        iterator.next();
+        iterator.seek(seekTime);
+
+        struct icaltimetype time = iterator.next();
+
+        while (!icaltime_is_null_time(time))
+        {
+            // Compare with the end like icaltime_compare(), converting with
+            // the table where it applies.
+            if (time.is_date || end.is_date ? icaltime_compare(time, end) > 0 : toUTC(time, dtstart.zone, pTable) > endTime)
+            {
+                break;
+            }
+
+            // libical offsets the base span by the wall clock difference
+            // from DTSTART, not by converting each recurrence.
+            int offset = icaldurationtype_as_int(icaltime_subtract(time, dtstart));
+
+            icaltime_span span;
+            span.start = baseSpan.start + offset;
+            span.end = baseSpan.end + offset;
+            span.is_busy = 1;
+
+            // Checking exclusions moves the component's property iterator,
+            // so the RRULE loop position must be restored.
+            if (!isExcluded(pComponent, dtstart, time, pTable) &&
+                icaltime_span_overlaps(&span, &limitSpan))
+            {
+                callback(pComponent, &span, data);
+            }
+
+            icalproperty* pRule = icalcomponent_get_first_property(pComponent,
+                                                                   ICAL_RRULE_PROPERTY);
+
+            while (pRule && pRule != pProperty)
+            {
+                pRule = icalcomponent_get_next_property(pComponent,
+                                                        ICAL_RRULE_PROPERTY);
+            }
+
+            time = iterator.next();
+        }
+
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_RRULE_PROPERTY);
+    }
+
+    pProperty = icalcomponent_get_first_property(pComponent,
+                                                 ICAL_RDATE_PROPERTY);
+
+    while (pProperty)
+    {
+        struct icaldatetimeperiodtype period = icalproperty_get_rdate(pProperty);
+
+        // Like libical, only RDATE date-times are supported.
+        if (!icaltime_is_null_time(period.time))
+        {
+            int offset = icaldurationtype_as_int(icaltime_subtract(period.time, dtstart));
+
+            icaltime_span span;
+            span.start = baseSpan.start + offset;
+            span.end = baseSpan.end + offset;
+            span.is_busy = 1;
+
+            if (!isExcluded(pComponent, dtstart, period.time, pTable) &&
+                icaltime_span_overlaps(&span, &limitSpan))
+            {
+                callback(pComponent, &span, data);
+            }
+
+            icalproperty* pDate = icalcomponent_get_first_property(pComponent,
+                                                                   ICAL_RDATE_PROPERTY);
+
+            while (pDate && pDate != pProperty)
+            {
+                pDate = icalcomponent_get_next_property(pComponent,
+                                                        ICAL_RDATE_PROPERTY);
+            }
+        }
+
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_RDATE_PROPERTY);
+    }
+}
+
+
+int64_t ICalendarUtils::toUTC(const struct icaltimetype& time,
+                              const icaltimezone* pZone,
+                              const ICalendarTimezoneTable* pTable)
+{
+    icaltimezone* pUTC = icaltimezone_get_utc_timezone();
+
+    // Like icaltime_convert_to_zone(), leave dates and floating times as
+    // they are.
+    if (time.is_date || !time.zone || time.zone == pUTC)
+    {
+        return toWallClock(time);
+    }
+
+    int64_t utc = 0;
+
+    if (pTable && time.zone == pZone && pTable->toUTC(toWallClock(time), time.is_daylight != 0, utc))
+    {
+        return utc;
+    }
+
+    return toWallClock(icaltime_convert_to_zone(time, pUTC));
+}
+
+
+bool ICalendarUtils::isExcluded(icalcomponent* pComponent,
+                                struct icaltimetype dtstart,
+                                struct icaltimetype time,
+                                const ICalendarTimezoneTable* pTable)
+{
+    if (!pTable ||
+        !pComponent ||
+        icaltime_is_null_time(time) ||
+        icalcomponent_get_first_property(pComponent, ICAL_EXRULE_PROPERTY))
+    {
+        return icalproperty_recurrence_is_excluded(pComponent, &dtstart, &time) != 0;
+    }
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_EXDATE_PROPERTY);
+
+    if (!pProperty)
+    {
+        return false;
+    }
+
+    int64_t utc = toUTC(time, dtstart.zone, pTable);
+
+    const char* pTZID = 0;
+
+    while (pProperty)
+    {
+        // icalproperty_get_exdate() also looks the TZID up among libical's
+        // builtin timezones, one by one, so read the value directly.
+        struct icaltimetype exdate = icalvalue_get_datetime(icalproperty_get_value(pProperty));
+
+        icalparameter* pParameter = icalproperty_get_first_parameter(pProperty,
+                                                                     ICAL_TZID_PARAMETER);
+
+        if (pParameter)
+        {
+            // libical resolves an EXDATE TZID like the DTSTART TZID, so
+            // only the same TZID is known to name the tabulated timezone.
+            if (!pTZID)
+            {
+                icalproperty* pStart = icalcomponent_get_first_property(pComponent,
+                                                                        ICAL_DTSTART_PROPERTY);
+
+                icalparameter* pStartParameter = pStart ? icalproperty_get_first_parameter(pStart,
+                                                                                           ICAL_TZID_PARAMETER) : 0;
+
+                pTZID = pStartParameter ? icalparameter_get_tzid(pStartParameter) : 0;
+            }
+
+            const char* pExcludedTZID = icalparameter_get_tzid(pParameter);
+
+            if (!pTZID || !pExcludedTZID || 0 != std::strcmp(pTZID, pExcludedTZID))
+            {
+                return icalproperty_recurrence_is_excluded(pComponent, &dtstart, &time) != 0;
+            }
+
+            exdate.zone = dtstart.zone;
+            exdate.is_utc = 0;
+        }
+
+        int64_t excluded = toUTC(exdate, dtstart.zone, pTable);
+
+        // Like libical, an EXDATE date excludes every recurrence on that
+        // day, and an EXDATE date-time only the same date-time.
+        if (exdate.is_date)
+        {
+            if (floorDivide(utc, 24 * 60 * 60) == floorDivide(excluded, 24 * 60 * 60))
+            {
+                return true;
+            }
+        }
+        else if (!time.is_date && utc == excluded)
+        {
+            return true;
+        }
+
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_EXDATE_PROPERTY);
+    }
+
+    return false;
+}
+
+
+void ICalendarUtils::prepareTimezones(icalcomponent* pComponent, int year)
+{
+    if (!pComponent)
+    {
+        return;
+    }
+
+    std::vector<struct icaltimetype> times;
+
+    times.push_back(icalcomponent_get_dtstart(pComponent));
+    times.push_back(icalcomponent_get_dtend(pComponent));
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_RDATE_PROPERTY);
+
+    while (pProperty)
+    {
+        times.push_back(icalproperty_get_rdate(pProperty).time);
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_RDATE_PROPERTY);
+    }
+
+    pProperty = icalcomponent_get_first_property(pComponent,
+                                                 ICAL_EXDATE_PROPERTY);
+
+    while (pProperty)
+    {
+        times.push_back(icalproperty_get_exdate(pProperty));
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_EXDATE_PROPERTY);
+    }
+
+    // Recurrences are converted up to 2038, where libical's iterator stops
+    // them, and the query itself may lie beyond that.
+    struct icaltimetype last = icaltime_from_day_of_year(1, std::max(year + 1, 2038));
+
+    Poco::Mutex::ScopedLock lock(_timezoneMutex);
+
+    std::vector<struct icaltimetype>::iterator iter = times.begin();
+
+    while (iter != times.end())
+    {
+        if (!icaltime_is_null_time(*iter) && iter->zone)
+        {
+            icaltimezone* pZone = const_cast<icaltimezone*>(iter->zone);
+            int isDaylight = 0;
+
+            icaltimezone_get_utc_offset(pZone, &*iter, &isDaylight);
+            icaltimezone_get_utc_offset(pZone, &last, &isDaylight);
+        }
+
+        ++iter;
+    }
+}
+
+
+Poco::Mutex& ICalendarUtils::getTimezoneMutex()
+{
+    return _timezoneMutex;
+}
+
+
+void ICalendarUtils::findMissingTimezones(icalcomponent* pCalendar,
+                                          std::set<std::string>& tzids)
+{
+    if (!pCalendar)
+    {
+        return;
+    }
+
+    std::set<std::string> referenced;
+
+    icalcomponent* pComponent = icalcomponent_get_first_component(pCalendar,
+                                                                  ICAL_ANY_COMPONENT);
+
+    while (pComponent)
+    {
+        if (ICAL_VTIMEZONE_COMPONENT != icalcomponent_isa(pComponent))
+        {
+            icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                                       ICAL_ANY_PROPERTY);
+
+            while (pProperty)
+            {
+                icalparameter* pParameter = icalproperty_get_first_parameter(pProperty,
+                                                                             ICAL_TZID_PARAMETER);
+
+                const char* pTZID = pParameter ? icalparameter_get_tzid(pParameter) : 0;
+
+                if (pTZID)
+                {
+                    referenced.insert(pTZID);
+                }
+
+                pProperty = icalcomponent_get_next_property(pComponent,
+                                                            ICAL_ANY_PROPERTY);
+            }
+        }
+
+        pComponent = icalcomponent_get_next_component(pCalendar,
+                                                      ICAL_ANY_COMPONENT);
+    }
+
+    std::set<std::string>::const_iterator iter = referenced.begin();
+
+    while (iter != referenced.end())
+    {
+        if (!icalcomponent_get_timezone(pCalendar, iter->c_str()))
+        {
+            tzids.insert(*iter);
+        }
+
+        ++iter;
+    }
+}
+
+
+std::size_t ICalendarUtils::copyTimezones(icalcomponent* pSource,
+                                          const std::set<std::string>& tzids,
+                                          icalcomponent* pTarget)
+{
+    if (!pSource || !pTarget || tzids.empty())
+    {
+        return 0;
+    }
+
+    // The clones are added after the walk, because each addition makes
+    // libical sort pTarget's timezones again on the next lookup.
+    std::vector<icalcomponent*> clones;
+
+    icalcomponent* pComponent = icalcomponent_get_first_component(pSource,
+                                                                  ICAL_VTIMEZONE_COMPONENT);
+
+    while (pComponent)
+    {
+        icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                                   ICAL_TZID_PROPERTY);
+
+        const char* pTZID = pProperty ? icalproperty_get_tzid(pProperty) : 0;
+
+        if (pTZID &&
+            tzids.find(pTZID) != tzids.end() &&
+            !icalcomponent_get_timezone(pTarget, pTZID))
+        {
+            clones.push_back(icalcomponent_new_clone(pComponent));
+        }
+
+        pComponent = icalcomponent_get_next_component(pSource,
+                                                      ICAL_VTIMEZONE_COMPONENT);
+    }
+
+    std::vector<icalcomponent*>::iterator iter = clones.begin();
+
+    while (iter != clones.end())
+    {
+        icalcomponent_add_component(pTarget, *iter);
+        ++iter;
+    }
+
+    return clones.size();
+}
+
+
+int64_t ICalendarUtils::toWallClock(const struct icaltimetype& time)
+{
+    int64_t seconds = daysFromCivil(time.year, time.month, time.day) * 86400;
+
+    if (!time.is_date)
+    {
+        seconds += time.hour * 3600 + time.minute * 60 + time.second;
+    }
+
+    return seconds;
+}
+
+
+int64_t ICalendarUtils::floorDivide(int64_t numerator,
+                                    int64_t denominator)
+{
+    int64_t quotient = numerator / denominator;
+
+    if ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0)))
+    {
+        --quotient;
+    }
+
+    return quotient;
+}
+
+
+int64_t ICalendarUtils::daysFromCivil(int year, int month, int day)
+{
+    // See http://howardhinnant.github.io/date_algorithms.html
+    int64_t y = year - (month <= 2 ? 1 : 0);
+    int64_t era = floorDivide(y, 400);
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+    return era * 146097 + dayOfEra - 719468;
+}
+
+
+void ICalendarUtils::civilFromDays(int64_t days,
+                                   int& year,
+                                   int& month,
+                                   int& day)
+{
+    days += 719468;
+
+    int64_t era = floorDivide(days, 146097);
+    int64_t dayOfEra = days - era * 146097;
+    int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int64_t monthPart = (5 * dayOfYear + 2) / 153;
+
+    day = static_cast<int>(dayOfYear - (153 * monthPart + 2) / 5 + 1);
+    month = static_cast<int>(monthPart < 10 ? monthPart + 3 : monthPart - 9);
+    year = static_cast<int>(yearOfEra + era * 400 + (month <= 2 ? 1 : 0));
+}
+
+
 //icaltimezone* ICalendarUtils::getTimezoneForTZID(icalcomponent* component, const std::string& tzid)
 //{
 //    if (0 != component)
@@ -24,6 +24,7 @@
 
 
 #include "ofx/Time/ICalendarWatcher.h"
+#include <algorithm>
 
 
 namespace ofx {
@@ -31,11 +32,15 @@ namespace Time {
 
 
 const Poco::Timespan ICalendarWatcher::DEFAULT_UPDATE_INTERVAL = 1 * Poco::Timespan::MINUTES;
+const Poco::Timespan ICalendarWatcher::DEFAULT_LOOK_AHEAD = 1 * Poco::Timespan::DAYS;
 
 
 ICalendarWatcher::ICalendarWatcher(ICalendar::SharedPtr calendar):
     _calendar(calendar),
-    _updateInterval(DEFAULT_UPDATE_INTERVAL)
+    _nextTransition(0),
+    _windowEnd(0),
+    _lookAhead(DEFAULT_LOOK_AHEAD),
+    _generation(0)
 {
     _lastUpdate.update();
     _lastUpdate -= DEFAULT_UPDATE_INTERVAL.totalMicroseconds();
@@ -52,90 +57,163 @@ ICalendarWatcher::~ICalendarWatcher()
 
 void ICalendarWatcher::setUpdateInterval(unsigned long long updateInterval)
 {
-    _updateInterval = Poco::Timespan(Poco::Timespan::MILLISECONDS * updateInterval);
+    setLookAhead(updateInterval);
 }
 
 
 unsigned long long ICalendarWatcher::getUpdateInterval() const
 {
-    return _updateInterval.milliseconds();
+    return getLookAhead();
 }
 
 
-void ICalendarWatcher::refresh()
+void ICalendarWatcher::setLookAhead(unsigned long long lookAhead)
 {
-    Poco::Timestamp now; // the current time
+    _lookAhead = Poco::Timespan(Poco::Timespan::MILLISECONDS * lookAhead);
+
+    // Rebuild the queue with the new window on the next update.
+    _windowEnd = 0;
+}
+
+
+unsigned long long ICalendarWatcher::getLookAhead() const
+{
+    return _lookAhead.totalMilliseconds();
+}
+
+
+Poco::Timestamp ICalendarWatcher::getNextRefresh() const
+{
+    if (_nextTransition < _transitions.size() &&
+        _transitions[_nextTransition].time < _windowEnd.epochMicroseconds())
+    {
+        return Poco::Timestamp(_transitions[_nextTransition].time);
+    }
+
+    return _windowEnd;
+}
+
+
+void ICalendarWatcher::refresh(const Poco::Timestamp& now)
+{
+    _transitions.clear();
+    _upcoming.clear();
+    _nextTransition = 0;
+    _windowEnd = now + _lookAhead.totalMicroseconds();
 
     if (_calendar)
     {
-        ICalendar::EventInstances oldInstances = _watches;
-        ICalendar::EventInstances newInstances = _calendar->getEventInstances(now);
-
-        // sort uids lexigraphically
-        std::sort(oldInstances.begin(), oldInstances.end(), compareUID);
-        std::sort(newInstances.begin(), newInstances.end(), compareUID);
-
-        // unmatchedOldInstances are those events instances that are NOT
-        // seen in the current instanaces.  if an instance is NOT seen,
-        // that means that an instance has ended (we can check for that)
-        // OR the event was "modified" -- that is -- the equality
-        // relationship didn't hold and we need to check for UID equality
-        // in this case -- OR the event was deleted altogether from the
-        // calendar.
-
-        ICalendar::EventInstances unmatchedOldInstances;
-
-        // unmatchedNewInstances are those instances that did not have an
-        // equality match inside of the watchedInstances vector.  Events in
-        // this array can fall into three categories: 1) a modified event
-        // -- == opererator failed because of a different modified date,
-        // 2) an event that has just started 3) an in-progress event that
-        // was added after its start time.
+        // Read the generation first, so a snapshot published during the
+        // refresh triggers another one.
+        uint64_t generation = _calendar->getGeneration();
+
+        // Events can only be modified by a new snapshot.
+        bool checkModified = (generation != _generation);
+
+        _generation = generation;
+
+        // Instance queries have a resolution of one second and libical's
+        // overlap test is strict, so an instance that starts or ends within
+        // the current second would be missed by a query starting at now.
+        // The query starts a second earlier and the instances are then
+        // classified by their exact times.
+        _upcoming = _calendar->getEventInstances(Interval(now - Poco::Timespan::SECONDS,
+                                                          _windowEnd));
 
+        ICalendarSnapshot::SharedPtr snapshot = _calendar->getSnapshot();
+
+        // Instances that are still watched are moved from _watches to
+        // newWatches, so _watches is left with the instances that are gone.
+        Watches newWatches;
+
+        ICalendar::EventInstances modifiedInstances;
         ICalendar::EventInstances unmatchedNewInstances;
 
-        // newWatches will eventually replace _watches when the refresh is done
-        ICalendar::EventInstances newWatches;
-
-        // std::set_difference - what is in first set, but not in the second one
-
-        // TODO: combine all three of these steps into a single loop
-
-        // find any instances that are in the current watch list that are no longer there
-        std::set_difference(oldInstances.begin(),
-                            oldInstances.end(),
-                            newInstances.begin(),
-                            newInstances.end(),
-                            std::inserter(unmatchedOldInstances,
-                                          unmatchedOldInstances.end()),
-                            compareUID);
-
-        // find any new instances that are not matched in the current watchlist
-        std::set_difference(newInstances.begin(),
-                            newInstances.end(),
-                            oldInstances.begin(),
-                            oldInstances.end(),
-                            std::inserter(unmatchedNewInstances,
-                                          unmatchedNewInstances.end()),
-                            compareUID);
-
-        // find all instances that are still are the same in both sets.
-        // these instances must be checked for modification times.
-        std::set_intersection(newInstances.begin(),
-                              newInstances.end(),
-                              oldInstances.begin(),
-                              oldInstances.end(),
-                              std::inserter(newWatches,
-                                            newWatches.end()),
-                              compareUID);
-
-        // process the unmatched old instances
-        ICalendar::EventInstances::iterator unmatchedOldInstancesIter = unmatchedOldInstances.begin();
-
-        while (unmatchedOldInstancesIter != unmatchedOldInstances.end())
+        Poco::Timestamp::TimeVal nowTime = now.epochMicroseconds();
+        Poco::Timestamp::TimeVal lastUpdateTime = _lastUpdate.epochMicroseconds();
+
+        for (std::size_t i = 0; i < _upcoming.size(); ++i)
+        {
+            const ICalendarEventInstance& instance = _upcoming[i];
+
+            Poco::Timestamp::TimeVal startTime = instance.getInterval().getStart().epochMicroseconds();
+            Poco::Timestamp::TimeVal endTime = instance.getInterval().getEnd().epochMicroseconds();
+
+            Transition start = { startTime, true, i };
+            Transition end = { endTime, false, i };
+
+            if (startTime > nowTime)
+            {
+                _transitions.push_back(start);
+
+                if (endTime > nowTime)
+                {
+                    _transitions.push_back(end);
+                }
+
+                continue;
+            }
+
+            if (endTime <= nowTime)
+            {
+                // The instance is over.  If it started after the last update
+                // and is not watched, none of its transitions has fired, so
+                // both are queued and fired at the end of the refresh.
+                if (startTime > lastUpdateTime &&
+                    findWatch(_watches, instance) == _watches.end())
+                {
+                    _transitions.push_back(start);
+                    _transitions.push_back(end);
+                }
+
+                continue;
+            }
+
+            // The instance is in progress.
+            _transitions.push_back(end);
+
+            uint64_t key = instance.getOccurrenceKey();
+
+            Watches::iterator watchIter = findWatch(_watches, instance);
+
+            if (watchIter != _watches.end())
+            {
+                Watch watch = watchIter->second;
+
+                _watches.erase(watchIter);
+
+                if (checkModified)
+                {
+                    Poco::Timestamp lastModified = getLastModified(snapshot.get(), instance);
+
+                    if (lastModified.epochTime() > watch.lastModified.epochTime())
+                    {
+                        modifiedInstances.push_back(instance);
+                    }
+
+                    watch.lastModified = lastModified;
+                }
+
+                newWatches.insert(std::make_pair(key, watch));
+            }
+            else
+            {
+                unmatchedNewInstances.push_back(instance);
+
+                newWatches.insert(std::make_pair(key,
+                                                 Watch(instance,
+                                                       getLastModified(snapshot.get(), instance))));
+            }
+        }
+
+        std::sort(_transitions.begin(), _transitions.end());
+
+        // The remaining old watches have either ended or were removed.
+        Watches::const_iterator oldIter = _watches.begin();
+
+        while (oldIter != _watches.end())
         {
-            ICalendarEventInstance& instance = *unmatchedOldInstancesIter;
-            Poco::Timestamp startTime = instance.getInterval().getStart();
+            const ICalendarEventInstance& instance = oldIter->second.instance;
             Poco::Timestamp endTime = instance.getInterval().getEnd();
 
             if (!instance.isValidEventInstance() || endTime.epochTime() < _lastUpdate.epochTime())
@@ -147,94 +225,172 @@ void ICalendarWatcher::refresh()
                 ofNotifyEvent(events.onEventEnded, instance, this);
             }
 
-            ++unmatchedOldInstancesIter;
+            ++oldIter;
         }
 
-        // process the old matches and check them for updates
-        // process the unmatched old instances
-        ICalendar::EventInstances::iterator newWatchesIter = newWatches.begin();
+        ICalendar::EventInstances::const_iterator iter = modifiedInstances.begin();
 
-        while (newWatchesIter != newWatches.end())
+        while (iter != modifiedInstances.end())
         {
-            const ICalendarEvent& evt = (*newWatchesIter).getEvent();
+            ofNotifyEvent(events.onEventModified, *iter, this);
+            ++iter;
+        }
 
-            std::string uid = evt.getUID();
-            Poco::Timestamp lastModified = evt.getLastModified();
+        iter = unmatchedNewInstances.begin();
 
-            std::map<std::string, Poco::Timestamp>::iterator lastUpdatedIter = _watchesLastUpdated.find(uid);
+        while (iter != unmatchedNewInstances.end())
+        {
+            Poco::Timestamp startTime = iter->getInterval().getStart();
 
-            if (lastUpdatedIter != _watchesLastUpdated.end() &&
-                lastModified.epochTime() > _watchesLastUpdated[uid].epochTime())
+            if (startTime.epochTime() >= _lastUpdate.epochTime())
             {
-                ofNotifyEvent(events.onEventModified, *newWatchesIter, this);
+                ofNotifyEvent(events.onEventStarted, *iter, this);
+            }
+            else
+            {
+                ofNotifyEvent(events.onEventAdded, *iter, this);
             }
 
-            ++newWatchesIter;
+            ++iter;
         }
 
-        // process the new instances (add them to the watch list and the updated group)
-        ICalendar::EventInstances::iterator unmatchedNewInstancesIter = unmatchedNewInstances.begin();
+        // make a record of the watches
+        _watches.swap(newWatches);
+    }
+    else
+    {
+        ofLogError("ICalendarWatcher::refresh()") << "Calendar null.";
+    }
 
-        while (unmatchedNewInstancesIter != unmatchedNewInstances.end())
-        {
-            ICalendarEventInstance& instance = *unmatchedNewInstancesIter;
-            std::string uid = instance.getEvent().getUID();
-            Poco::Timestamp startTime = instance.getInterval().getStart();
-            Poco::Timestamp endTime = instance.getInterval().getEnd();
+    // Fire the transitions that are already due from their own times.
+    advance(now);
+}
 
-            if (startTime.epochTime() >= _lastUpdate.epochTime())
+
+void ICalendarWatcher::advance(const Poco::Timestamp& now)
+{
+    Poco::Timestamp::TimeVal nowTime = now.epochMicroseconds();
+
+    ICalendarSnapshot::SharedPtr snapshot;
+
+    while (_nextTransition < _transitions.size() &&
+           _transitions[_nextTransition].time <= nowTime)
+    {
+        const Transition& transition = _transitions[_nextTransition];
+        const ICalendarEventInstance& instance = _upcoming[transition.index];
+
+        ++_nextTransition;
+
+        uint64_t key = instance.getOccurrenceKey();
+
+        if (transition.isStart)
+        {
+            if (!snapshot)
             {
-                ofNotifyEvent(events.onEventStarted, instance, this);
+                snapshot = _calendar->getSnapshot();
             }
-            else
+
+            _watches.insert(std::make_pair(key,
+                                           Watch(instance,
+                                                 getLastModified(snapshot.get(), instance))));
+
+            ofNotifyEvent(events.onEventStarted, instance, this);
+        }
+        else
+        {
+            Watches::iterator watchIter = findWatch(_watches, instance);
+
+            if (watchIter != _watches.end())
             {
-                ofNotifyEvent(events.onEventAdded, instance, this);
+                _watches.erase(watchIter);
+
+                ofNotifyEvent(events.onEventEnded, instance, this);
             }
+        }
+    }
+
+    _lastUpdate = now;
+}
 
-            newWatches.push_back(instance); // add to current watches
 
-            ++unmatchedNewInstancesIter;
-        }
+bool ICalendarWatcher::Transition::operator < (const Transition& other) const
+{
+    if (time != other.time)
+    {
+        return time < other.time;
+    }
 
-        // make a record of the watches
-        _watches = newWatches;
+    return isStart && !other.isStart;
+}
 
-        // clear out old last udpated lists
-        _watchesLastUpdated.clear();
 
-        ICalendar::EventInstances::iterator iter = _watches.begin();
+Poco::Timestamp ICalendarWatcher::getLastModified(const ICalendarSnapshot* pSnapshot,
+                                                  const ICalendarEventInstance& instance)
+{
+    if (pSnapshot)
+    {
+        const CompiledCalendar& compiled = pSnapshot->getCompiledCalendar();
 
-        while (iter != _watches.end())
+        std::size_t row = compiled.find(instance.getEvent().getUID());
+
+        if (row != ICalendarEventIndex::NO_ROW)
         {
-            const ICalendarEvent& evt = (*iter).getEvent();
-            _watchesLastUpdated[evt.getUID()] = evt.getLastModified();
-            ++iter;
+            return Poco::Timestamp(compiled.getLastModified(row));
         }
     }
-    else
+
+    return Poco::Timestamp(0);
+}
+
+
+ICalendarWatcher::Watches::iterator ICalendarWatcher::findWatch(Watches& watches,
+                                                               const ICalendarEventInstance& instance)
+{
+    std::pair<Watches::iterator, Watches::iterator> range = watches.equal_range(instance.getOccurrenceKey());
+
+    while (range.first != range.second)
     {
-        ofLogError("ICalendarWatcher::refresh()") << "Calendar null.";
+        if (range.first->second.instance.isSameOccurrence(instance))
+        {
+            return range.first;
+        }
+
+        ++range.first;
     }
 
-    _lastUpdate = now;
+    return watches.end();
 }
 
-bool ICalendarWatcher::compareUID(const ICalendarEventInstance& lhs,
-                                  const ICalendarEventInstance& rhs)
+
+ICalendarWatcher::Watch::Watch(const ICalendarEventInstance& watchedInstance,
+                               const Poco::Timestamp& eventLastModified):
+    instance(watchedInstance),
+    lastModified(eventLastModified)
 {
-    return lhs.getEvent().getUID() < rhs.getEvent().getUID();
 }
 
 
 void ICalendarWatcher::update(ofEventArgs& args)
 {
-    if (_lastUpdate.isElapsed(_updateInterval.totalMicroseconds()))
+    Poco::Timestamp now;
+
+    if (_calendar && _calendar->getGeneration() != _generation)
+    {
+        // The calendar was reloaded.
+        refresh(now);
+    }
+    else if (_nextTransition < _transitions.size() &&
+             _transitions[_nextTransition].time <= now.epochMicroseconds())
+    {
+        advance(now);
+    }
+    else if (now >= _windowEnd)
     {
-        refresh();
+        refresh(now);
     }
     else
     {
-        // wait until next time
+        // wait until the next transition
     }
 }
 
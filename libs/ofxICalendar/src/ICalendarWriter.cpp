@@ -0,0 +1,161 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarWriter.h"
+#include <cstdlib>
+#include <cstring>
+
+
+namespace ofx {
+namespace Time {
+
+
+ICalendarWriter::ICalendarWriter(std::ostream& stream,
+                                 std::size_t chunkSize):
+    _stream(stream),
+    _chunkSize(chunkSize > 0 ? chunkSize : std::size_t(DEFAULT_CHUNK_SIZE))
+{
+    _buffer.reserve(_chunkSize);
+}
+
+
+ICalendarWriter::~ICalendarWriter()
+{
+    flush();
+}
+
+
+void ICalendarWriter::write(icalcomponent* pComponent)
+{
+    if (!pComponent)
+    {
+        return;
+    }
+
+    icalcomponent_kind kind = icalcomponent_isa(pComponent);
+
+    // The name of an X component is not exposed by libical.
+    if (ICAL_X_COMPONENT == kind)
+    {
+        appendAndFree(icalcomponent_as_ical_string_r(pComponent));
+        return;
+    }
+
+    const char* pKind = icalcomponent_kind_to_string(kind);
+
+    if (!pKind)
+    {
+        return;
+    }
+
+    append("BEGIN:");
+    append(pKind);
+    append("\r\n");
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_ANY_PROPERTY);
+
+    while (pProperty)
+    {
+        // The line is folded and escaped by libical, like
+        // icalcomponent_as_ical_string() does.
+        appendAndFree(icalproperty_as_ical_string_r(pProperty));
+
+        pProperty = icalcomponent_get_next_property(pComponent,
+                                                    ICAL_ANY_PROPERTY);
+    }
+
+    icalcomponent* pChild = icalcomponent_get_first_component(pComponent,
+                                                              ICAL_ANY_COMPONENT);
+
+    while (pChild)
+    {
+        write(pChild);
+
+        pChild = icalcomponent_get_next_component(pComponent,
+                                                  ICAL_ANY_COMPONENT);
+    }
+
+    append("END:");
+    append(pKind);
+    append("\r\n");
+}
+
+
+void ICalendarWriter::flush()
+{
+    if (!_buffer.empty())
+    {
+        _stream.write(&_buffer[0], _buffer.size());
+        _buffer.clear();
+    }
+}
+
+
+void ICalendarWriter::write(std::ostream& stream,
+                            icalcomponent* pComponent,
+                            std::size_t chunkSize)
+{
+    ICalendarWriter writer(stream, chunkSize);
+    writer.write(pComponent);
+}
+
+
+void ICalendarWriter::append(const char* pData, std::size_t size)
+{
+    if (_buffer.size() + size > _chunkSize)
+    {
+        flush();
+
+        // Data that does not fit an empty buffer bypasses it.
+        if (size > _chunkSize)
+        {
+            _stream.write(pData, size);
+            return;
+        }
+    }
+
+    _buffer.insert(_buffer.end(), pData, pData + size);
+}
+
+
+void ICalendarWriter::append(const char* pString)
+{
+    append(pString, std::strlen(pString));
+}
+
+
+void ICalendarWriter::appendAndFree(char* pString)
+{
+    if (pString)
+    {
+        append(pString);
+        free(pString);
+    }
+}
+
+
+} } // namespace ofx::Time
@@ -0,0 +1,602 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+#include "ofx/Time/ICalendarZoneInfo.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <set>
+#include <utility>
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/Path.h"
+#include "ofLog.h"
+#include "ofx/Time/ICalendarParser.h"
+
+
+namespace ofx {
+namespace Time {
+
+
+const char ICalendarZoneInfo::MAGIC[8] = { 'o', 'f', 'x', 'T', 'Z', 'I', '\0', '\0' };
+
+
+ICalendarZoneInfo::ICalendarZoneInfo():
+    _pHeader(0),
+    _pZones(0),
+    _pTransitions(0),
+    _pStrings(0)
+{
+}
+
+
+ICalendarZoneInfo::~ICalendarZoneInfo()
+{
+}
+
+
+bool ICalendarZoneInfo::open(const std::string& path)
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    reset();
+
+    if (!_file.open(path))
+    {
+        ofLogError("ICalendarZoneInfo::open()") << "File: " << path << " could not be opened.";
+        return false;
+    }
+
+    if (!validate())
+    {
+        ofLogError("ICalendarZoneInfo::open()") << "File: " << path << " is not a zoneinfo file compiled for this platform.";
+        reset();
+        return false;
+    }
+
+    const char* pData = _file.getData();
+
+    _pHeader = reinterpret_cast<const Header*>(pData);
+    _pZones = reinterpret_cast<const Zone*>(pData + _pHeader->zonesOffset);
+    _pTransitions = reinterpret_cast<const Transition*>(pData + _pHeader->transitionsOffset);
+    _pStrings = pData + _pHeader->stringsOffset;
+
+    _tables.resize(_pHeader->numZones);
+
+    return true;
+}
+
+
+void ICalendarZoneInfo::close()
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    reset();
+}
+
+
+bool ICalendarZoneInfo::isOpen() const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    return 0 != _pHeader;
+}
+
+
+std::size_t ICalendarZoneInfo::size() const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    return _pHeader ? _pHeader->numZones : 0;
+}
+
+
+bool ICalendarZoneInfo::hasTimezone(const std::string& tzid) const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+    return NO_ZONE != find(tzid.c_str());
+}
+
+
+icalcomponent* ICalendarZoneInfo::newTimezoneComponent(const std::string& tzid) const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    int index = find(tzid.c_str());
+
+    return NO_ZONE != index ? newComponent(index, tzid.c_str()) : 0;
+}
+
+
+ICalendarTimezoneTable::SharedPtr ICalendarZoneInfo::getTimezoneTable(const std::string& tzid) const
+{
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    int index = find(tzid.c_str());
+
+    return NO_ZONE != index ? getTable(index) : ICalendarTimezoneTable::SharedPtr();
+}
+
+
+std::size_t ICalendarZoneInfo::addTimezones(const std::set<std::string>& tzids,
+                                            icalcomponent* pTimezones) const
+{
+    if (!pTimezones)
+    {
+        return 0;
+    }
+
+    Poco::Mutex::ScopedLock lock(_mutex);
+
+    if (!_pHeader)
+    {
+        return 0;
+    }
+
+    std::size_t numAdded = 0;
+
+    std::set<std::string>::const_iterator iter = tzids.begin();
+
+    while (iter != tzids.end())
+    {
+        int index = NO_ZONE;
+
+        if (!icalcomponent_get_timezone(pTimezones, iter->c_str()))
+        {
+            index = find(iter->c_str());
+        }
+
+        icalcomponent* pTimezone = NO_ZONE != index ? newComponent(index, iter->c_str()) : 0;
+
+        if (pTimezone)
+        {
+            icalcomponent_add_component(pTimezones, pTimezone);
+
+            // Calendars compiled later find the table instead of building
+            // it from libical.
+            ICalendarTimezoneTable::insert(pTimezone, getTable(index));
+
+            ++numAdded;
+        }
+
+        ++iter;
+    }
+
+    return numAdded;
+}
+
+
+bool ICalendarZoneInfo::compile(const std::string& directory,
+                                const std::string& path)
+{
+    Poco::Path base(directory);
+    base.makeDirectory();
+
+    MappedFile zonesTab;
+
+    if (!zonesTab.open(Poco::Path(base, "zones.tab").toString()))
+    {
+        ofLogError("ICalendarZoneInfo::compile()") << "Directory: " << directory << " has no zones.tab.";
+        return false;
+    }
+
+    // Each line of zones.tab ends with the name of a timezone, optionally
+    // preceded by its coordinates.
+    std::vector<std::string> names;
+
+    const char* pLine = zonesTab.getData();
+    const char* pEnd = pLine + zonesTab.size();
+
+    while (pLine < pEnd)
+    {
+        const char* pLineEnd = std::find(pLine, pEnd, '\n');
+        const char* pNameEnd = pLineEnd;
+
+        while (pNameEnd > pLine && std::isspace(static_cast<unsigned char>(pNameEnd[-1])))
+        {
+            --pNameEnd;
+        }
+
+        const char* pName = pNameEnd;
+
+        while (pName > pLine && !std::isspace(static_cast<unsigned char>(pName[-1])))
+        {
+            --pName;
+        }
+
+        std::string name(pName, pNameEnd);
+
+        // Some entries name the file rather than the timezone.
+        if (name.size() > 4 && 0 == name.compare(name.size() - 4, 4, ".ics"))
+        {
+            name.erase(name.size() - 4);
+        }
+
+        if (!name.empty())
+        {
+            names.push_back(name);
+        }
+
+        pLine = pLineEnd < pEnd ? pLineEnd + 1 : pEnd;
+    }
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    std::vector<Zone> zones;
+    std::vector<Transition> transitions;
+    std::vector<char> strings;
+
+    std::vector<std::string>::const_iterator iter = names.begin();
+
+    while (iter != names.end())
+    {
+        const std::string& name = *iter++;
+
+        std::string zonePath = Poco::Path(base, Poco::Path(name + ".ics", Poco::Path::PATH_UNIX)).toString();
+
+        icalcomponent* pCalendar = ICalendarParser::parseFile(zonePath);
+
+        icalcomponent* pComponent = 0;
+
+        if (pCalendar)
+        {
+            if (ICAL_VTIMEZONE_COMPONENT == icalcomponent_isa(pCalendar))
+            {
+                pComponent = pCalendar;
+            }
+            else
+            {
+                pComponent = icalcomponent_get_first_component(pCalendar,
+                                                               ICAL_VTIMEZONE_COMPONENT);
+
+                if (pComponent)
+                {
+                    icalcomponent_remove_component(pCalendar, pComponent);
+                }
+
+                icalcomponent_free(pCalendar);
+            }
+        }
+
+        if (!pComponent)
+        {
+            ofLogError("ICalendarZoneInfo::compile()") << "File: " << zonePath << " has no VTIMEZONE.";
+            continue;
+        }
+
+        // The bundled files use vendor-prefixed TZIDs, but calendars refer
+        // to the timezones by name.
+        icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                                   ICAL_TZID_PROPERTY);
+
+        if (pProperty)
+        {
+            icalproperty_set_tzid(pProperty, name.c_str());
+        }
+        else
+        {
+            icalcomponent_add_property(pComponent, icalproperty_new_tzid(name.c_str()));
+        }
+
+        std::string definition(icalcomponent_as_ical_string(pComponent));
+
+        // The timezone owns and frees the component.
+        icaltimezone* pZone = icaltimezone_new();
+
+        if (!icaltimezone_set_component(pZone, pComponent))
+        {
+            ofLogError("ICalendarZoneInfo::compile()") << "File: " << zonePath << " has an invalid VTIMEZONE.";
+            icalcomponent_free(pComponent);
+            icaltimezone_free(pZone, 1);
+            continue;
+        }
+
+        ICalendarTimezoneTable table(pZone);
+
+        icaltimezone_free(pZone, 1);
+
+        Zone zone;
+        zone.name = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), name.begin(), name.end());
+        strings.push_back('\0');
+        zone.definition = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), definition.begin(), definition.end());
+        strings.push_back('\0');
+        zone.firstTransition = static_cast<uint32_t>(transitions.size());
+        zone.numTransitions = static_cast<uint32_t>(table.getTransitions().size());
+        zone.localStart = table.getLocalStart();
+        zone.offset = table.getInitialOffset();
+        zone.isDaylight = table.isInitiallyDaylight() ? 1 : 0;
+
+        zones.push_back(zone);
+
+        ICalendarTimezoneTable::Transitions::const_iterator transitionIter = table.getTransitions().begin();
+
+        while (transitionIter != table.getTransitions().end())
+        {
+            Transition transition;
+            transition.time = transitionIter->time;
+            transition.offset = transitionIter->offset;
+            transition.previousOffset = transitionIter->previousOffset;
+            transition.flags = (transitionIter->isDaylight ? IS_DAYLIGHT : 0) |
+                               (transitionIter->wasDaylight ? WAS_DAYLIGHT : 0);
+            transition.reserved = 0;
+
+            transitions.push_back(transition);
+
+            ++transitionIter;
+        }
+    }
+
+    if (zones.empty())
+    {
+        ofLogError("ICalendarZoneInfo::compile()") << "Directory: " << directory << " has no timezones.";
+        return false;
+    }
+
+    // Zero the header so that its padding is written deterministically.
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.byteOrder = 0x01020304;
+    header.numZones = static_cast<uint32_t>(zones.size());
+    header.numTransitions = static_cast<uint32_t>(transitions.size());
+    header.firstYear = ICalendarTimezoneTable::DEFAULT_FIRST_YEAR;
+    header.lastYear = ICalendarTimezoneTable::DEFAULT_LAST_YEAR;
+    header.zonesOffset = sizeof(Header);
+    header.transitionsOffset = header.zonesOffset + zones.size() * sizeof(Zone);
+    header.stringsOffset = header.transitionsOffset + transitions.size() * sizeof(Transition);
+    header.stringsSize = strings.size();
+
+    // Write a temporary file and rename it, so that a file mapped by
+    // another process is never truncated.
+    std::string temporaryPath = path + ".tmp";
+
+    try
+    {
+        Poco::FileOutputStream stream(temporaryPath,
+                                      std::ios::out | std::ios::binary | std::ios::trunc);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(&zones[0]), zones.size() * sizeof(Zone));
+
+        if (!transitions.empty())
+        {
+            stream.write(reinterpret_cast<const char*>(&transitions[0]),
+                         transitions.size() * sizeof(Transition));
+        }
+
+        stream.write(&strings[0], strings.size());
+        stream.close();
+
+        if (!stream.good())
+        {
+            ofLogError("ICalendarZoneInfo::compile()") << "File: " << temporaryPath << " could not be written.";
+            Poco::File(temporaryPath).remove();
+            return false;
+        }
+
+        Poco::File(temporaryPath).renameTo(path);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("ICalendarZoneInfo::compile()") << exc.displayText();
+        return false;
+    }
+
+    return true;
+}
+
+
+ICalendarZoneInfo::SharedPtr ICalendarZoneInfo::getDefault()
+{
+    static SharedPtr zoneInfo(new ICalendarZoneInfo());
+    return zoneInfo;
+}
+
+
+int ICalendarZoneInfo::find(const char* tzid) const
+{
+    if (!_pHeader || !tzid)
+    {
+        return NO_ZONE;
+    }
+
+    int index = findName(tzid);
+
+    // Strip a vendor prefix one path segment at a time.
+    const char* pName = std::strchr(tzid, '/');
+
+    while (NO_ZONE == index && pName)
+    {
+        ++pName;
+        index = findName(pName);
+        pName = std::strchr(pName, '/');
+    }
+
+    return index;
+}
+
+
+int ICalendarZoneInfo::findName(const char* name) const
+{
+    int low = 0;
+    int high = static_cast<int>(_pHeader->numZones);
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        int order = std::strcmp(_pStrings + _pZones[middle].name, name);
+
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else if (order > 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            return middle;
+        }
+    }
+
+    return NO_ZONE;
+}
+
+
+ICalendarTimezoneTable::SharedPtr ICalendarZoneInfo::getTable(int index) const
+{
+    ICalendarTimezoneTable::SharedPtr& table = _tables[index];
+
+    if (!table)
+    {
+        const Zone& zone = _pZones[index];
+
+        ICalendarTimezoneTable::Transitions transitions(zone.numTransitions);
+
+        for (std::size_t i = 0; i < transitions.size(); ++i)
+        {
+            const Transition& record = _pTransitions[zone.firstTransition + i];
+
+            transitions[i].time = record.time;
+            transitions[i].localTime = record.time + std::min(record.offset,
+                                                              record.previousOffset);
+            transitions[i].offset = record.offset;
+            transitions[i].previousOffset = record.previousOffset;
+            transitions[i].isDaylight = 0 != (record.flags & IS_DAYLIGHT);
+            transitions[i].wasDaylight = 0 != (record.flags & WAS_DAYLIGHT);
+        }
+
+        table = std::make_shared<ICalendarTimezoneTable>(_pHeader->firstYear,
+                                                         _pHeader->lastYear,
+                                                         zone.offset,
+                                                         0 != zone.isDaylight,
+                                                         zone.localStart,
+                                                         transitions);
+    }
+
+    return table;
+}
+
+
+icalcomponent* ICalendarZoneInfo::newComponent(int index, const char* tzid) const
+{
+    icalcomponent* pComponent = icalparser_parse_string(_pStrings + _pZones[index].definition);
+
+    if (!pComponent)
+    {
+        return 0;
+    }
+
+    if (ICAL_VTIMEZONE_COMPONENT != icalcomponent_isa(pComponent))
+    {
+        icalcomponent_free(pComponent);
+        return 0;
+    }
+
+    icalproperty* pProperty = icalcomponent_get_first_property(pComponent,
+                                                               ICAL_TZID_PROPERTY);
+
+    if (pProperty)
+    {
+        icalproperty_set_tzid(pProperty, tzid);
+    }
+
+    return pComponent;
+}
+
+
+bool ICalendarZoneInfo::validate() const
+{
+    const char* pData = _file.getData();
+    std::size_t size = _file.size();
+
+    if (!pData ||
+        size < sizeof(Header) ||
+        0 != reinterpret_cast<uintptr_t>(pData) % sizeof(int64_t))
+    {
+        return false;
+    }
+
+    const Header* pHeader = reinterpret_cast<const Header*>(pData);
+
+    if (0 != std::memcmp(pHeader->magic, MAGIC, sizeof(MAGIC)) ||
+        VERSION != pHeader->version ||
+        0x01020304 != pHeader->byteOrder ||
+        0 != pHeader->zonesOffset % sizeof(int64_t) ||
+        0 != pHeader->transitionsOffset % sizeof(int64_t) ||
+        pHeader->zonesOffset > size ||
+        pHeader->numZones > (size - pHeader->zonesOffset) / sizeof(Zone) ||
+        pHeader->transitionsOffset > size ||
+        pHeader->numTransitions > (size - pHeader->transitionsOffset) / sizeof(Transition) ||
+        pHeader->stringsOffset > size ||
+        pHeader->stringsSize > size - pHeader->stringsOffset ||
+        0 == pHeader->stringsSize ||
+        '\0' != pData[pHeader->stringsOffset + pHeader->stringsSize - 1])
+    {
+        return false;
+    }
+
+    const Zone* pZones = reinterpret_cast<const Zone*>(pData + pHeader->zonesOffset);
+    const char* pStrings = pData + pHeader->stringsOffset;
+
+    for (uint32_t i = 0; i < pHeader->numZones; ++i)
+    {
+        const Zone& zone = pZones[i];
+
+        if (zone.name >= pHeader->stringsSize ||
+            zone.definition >= pHeader->stringsSize ||
+            zone.firstTransition > pHeader->numTransitions ||
+            zone.numTransitions > pHeader->numTransitions - zone.firstTransition)
+        {
+            return false;
+        }
+
+        // The names must be sorted for find().
+        if (i > 0 && std::strcmp(pStrings + pZones[i - 1].name, pStrings + zone.name) >= 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void ICalendarZoneInfo::reset()
+{
+    _file.close();
+    _pHeader = 0;
+    _pZones = 0;
+    _pTransitions = 0;
+    _pStrings = 0;
+    _tables.clear();
+}
+
+
+} } // namespace ofx::Time
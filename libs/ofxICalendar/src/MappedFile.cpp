@@ -0,0 +1,154 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+
+#include "ofx/Time/MappedFile.h"
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace Time {
+
+
+MappedFile::MappedFile():
+    _pMapped(0),
+    _size(0)
+{
+}
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+#if !defined(_WIN32)
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if (0 != ::fstat(fd, &info))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (0 == info.st_size)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    void* pMapped = ::mmap(0,
+                           static_cast<std::size_t>(info.st_size),
+                           PROT_READ,
+                           MAP_PRIVATE,
+                           fd,
+                           0);
+
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+
+    if (MAP_FAILED != pMapped)
+    {
+        _pMapped = pMapped;
+        _size = static_cast<std::size_t>(info.st_size);
+        ::madvise(_pMapped, _size, MADV_SEQUENTIAL);
+        return true;
+    }
+#endif
+
+    std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+
+    if (!stream)
+    {
+        return false;
+    }
+
+    _buffer.assign(std::istreambuf_iterator<char>(stream),
+                   std::istreambuf_iterator<char>());
+    _size = _buffer.size();
+
+    return true;
+}
+
+
+void MappedFile::close()
+{
+#if !defined(_WIN32)
+    if (_pMapped)
+    {
+        ::munmap(_pMapped, _size);
+    }
+#endif
+
+    _pMapped = 0;
+    _size = 0;
+    _buffer.clear();
+}
+
+
+const char* MappedFile::getData() const
+{
+    if (_pMapped)
+    {
+        return static_cast<const char*>(_pMapped);
+    }
+    else if (!_buffer.empty())
+    {
+        return &_buffer[0];
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+
+std::size_t MappedFile::size() const
+{
+    return _size;
+}
+
+
+} } // namespace ofx::Time
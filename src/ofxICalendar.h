@@ -24,9 +24,25 @@
 
 
 #include "ofxTime.h"
+#include "ofx/Time/CompiledCalendar.h"
 #include "ofx/Time/ICalendar.h"
+#include "ofx/Time/ICalendarChangeSet.h"
 #include "ofx/Time/ICalendarEvent.h"
+#include "ofx/Time/ICalendarEventIndex.h"
 #include "ofx/Time/ICalendarEventInstance.h"
+#include "ofx/Time/ICalendarExpansionPool.h"
+#include "ofx/Time/ICalendarInstanceIndex.h"
 #include "ofx/Time/ICalendarInterface.h"
+#include "ofx/Time/ICalendarParser.h"
+#include "ofx/Time/ICalendarRecurrenceCache.h"
+#include "ofx/Time/ICalendarRecurrenceIterator.h"
+#include "ofx/Time/ICalendarRefreshScheduler.h"
+#include "ofx/Time/ICalendarSet.h"
+#include "ofx/Time/ICalendarSnapshot.h"
+#include "ofx/Time/ICalendarSnapshotCache.h"
+#include "ofx/Time/ICalendarTimezoneTable.h"
 #include "ofx/Time/ICalendarWatcher.h"
 #include "ofx/Time/ICalendarWatcherEvents.h"
+#include "ofx/Time/ICalendarWriter.h"
+#include "ofx/Time/ICalendarZoneInfo.h"
+#include "ofx/Time/MappedFile.h"
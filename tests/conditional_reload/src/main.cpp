@@ -0,0 +1,201 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+
+// Reloads an ICalendar from a local HTTP server that answers conditional
+// requests and checks which reloads were answered with 304 Not Modified,
+// including after the server changes the ETag of unchanged content.
+//
+// Run without arguments.  The process returns 0 if every check passed.
+// Conditional requests need openFrameworks 0.10 or later.
+
+
+#include <cstdio>
+#include <string>
+#include "Poco/Mutex.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/HTTPResponse.h"
+#include "Poco/Net/HTTPServer.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/ServerSocket.h"
+#include "ofx/Time/ICalendar.h"
+
+
+using namespace ofx::Time;
+
+
+static const std::string CALENDAR =
+    "BEGIN:VCALENDAR\r\n"
+    "VERSION:2.0\r\n"
+    "PRODID:-//ofxICalendar//conditional_reload//EN\r\n"
+    "BEGIN:VEVENT\r\n"
+    "UID:conditional-reload-1\r\n"
+    "DTSTART:20300101T100000Z\r\n"
+    "DTEND:20300101T110000Z\r\n"
+    "SUMMARY:Conditional reload\r\n"
+    "END:VEVENT\r\n"
+    "END:VCALENDAR\r\n";
+
+
+/// \brief The content served by the test server.
+struct ServerState
+{
+    Poco::Mutex mutex;
+    std::string body;
+    std::string etag;
+    int numOK;
+    int numNotModified;
+};
+
+
+static ServerState state;
+
+
+class CalendarRequestHandler: public Poco::Net::HTTPRequestHandler
+{
+public:
+    void handleRequest(Poco::Net::HTTPServerRequest& request,
+                       Poco::Net::HTTPServerResponse& response)
+    {
+        Poco::Mutex::ScopedLock lock(state.mutex);
+
+        if (request.get("If-None-Match", "") == state.etag)
+        {
+            ++state.numNotModified;
+            response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED);
+            response.set("ETag", state.etag);
+            response.send();
+            return;
+        }
+
+        ++state.numOK;
+        response.set("ETag", state.etag);
+        response.setContentType("text/calendar");
+        response.setContentLength(state.body.size());
+        response.send() << state.body;
+    }
+
+};
+
+
+class CalendarRequestHandlerFactory: public Poco::Net::HTTPRequestHandlerFactory
+{
+public:
+    Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest& request)
+    {
+        return new CalendarRequestHandler();
+    }
+
+};
+
+
+static void setContent(const std::string& body, const std::string& etag)
+{
+    Poco::Mutex::ScopedLock lock(state.mutex);
+    state.body = body;
+    state.etag = etag;
+}
+
+
+static int check(ICalendar& calendar,
+                 const char* step,
+                 uint64_t unchanged,
+                 uint64_t notModified)
+{
+    calendar.reload();
+
+    // There is no openFrameworks update loop to publish the snapshot.
+    calendar.publishPendingSnapshot();
+
+    ICalendar::ReloadStatistics statistics = calendar.getReloadStatistics();
+
+    if (!calendar.isLoaded())
+    {
+        std::printf("%s: the calendar is not loaded.\n", step);
+        return 1;
+    }
+
+    if (statistics.unchanged != unchanged ||
+        statistics.notModified != notModified ||
+        statistics.failures != 0)
+    {
+        std::printf("%s: %llu unchanged, %llu not modified, %llu failures, expected %llu, %llu, 0.\n",
+                    step,
+                    static_cast<unsigned long long>(statistics.unchanged),
+                    static_cast<unsigned long long>(statistics.notModified),
+                    static_cast<unsigned long long>(statistics.failures),
+                    static_cast<unsigned long long>(unchanged),
+                    static_cast<unsigned long long>(notModified));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main()
+{
+    state.numOK = 0;
+    state.numNotModified = 0;
+    setContent(CALENDAR, "\"v1\"");
+
+    Poco::Net::ServerSocket socket(0);
+    Poco::Net::HTTPServer server(new CalendarRequestHandlerFactory(),
+                                 socket,
+                                 new Poco::Net::HTTPServerParams());
+    server.start();
+
+    ICalendar calendar("http://127.0.0.1:" +
+                       std::to_string(socket.address().port()) +
+                       "/calendar.ics");
+
+    int numFailures = 0;
+
+    numFailures += check(calendar, "First reload", 0, 0);
+    numFailures += check(calendar, "Same ETag", 0, 1);
+
+    // The same content under a new ETag is downloaded, but its hash matches
+    // the loaded content, so it is not parsed and is counted as unchanged.
+    // The next request must send the new ETag.
+    setContent(CALENDAR, "\"v2\"");
+    numFailures += check(calendar, "New ETag", 1, 1);
+    numFailures += check(calendar, "Same new ETag", 1, 2);
+
+    setContent(CALENDAR + "\r\n", "\"v3\"");
+    numFailures += check(calendar, "New content", 1, 2);
+    numFailures += check(calendar, "Same new content", 1, 3);
+
+    server.stop();
+
+    std::printf("%d checks failed, server sent %d full and %d not modified responses.\n",
+                numFailures,
+                state.numOK,
+                state.numNotModified);
+
+    return numFailures > 0 ? 1 : 0;
+}
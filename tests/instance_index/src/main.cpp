@@ -0,0 +1,254 @@
+// =============================================================================
+//
+// Copyright (c) 2013 Christopher Baker <http://christopherbaker.net>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// =============================================================================
+
+
+// Compares ICalendarInstanceIndex queries against a brute-force expansion of
+// every VEVENT with icalcomponent_foreach_recurrence() on random calendars.
+//
+// Run without arguments.  The process returns 0 if every query matched.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "ofx/Time/CompiledCalendar.h"
+#include "ofx/Time/ICalendarInstanceIndex.h"
+#include "ofx/Time/ICalendarUtils.h"
+
+
+using namespace ofx::Time;
+
+
+typedef ICalendarInstanceIndex::Instance Instance;
+typedef ICalendarInstanceIndex::Instances Instances;
+
+
+static bool compareInstances(const Instance& lhs, const Instance& rhs)
+{
+    if (lhs.row != rhs.row) return lhs.row < rhs.row;
+    if (lhs.start != rhs.start) return lhs.start < rhs.start;
+    return lhs.end < rhs.end;
+}
+
+
+static bool equalInstances(const Instance& lhs, const Instance& rhs)
+{
+    return lhs.row == rhs.row && lhs.start == rhs.start && lhs.end == rhs.end;
+}
+
+
+struct BruteForceData
+{
+    Instances* pInstances;
+    std::size_t row;
+    int64_t start;
+    int64_t end;
+};
+
+
+static void bruteForceCallback(icalcomponent* component,
+                               struct icaltime_span* timeSpan,
+                               void* data)
+{
+    BruteForceData* pData = reinterpret_cast<BruteForceData*>(data);
+
+    if (ICalendarUtils::spansOverlap(timeSpan->start,
+                                     timeSpan->end,
+                                     pData->start,
+                                     pData->end))
+    {
+        Instance instance = { timeSpan->start, timeSpan->end, pData->row };
+        pData->pInstances->push_back(instance);
+    }
+}
+
+
+static std::string formatTime(int64_t time)
+{
+    struct icaltimetype t = icaltime_from_timet(time, false);
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%04d%02d%02dT%02d%02d%02dZ",
+                  t.year, t.month, t.day, t.hour, t.minute, t.second);
+    return buffer;
+}
+
+
+static std::string makeCalendar(std::mt19937& random,
+                                int64_t horizonStart,
+                                int64_t horizonEnd)
+{
+    static const char* rules[] = {
+        "",
+        "",
+        "RRULE:FREQ=DAILY;COUNT=10\r\n",
+        "RRULE:FREQ=HOURLY;INTERVAL=7;COUNT=30\r\n",
+        "RRULE:FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=12\r\n"
+    };
+
+    std::uniform_int_distribution<int> numEvents(0, 300);
+    std::uniform_int_distribution<int64_t> offset(-86400, horizonEnd - horizonStart + 86400);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::uniform_int_distribution<int64_t> duration(1, 3 * 86400);
+    std::uniform_int_distribution<int> rule(0, 4);
+
+    std::string ics = "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:test\r\n";
+
+    int n = numEvents(random);
+
+    for (int i = 0; i < n; ++i)
+    {
+        int64_t start = horizonStart + offset(random);
+        int64_t length = duration(random);
+
+        switch (kind(random))
+        {
+            case 0:
+                // Zero-length instances on the horizon boundaries.
+                start = horizonStart;
+                length = 0;
+                break;
+            case 1:
+                start = horizonEnd;
+                length = 0;
+                break;
+            case 2:
+                length = 0;
+                break;
+            case 3:
+                // Long instances that cover much of the horizon.
+                length *= 20;
+                break;
+        }
+
+        char uid[32];
+        std::snprintf(uid, sizeof(uid), "event-%d", i);
+
+        ics += "BEGIN:VEVENT\r\nUID:";
+        ics += uid;
+        ics += "\r\nDTSTART:" + formatTime(start);
+        ics += "\r\nDTEND:" + formatTime(start + length) + "\r\n";
+        ics += rules[rule(random)];
+        ics += "END:VEVENT\r\n";
+    }
+
+    ics += "END:VCALENDAR\r\n";
+
+    return ics;
+}
+
+
+int main()
+{
+    std::mt19937 random(20140101);
+
+    const int64_t horizonStart = 1388534400; // 2014-01-01
+    const int64_t horizonEnd = horizonStart + 60 * 86400;
+
+    std::uniform_int_distribution<int64_t> queryStart(horizonStart, horizonEnd);
+    std::uniform_int_distribution<int64_t> queryLength(0, 5 * 86400);
+    std::uniform_int_distribution<int> point(0, 9);
+
+    int numFailures = 0;
+    int numQueries = 0;
+
+    for (int trial = 0; trial < 200; ++trial)
+    {
+        std::string ics = makeCalendar(random, horizonStart, horizonEnd);
+
+        icalcomponent* pCalendar = icalparser_parse_string(ics.c_str());
+
+        CompiledCalendar compiled;
+        compiled.compile(pCalendar);
+
+        Interval horizon(Poco::Timestamp::fromEpochTime(horizonStart),
+                         Poco::Timestamp::fromEpochTime(horizonEnd));
+
+        ICalendarInstanceIndex index;
+        index.build(compiled, horizon);
+
+        for (int q = 0; q < 40; ++q)
+        {
+            int64_t start = queryStart(random);
+            int64_t end = start;
+
+            switch (point(random))
+            {
+                case 0:
+                    start = end = horizonStart;
+                    break;
+                case 1:
+                    start = end = horizonEnd;
+                    break;
+                case 2:
+                    break;
+                default:
+                    end = std::min(start + queryLength(random), horizonEnd);
+                    break;
+            }
+
+            Instances expected;
+
+            for (std::size_t row = 0; row < compiled.size(); ++row)
+            {
+                BruteForceData data = { &expected, row, start, end };
+
+                icalcomponent_foreach_recurrence(compiled.getComponent(row),
+                                                 icaltime_from_timet(horizonStart - 86400, false),
+                                                 icaltime_from_timet(horizonEnd + 86400, false),
+                                                 &bruteForceCallback,
+                                                 &data);
+            }
+
+            Instances actual;
+
+            index.query(Interval(Poco::Timestamp::fromEpochTime(start),
+                                 Poco::Timestamp::fromEpochTime(end)),
+                        actual);
+
+            std::sort(expected.begin(), expected.end(), &compareInstances);
+            std::sort(actual.begin(), actual.end(), &compareInstances);
+
+            ++numQueries;
+
+            if (expected.size() != actual.size() ||
+                !std::equal(expected.begin(), expected.end(), actual.begin(), &equalInstances))
+            {
+                std::printf("Trial %d: query [%lld, %lld] returned %d instances, expected %d.\n",
+                            trial,
+                            static_cast<long long>(start),
+                            static_cast<long long>(end),
+                            static_cast<int>(actual.size()),
+                            static_cast<int>(expected.size()));
+                ++numFailures;
+            }
+        }
+
+        icalcomponent_free(pCalendar);
+    }
+
+    std::printf("%d of %d queries failed.\n", numFailures, numQueries);
+
+    return numFailures > 0 ? 1 : 0;
+}